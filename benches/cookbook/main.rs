@@ -0,0 +1,315 @@
+//! Benchmarks of cookbook hot paths on a synthetic recipe tree.
+//!
+//! ```sh
+//! cargo bench --bench cookbook -- [FILTER] [--scale=small|large]
+//!     [--save-baseline=NAME] [--baseline=NAME]
+//! ```
+//!
+//! The tree is generated once per scale under cargo's target tmpdir. Each
+//! benchmark runs until it has taken a second and at least ten samples, and
+//! reports the median with its median absolute deviation. A run compared to a
+//! saved baseline fails if any median got slower by more than 10% plus three
+//! times its noise.
+
+mod synth;
+
+use std::collections::BTreeMap;
+use std::env;
+use std::fs;
+use std::path::{Path, PathBuf};
+use std::process::{self, Command, Stdio};
+use std::time::{Duration, Instant};
+
+use cookbook::WALK_DEPTH;
+use cookbook::cook::cook_build::{auto_deps_from_dynamic_linking, build_deps_dir};
+use cookbook::cook::fs::modified_dir_ignore_git;
+use cookbook::recipe::CookRecipe;
+use cookbook::staged_pkg;
+use cookbook::web::search::FileIndexBuilder;
+use serde::{Deserialize, Serialize};
+
+use synth::{Params, Tree};
+
+const MIN_SAMPLES: usize = 10;
+const MAX_SAMPLES: usize = 1000;
+const MIN_TIME: Duration = Duration::from_secs(1);
+const REGRESSION: f64 = 0.10;
+
+/// Set in a child process that measures `staged_pkg` startup in this dir.
+const STARTUP_ENV: &str = "COOKBOOK_BENCH_STARTUP";
+
+#[derive(Clone, Copy, Deserialize, Serialize)]
+struct Estimate {
+    /// in nanoseconds
+    median: f64,
+    /// median absolute deviation, in nanoseconds
+    mad: f64,
+}
+
+fn median(sorted: &[f64]) -> f64 {
+    let mid = sorted.len() / 2;
+    if sorted.len() % 2 == 0 {
+        (sorted[mid - 1] + sorted[mid]) / 2.0
+    } else {
+        sorted[mid]
+    }
+}
+
+impl Estimate {
+    fn of(samples: &[Duration]) -> Self {
+        let mut ns: Vec<f64> = samples.iter().map(|d| d.as_nanos() as f64).collect();
+        ns.sort_by(f64::total_cmp);
+        let median = median(&ns);
+        let mut deviations: Vec<f64> = ns.iter().map(|n| (n - median).abs()).collect();
+        deviations.sort_by(f64::total_cmp);
+        Self {
+            median,
+            mad: median(&deviations),
+        }
+    }
+
+    fn regressed_from(&self, base: &Estimate) -> bool {
+        self.median > base.median * (1.0 + REGRESSION) + 3.0 * self.mad.max(base.mad)
+    }
+}
+
+fn format_ns(ns: f64) -> String {
+    if ns >= 1e9 {
+        format!("{:.3} s", ns / 1e9)
+    } else if ns >= 1e6 {
+        format!("{:.3} ms", ns / 1e6)
+    } else if ns >= 1e3 {
+        format!("{:.3} µs", ns / 1e3)
+    } else {
+        format!("{ns:.0} ns")
+    }
+}
+
+struct Bench {
+    filter: Option<String>,
+    baseline: Option<BTreeMap<String, Estimate>>,
+    results: BTreeMap<String, Estimate>,
+    regressions: usize,
+}
+
+impl Bench {
+    fn enabled(&self, name: &str) -> bool {
+        self.filter
+            .as_ref()
+            .is_none_or(|f| name.contains(f.as_str()))
+    }
+
+    /// Collect samples of `measure`, which returns the duration of one run.
+    fn sample(&mut self, name: &str, mut measure: impl FnMut() -> Duration) {
+        if !self.enabled(name) {
+            return;
+        }
+        // warm up caches, lazy statics and the page cache
+        measure();
+        let mut samples = Vec::new();
+        let mut total = Duration::ZERO;
+        while samples.len() < MAX_SAMPLES && (samples.len() < MIN_SAMPLES || total < MIN_TIME) {
+            let elapsed = measure();
+            total += elapsed;
+            samples.push(elapsed);
+        }
+        let estimate = Estimate::of(&samples);
+        let mut line = format!(
+            "{name:<48} {:>12} ± {:<12} ({} samples)",
+            format_ns(estimate.median),
+            format_ns(estimate.mad),
+            samples.len()
+        );
+        if let Some(base) = self.baseline.as_ref().and_then(|b| b.get(name)) {
+            let change = (estimate.median / base.median - 1.0) * 100.0;
+            line.push_str(&format!(" {change:+.1}%"));
+            if estimate.regressed_from(base) {
+                line.push_str(" REGRESSED");
+                self.regressions += 1;
+            }
+        }
+        println!("{line}");
+        self.results.insert(name.to_string(), estimate);
+    }
+
+    fn run(&mut self, name: &str, mut routine: impl FnMut()) {
+        self.sample(name, || {
+            let start = Instant::now();
+            routine();
+            start.elapsed()
+        });
+    }
+
+    /// Like [`Bench::run`], with an untimed `setup` before every run.
+    fn run_with_setup<T>(
+        &mut self,
+        name: &str,
+        mut setup: impl FnMut() -> T,
+        mut routine: impl FnMut(T),
+    ) {
+        self.sample(name, || {
+            let input = setup();
+            let start = Instant::now();
+            routine(input);
+            start.elapsed()
+        });
+    }
+}
+
+fn startup_child() {
+    let start = Instant::now();
+    let _ = staged_pkg::find("synth-00000");
+    println!("{}", start.elapsed().as_nanos());
+}
+
+/// Time `staged_pkg` startup in a fresh process, as its recipe index is
+/// built only once per process.
+fn startup_sample(root: &Path) -> Duration {
+    let output = Command::new(env::current_exe().unwrap())
+        .current_dir(root)
+        .env(STARTUP_ENV, "1")
+        .stderr(Stdio::inherit())
+        .output()
+        .unwrap();
+    let ns = String::from_utf8_lossy(&output.stdout)
+        .trim()
+        .parse()
+        .unwrap();
+    Duration::from_nanos(ns)
+}
+
+/// `repo cook` of everything that is already cooked.
+fn repo_cook(root: &Path, names: &[String]) -> Command {
+    let mut command = Command::new(env!("CARGO_BIN_EXE_repo"));
+    command
+        .arg("cook")
+        .args(names)
+        .current_dir(root)
+        .env("CI", "1")
+        .env("COOKBOOK_OFFLINE", "true")
+        .env("COOKBOOK_LOGS", "false")
+        .env("COOKBOOK_VERBOSE", "false")
+        .env("COOKBOOK_TAR_STORE", "")
+        .stdout(Stdio::null())
+        .stderr(Stdio::null());
+    command
+}
+
+fn main() {
+    if env::var_os(STARTUP_ENV).is_some() {
+        startup_child();
+        return;
+    }
+
+    let mut filter = None;
+    let mut scale = "small".to_string();
+    let mut save_baseline = None;
+    let mut baseline = None;
+    for arg in env::args().skip(1) {
+        if let Some(value) = arg.strip_prefix("--scale=") {
+            scale = value.to_string();
+        } else if let Some(value) = arg.strip_prefix("--save-baseline=") {
+            save_baseline = Some(value.to_string());
+        } else if let Some(value) = arg.strip_prefix("--baseline=") {
+            baseline = Some(value.to_string());
+        } else if !arg.starts_with("--") {
+            filter = Some(arg);
+        }
+        // other flags, such as the --bench passed by cargo, are ignored
+    }
+    let Some(params) = Params::scale(&scale) else {
+        eprintln!("unknown scale {scale:?}, expected small or large");
+        process::exit(2);
+    };
+
+    let work_dir = PathBuf::from(env!("CARGO_TARGET_TMPDIR")).join("cookbook-bench");
+    let baseline_path = |name: &str| {
+        work_dir
+            .join("baselines")
+            .join(format!("{name}-{scale}.toml"))
+    };
+    let baseline: Option<BTreeMap<String, Estimate>> = baseline.map(|name| {
+        let path = baseline_path(&name);
+        let content = fs::read_to_string(&path)
+            .unwrap_or_else(|e| panic!("reading baseline {}: {e}", path.display()));
+        toml::from_str(&content).unwrap()
+    });
+
+    let generating = Instant::now();
+    let tree = Tree::open(&work_dir.join(format!("tree-{scale}")), params);
+    eprintln!(
+        "synthetic tree {} ready in {}",
+        tree.root.display(),
+        format_ns(generating.elapsed().as_nanos() as f64)
+    );
+    // the cookbook resolves recipes/ and build/ relative to the working dir
+    env::set_current_dir(&tree.root).unwrap();
+
+    let mut bench = Bench {
+        filter,
+        baseline,
+        results: BTreeMap::new(),
+        regressions: 0,
+    };
+    let tops = tree.tops();
+
+    bench.sample("staged_pkg/startup", || startup_sample(&tree.root));
+    bench.run("staged_pkg/new_recursive", || {
+        staged_pkg::new_recursive(&tops, false, WALK_DEPTH).unwrap();
+    });
+    bench.run("recipe/get_all_deps_names_recursive", || {
+        CookRecipe::get_all_deps_names_recursive(&tops, true).unwrap();
+    });
+    bench.run("fs/modified_dir_ignore_git", || {
+        modified_dir_ignore_git(&tree.source_dir()).unwrap();
+    });
+
+    let files = tree.file_tree(params.source_files);
+    bench.run_with_setup(
+        "search/file_index_parse",
+        FileIndexBuilder::new,
+        |mut index| index.parse("synth", &files),
+    );
+
+    let stage_dirs = tree.stage_dirs();
+    let dep_pkgars = tree.dep_pkgars();
+    bench.run("cook_build/auto_deps_from_dynamic_linking", || {
+        auto_deps_from_dynamic_linking(&stage_dirs, &dep_pkgars, &None);
+    });
+
+    let sysroot = tree.root.join("sysroot");
+    bench.run_with_setup(
+        "cook_build/build_deps_dir",
+        || {
+            let _ = fs::remove_dir_all(&sysroot);
+        },
+        |()| {
+            build_deps_dir(&None, &sysroot, &dep_pkgars).unwrap();
+        },
+    );
+    bench.run("cook_build/build_deps_dir_cached", || {
+        assert!(build_deps_dir(&None, &sysroot, &dep_pkgars).unwrap());
+    });
+
+    let names: Vec<String> = tops.iter().map(|n| n.as_str().to_string()).collect();
+    if bench.enabled("repo/cook_noop") {
+        // the first cook does the actual work
+        match repo_cook(&tree.root, &names).status() {
+            Ok(status) if status.success() => bench.run("repo/cook_noop", || {
+                assert!(repo_cook(&tree.root, &names).status().unwrap().success());
+            }),
+            result => eprintln!("repo/cook_noop skipped, first cook failed: {result:?}"),
+        }
+    }
+
+    if let Some(name) = save_baseline {
+        let path = baseline_path(&name);
+        fs::create_dir_all(path.parent().unwrap()).unwrap();
+        fs::write(&path, toml::to_string(&bench.results).unwrap()).unwrap();
+        eprintln!("saved baseline {}", path.display());
+    }
+    if bench.regressions > 0 {
+        eprintln!("{} benchmarks regressed", bench.regressions);
+        process::exit(1);
+    }
+}
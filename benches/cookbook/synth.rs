@@ -0,0 +1,312 @@
+//! Generator for synthetic cookbook trees.
+//!
+//! A tree has `recipes/<category>/<name>/recipe.toml` files forming dependency
+//! chains, a staged `stage.toml` for each of them, one large source tree with
+//! a `.git` dir, signed dependency pkgars providing shared libraries and stage
+//! dirs holding ELF binaries that need them. Everything is derived from a
+//! fixed seed, so a tree with the same parameters is identical across runs and
+//! is only generated once.
+
+use std::collections::BTreeSet;
+use std::fs;
+use std::path::{Path, PathBuf};
+
+use cookbook::cook::fs::serialize_and_write;
+use pkg::{Package, PackageName};
+use pkgar_core::HeaderFlags;
+
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct Params {
+    pub recipes: usize,
+    /// length of each dependency chain, must stay below `WALK_DEPTH`
+    pub chain_depth: usize,
+    /// extra dependencies on recipes of earlier chains
+    pub cross_deps: usize,
+    pub source_files: usize,
+    pub dep_pkgars: usize,
+    pub stage_dirs: usize,
+    pub elfs_per_stage: usize,
+}
+
+impl Params {
+    pub fn scale(name: &str) -> Option<Self> {
+        match name {
+            "small" => Some(Self {
+                recipes: 2000,
+                chain_depth: 12,
+                cross_deps: 2,
+                source_files: 20_000,
+                dep_pkgars: 32,
+                stage_dirs: 16,
+                elfs_per_stage: 4,
+            }),
+            "large" => Some(Self {
+                recipes: 10_000,
+                chain_depth: 12,
+                cross_deps: 4,
+                source_files: 100_000,
+                dep_pkgars: 128,
+                stage_dirs: 64,
+                elfs_per_stage: 8,
+            }),
+            _ => None,
+        }
+    }
+}
+
+/// xorshift64*, good enough to shape a tree and stable across platforms
+pub struct Rng(u64);
+
+impl Rng {
+    pub fn new(seed: u64) -> Self {
+        Self(seed.max(1))
+    }
+
+    pub fn next(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545_f491_4f6c_dd1d)
+    }
+
+    pub fn below(&mut self, n: usize) -> usize {
+        (self.next() % n.max(1) as u64) as usize
+    }
+}
+
+const CATEGORIES: [&str; 8] = [
+    "core", "dev", "libs", "net", "tools", "games", "gui", "demos",
+];
+
+pub struct Tree {
+    pub root: PathBuf,
+    pub params: Params,
+}
+
+impl Tree {
+    pub fn recipe_name(i: usize) -> String {
+        format!("synth-{i:05}")
+    }
+
+    pub fn recipe_dir(&self, i: usize) -> PathBuf {
+        self.root
+            .join("recipes")
+            .join(CATEGORIES[i % CATEGORIES.len()])
+            .join(Self::recipe_name(i))
+    }
+
+    /// Last recipe of every chain, which depends on all others of the chain.
+    pub fn tops(&self) -> Vec<PackageName> {
+        let depth = self.params.chain_depth;
+        (0..self.params.recipes)
+            .filter(|i| i % depth == depth - 1)
+            .map(|i| PackageName::new(Self::recipe_name(i)).unwrap())
+            .collect()
+    }
+
+    pub fn source_dir(&self) -> PathBuf {
+        self.root.join("source")
+    }
+
+    pub fn stage_dirs(&self) -> Vec<PathBuf> {
+        (0..self.params.stage_dirs)
+            .map(|i| self.root.join("stages").join(format!("stage-{i}")))
+            .collect()
+    }
+
+    pub fn dep_pkgars(&self) -> BTreeSet<(PackageName, PathBuf)> {
+        (0..self.params.dep_pkgars)
+            .map(|i| {
+                let name = format!("synth-lib{i}");
+                let path = self.root.join("pkgars").join(format!("{name}.pkgar"));
+                (PackageName::new(name).unwrap(), path)
+            })
+            .collect()
+    }
+
+    /// `stage.files` listing, as written by `walk_file_tree`, of a package
+    /// with `files` entries.
+    pub fn file_tree(&self, files: usize) -> String {
+        let mut rng = Rng::new(files as u64);
+        let mut lines = Vec::new();
+        for dir in ["bin", "include", "lib", "share"] {
+            lines.push(format!("├── {dir}/"));
+            for f in 0..files / 4 {
+                if f % 16 == 0 && rng.below(2) == 0 {
+                    lines.push(format!("│   ├── {dir}{f}/"));
+                }
+                let size = rng.below(1000);
+                lines.push(format!("│   │   ├── {dir}-{f} ({size} KiB)"));
+            }
+        }
+        lines.join("\n")
+    }
+
+    /// Open the tree at `root`, generating it first unless it was already
+    /// generated with the same parameters.
+    pub fn open(root: &Path, params: Params) -> Self {
+        let tree = Self {
+            root: root.to_path_buf(),
+            params,
+        };
+        let stamp = root.join("params");
+        let wanted = format!("{params:?}");
+        if fs::read_to_string(&stamp).is_ok_and(|s| s == wanted) {
+            return tree;
+        }
+        let _ = fs::remove_dir_all(root);
+        fs::create_dir_all(root).unwrap();
+        tree.gen_recipes();
+        tree.gen_source();
+        tree.gen_pkgars();
+        tree.gen_stages();
+        fs::write(&stamp, wanted).unwrap();
+        tree
+    }
+
+    fn gen_recipes(&self) {
+        let mut rng = Rng::new(0xc00c_b00c);
+        let Params {
+            recipes,
+            chain_depth,
+            cross_deps,
+            ..
+        } = self.params;
+        let target = redoxer::target();
+        for i in 0..recipes {
+            let mut deps = BTreeSet::new();
+            let chain_start = i - i % chain_depth;
+            if i != chain_start {
+                deps.insert(i - 1);
+                // bottoms of earlier chains have no dependencies,
+                // so no walk gets deeper than one chain
+                for _ in 0..cross_deps {
+                    if chain_start > 0 {
+                        deps.insert(rng.below(chain_start / chain_depth) * chain_depth);
+                    }
+                }
+            }
+            let deps: Vec<String> = deps.into_iter().map(Self::recipe_name).collect();
+
+            let dir = self.recipe_dir(i);
+            fs::create_dir_all(dir.join("target").join(target)).unwrap();
+            let quoted: Vec<String> = deps.iter().map(|d| format!("{d:?}")).collect();
+            fs::write(
+                dir.join("recipe.toml"),
+                format!(
+                    "[build]\ntemplate = \"none\"\ndependencies = [{0}]\n\n\
+                     [package]\ndependencies = [{0}]\n",
+                    quoted.join(", ")
+                ),
+            )
+            .unwrap();
+
+            let package = Package {
+                name: PackageName::new(Self::recipe_name(i)).unwrap(),
+                version: "1.0.0".into(),
+                target: target.to_string(),
+                depends: deps
+                    .iter()
+                    .map(|d| PackageName::new(d.clone()).unwrap())
+                    .collect(),
+                ..Default::default()
+            };
+            serialize_and_write(
+                &dir.join("target").join(target).join("stage.toml"),
+                &package,
+            )
+            .unwrap();
+        }
+    }
+
+    fn gen_source(&self) {
+        let mut rng = Rng::new(0x5eed);
+        let source = self.source_dir();
+        let mut dirs = vec![source.clone()];
+        for i in 0..self.params.source_files {
+            // new dirs at a rate that gives a few dozen files per dir
+            if rng.below(32) == 0 {
+                let parent = dirs[rng.below(dirs.len())].clone();
+                dirs.push(parent.join(format!("d{i}")));
+            }
+            let dir = &dirs[rng.below(dirs.len())];
+            fs::create_dir_all(dir).unwrap();
+            fs::write(
+                dir.join(format!("f{i}.c")),
+                b"int main(void) { return 0; }\n",
+            )
+            .unwrap();
+        }
+        let objects = source.join(".git").join("objects");
+        for i in 0..self.params.source_files / 4 {
+            let dir = objects.join(format!("{:02x}", i % 256));
+            fs::create_dir_all(&dir).unwrap();
+            fs::write(dir.join(format!("{i:038x}")), b"blob").unwrap();
+        }
+    }
+
+    fn gen_pkgars(&self) {
+        let build = self.root.join("build");
+        fs::create_dir_all(&build).unwrap();
+        let secret_path = build.join("id_ed25519.toml");
+        let public_path = build.join("id_ed25519.pub.toml");
+        let (public_key, secret_key) = pkgar_keys::SecretKeyFile::new();
+        public_key.save(public_path.to_str().unwrap()).unwrap();
+        secret_key.save(secret_path.to_str().unwrap()).unwrap();
+
+        for (i, (name, pkgar)) in self.dep_pkgars().into_iter().enumerate() {
+            let stage = self.root.join("pkgar-stages").join(name.as_str());
+            let lib = stage.join("usr/lib");
+            let include = stage.join("usr/include").join(name.as_str());
+            fs::create_dir_all(&lib).unwrap();
+            fs::create_dir_all(&include).unwrap();
+            // the first one provides what the ELF stubs need
+            let libs = if i == 0 {
+                vec!["libc.so.6".to_string(), "libgcc_s.so.1".to_string()]
+            } else {
+                vec![format!("lib{}.so", name.as_str())]
+            };
+            for lib_name in libs {
+                fs::write(lib.join(lib_name), vec![0; 4096]).unwrap();
+            }
+            for h in 0..32 {
+                fs::write(include.join(format!("h{h}.h")), b"#pragma once\n").unwrap();
+            }
+            fs::create_dir_all(pkgar.parent().unwrap()).unwrap();
+            pkgar::create_with_flags(
+                secret_path.to_str().unwrap(),
+                pkgar.to_str().unwrap(),
+                stage.to_str().unwrap(),
+                HeaderFlags::latest(
+                    pkgar_core::Architecture::Independent,
+                    pkgar_core::Packaging::Uncompressed,
+                ),
+            )
+            .unwrap();
+        }
+    }
+
+    fn gen_stages(&self) {
+        let elf = elf_stub();
+        for stage in self.stage_dirs() {
+            for dir in ["usr/bin", "usr/lib"] {
+                fs::create_dir_all(stage.join(dir)).unwrap();
+            }
+            for e in 0..self.params.elfs_per_stage {
+                let dir = if e % 2 == 0 { "usr/bin" } else { "usr/lib" };
+                fs::write(stage.join(dir).join(format!("elf{e}")), &elf).unwrap();
+            }
+            for f in 0..64 {
+                fs::write(stage.join("usr/lib").join(format!("data{f}.txt")), b"x").unwrap();
+            }
+        }
+    }
+}
+
+/// A small dynamically linked ELF, copied from the host.
+fn elf_stub() -> Vec<u8> {
+    ["/bin/true", "/usr/bin/true"]
+        .iter()
+        .find_map(|p| fs::read(p).ok())
+        .unwrap_or_else(|| fs::read(std::env::current_exe().unwrap()).unwrap())
+}
@@ -117,28 +117,16 @@ else
 	$(REPO_BIN) cook-tree $(foreach f,$(subst $(comma), ,$*),$(f)) $(COOKBOOK_OPTS)
 endif
 
-MOUNTED_TAG=$(MOUNT_DIR)~
+# Push into $(MOUNT_DIR) when it is mounted, otherwise write into the image without mounting it
+PUSH_DEST=$(if $(wildcard $(MOUNT_DIR)),--sysroot=$(MOUNT_DIR),--image=$(BUILD)/harddrive.img)
 
 # Push compiled package into existing image
 # DO NOT RUN THIS WHILE QEMU ALIVE, THE DISK MIGHT CORRUPT IN DOING SO
 p.%: $(FSTOOLS_TAG) FORCE
-ifeq ($(ALLOW_FSTOOLS),1)
-	@rm -f $(MOUNTED_TAG)
-	@if [ ! -d "$(MOUNT_DIR)" ]; then \
-		$(MAKE) mount; \
-		touch $(MOUNTED_TAG); \
-	fi
-endif
 ifeq ($(PODMAN_BUILD),1)
-	$(PODMAN_RUN) make $@ ALLOW_FSTOOLS=$(FSTOOLS_IN_PODMAN)
+	$(PODMAN_RUN) make $@
 else
-	$(REPO_BIN) push $(foreach f,$(subst $(comma), ,$*),$(f)) "--sysroot=$(MOUNT_DIR)" $(COOKBOOK_OPTS)
-endif
-ifeq ($(ALLOW_FSTOOLS),1)
-	@if [ -f $(MOUNTED_TAG) ]; then \
-		$(MAKE) unmount && rm -f $(MOUNTED_TAG); \
-	else echo "\033[0;33;49mNot unmounting by ourself, don't forget to do it\033[0m"; \
-	fi
+	$(REPO_BIN) push $(foreach f,$(subst $(comma), ,$*),$(f)) "$(PUSH_DEST)" $(COOKBOOK_OPTS)
 endif
 
 # Show what to push
@@ -151,23 +139,10 @@ endif
 
 # Push all recipes specified by the filesystem config
 push: $(FSTOOLS_TAG) FORCE
-ifeq ($(ALLOW_FSTOOLS),1)
-	@rm -f $(MOUNTED_TAG)
-	@if [ ! -d "$(MOUNT_DIR)" ]; then \
-		$(MAKE) mount; \
-		touch $(MOUNTED_TAG); \
-	fi
-endif
 ifeq ($(PODMAN_BUILD),1)
-	$(PODMAN_RUN) make $@ ALLOW_FSTOOLS=$(FSTOOLS_IN_PODMAN)
+	$(PODMAN_RUN) make $@
 else
-	$(REPO_BIN) push $(COOKBOOK_OPTS) --with-package-deps "--sysroot=$(MOUNT_DIR)"
-endif
-ifeq ($(ALLOW_FSTOOLS),1)
-	@if [ -f $(MOUNTED_TAG) ]; then \
-		$(MAKE) unmount && rm -f $(MOUNTED_TAG); \
-	else echo "\033[1;33;49mNot unmounting by ourself, don't forget to do it\033[0m"; \
-	fi
+	$(REPO_BIN) push $(COOKBOOK_OPTS) --with-package-deps "$(PUSH_DEST)"
 endif
 
 # Rebuild and push all recipes specified by the filesystem config
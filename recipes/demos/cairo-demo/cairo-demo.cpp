@@ -0,0 +1,241 @@
+/*
+ * Cairo drawing in an orbital window.
+ *
+ * With --animate the drawing bounces around the window and is redrawn
+ * every frame. Only the damaged area, the union of the old and new
+ * position, is cleared and re-rendered unless --full is given.
+ *
+ * --bench N renders N animated frames with full redraws and N with
+ * damage tracking, and prints frames/s, frame times and the bytes of
+ * the window buffer touched per frame for both.
+ *
+ * Usage: cairo-demo
+ *        cairo-demo --animate [--full]
+ *        cairo-demo --bench N
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <cairo/cairo.h>
+#include <orbital.h>
+
+#include "cairo_scene.h"
+#include "frame_stats.hpp"
+
+struct Rect {
+  int x, y, width, height;
+};
+
+/* state of an animated surface between frames */
+struct Animation {
+  cairo_surface_t *surface;
+  int width, height;
+  bool full;
+  int frame;
+  /* where the drawing was last rendered */
+  Rect last;
+};
+
+static int width = 800;
+static int height = 600;
+
+static Rect
+rect_union (Rect a, Rect b)
+{
+  int x0 = a.x < b.x ? a.x : b.x;
+  int y0 = a.y < b.y ? a.y : b.y;
+  int x1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+  int y1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+  return Rect { x0, y0, x1 - x0, y1 - y0 };
+}
+
+static Rect
+rect_clip (Rect r, int w, int h)
+{
+  int x0 = r.x < 0 ? 0 : r.x;
+  int y0 = r.y < 0 ? 0 : r.y;
+  int x1 = r.x + r.width > w ? w : r.x + r.width;
+  int y1 = r.y + r.height > h ? h : r.y + r.height;
+  if (x1 <= x0 || y1 <= y0)
+    return Rect { 0, 0, 0, 0 };
+  return Rect { x0, y0, x1 - x0, y1 - y0 };
+}
+
+/* bounce between 0 and range, moving step pixels per frame */
+static int
+bounce (int frame, int step, int range)
+{
+  if (range <= 0)
+    return 0;
+  int pos = (frame * step) % (2 * range);
+  return pos > range ? 2 * range - pos : pos;
+}
+
+/* Clear the area to the background and render the drawing at x, y into it */
+static void
+redraw (cairo_surface_t *surface, Rect area, int x, int y)
+{
+  cairo_t *cr = cairo_create (surface);
+  cairo_rectangle (cr, area.x, area.y, area.width, area.height);
+  cairo_clip (cr);
+
+  /* the window buffer is shown as is, so the background must be opaque */
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_set_source_rgba (cr, 0.9, 0.9, 0.9, 1.0);
+  cairo_paint (cr);
+  cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+
+  cairo_translate (cr, x, y);
+  cairo_scene_travel_path (cr);
+  cairo_destroy (cr);
+  cairo_surface_flush (surface);
+}
+
+/* Advance one frame and return the number of bytes redrawn */
+static size_t
+animate (Animation &anim)
+{
+  Rect now = {
+    bounce (anim.frame, 3, anim.width - CAIRO_SCENE_WIDTH),
+    bounce (anim.frame, 2, anim.height - CAIRO_SCENE_HEIGHT),
+    CAIRO_SCENE_WIDTH,
+    CAIRO_SCENE_HEIGHT,
+  };
+  Rect damage = { 0, 0, anim.width, anim.height };
+  if (!anim.full)
+    damage = rect_clip (rect_union (anim.last, now), anim.width, anim.height);
+
+  redraw (anim.surface, damage, now.x, now.y);
+
+  anim.last = now;
+  anim.frame++;
+  return (size_t) damage.width * damage.height * 4;
+}
+
+static Animation
+animation_new (cairo_surface_t *surface, bool full)
+{
+  Animation anim;
+  anim.surface = surface;
+  anim.width = width;
+  anim.height = height;
+  anim.full = full;
+  anim.frame = 0;
+  /* the first frame has to cover the whole window */
+  anim.last = Rect { 0, 0, width, height };
+  return anim;
+}
+
+/* render frames as fast as possible in one mode and report the results */
+static void
+bench_mode (void *window, cairo_surface_t *surface, int frames, bool full)
+{
+  std::vector<double> render_ms, total_ms;
+  render_ms.reserve (frames);
+  total_ms.reserve (frames);
+  size_t bytes = 0;
+
+  Animation anim = animation_new (surface, full);
+  for (int i = 0; i < frames; i++) {
+    frame_stats::Clock::time_point t0 = frame_stats::Clock::now ();
+    bytes += animate (anim);
+    frame_stats::Clock::time_point t1 = frame_stats::Clock::now ();
+    orb_window_sync (window);
+    frame_stats::Clock::time_point t2 = frame_stats::Clock::now ();
+
+    render_ms.push_back (frame_stats::elapsed_ms (t0, t1));
+    total_ms.push_back (frame_stats::elapsed_ms (t0, t2));
+  }
+
+  frame_stats::Summary total = frame_stats::summarize (total_ms);
+  printf ("%s: %d frames, %dx%d, %.1f fps, %.1f KiB touched per frame\n",
+          full ? "full" : "damage", frames, width, height,
+          frames * 1000.0 / total.total, bytes / 1024.0 / frames);
+  frame_stats::print ("render", frame_stats::summarize (render_ms));
+  frame_stats::print ("total", total);
+}
+
+static void
+usage (void)
+{
+  fprintf (stderr, "Usage: cairo-demo\n"
+                   "       cairo-demo --animate [--full]\n"
+                   "       cairo-demo --bench <frames>\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  bool animated = false;
+  bool full = false;
+  int bench_frames = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp (argv[i], "--animate") == 0) {
+      animated = true;
+    } else if (strcmp (argv[i], "--full") == 0) {
+      full = true;
+    } else if (strcmp (argv[i], "--bench") == 0 && i + 1 < argc) {
+      bench_frames = atoi (argv[++i]);
+      if (bench_frames <= 0) {
+        usage ();
+        return 1;
+      }
+    } else {
+      usage ();
+      return 1;
+    }
+  }
+
+  void * window = orb_window_new_flags(-1, -1, width, height, "CairoDemo",
+                                       animated ? ORB_WINDOW_ASYNC : 0);
+  if (!window) {
+    printf ("orb_window_new_flags failed\n");
+    return 1;
+  }
+
+  //Cairo
+  uint32_t * frame_data = orb_window_data(window);
+  cairo_surface_t *surface = cairo_image_surface_create_for_data((uint8_t*) frame_data, CAIRO_FORMAT_ARGB32, width, height, cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width));
+
+  if (bench_frames) {
+    bench_mode (window, surface, bench_frames, true);
+    bench_mode (window, surface, bench_frames, false);
+    cairo_surface_destroy (surface);
+    orb_window_destroy (window);
+    return 0;
+  }
+
+  Animation anim = animation_new (surface, full);
+  animate (anim);
+  orb_window_sync(window);
+
+  char running = 1;
+  while (running) {
+   if (animated) {
+     animate (anim);
+     orb_window_sync (window);
+   }
+
+   void * event_iter = orb_window_events(window);
+
+   OrbEventOption event_option;
+   do {
+     event_option = orb_events_next(event_iter);
+     switch (event_option.tag) {
+       case OrbEventOption_Quit:
+         running = 0;
+         break;
+       default:
+         break;
+     }
+   } while (running && event_option.tag != OrbEventOption_None);
+
+   orb_events_destroy(event_iter);
+  }
+  cairo_surface_destroy(surface);
+  orb_window_destroy(window);
+  return 0;             /* ANSI C requires main to return int. */
+}
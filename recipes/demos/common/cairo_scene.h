@@ -1,18 +1,25 @@
-#include <stdint.h>
+/*
+ * The cairo-demo drawing: gradients, a rounded rectangle and an arc with
+ * helper lines. Shared by cairo-demo and demo-bench, and kept
+ * C-compatible.
+ */
+
+#ifndef CAIRO_SCENE_H
+#define CAIRO_SCENE_H
+
 #include <math.h>
-#include <stdlib.h>
 #include <cairo/cairo.h>
-#include <orbital.h>
 
 #ifndef M_PI
 #define M_PI 3.14159265
 #endif
 
-static int width = 800;
-static int height = 600;
+/* ink extents of the drawing from the origin, including strokes */
+#define CAIRO_SCENE_WIDTH 516
+#define CAIRO_SCENE_HEIGHT 256
 
-static void
-travel_path (cairo_t *cr)
+static inline void
+cairo_scene_travel_path (cairo_t *cr)
 {
 
   cairo_pattern_t *pat;
@@ -83,47 +90,4 @@ travel_path (cairo_t *cr)
   cairo_stroke (cr);
 }
 
-static void 
-draw (cairo_surface_t *surface)
-{
-  cairo_t *cr;
-  cr = cairo_create (surface);
-  travel_path (cr);
-  cairo_destroy (cr);
-}
-
-int
-main(int argc, char *argv[])
-{
-  void * window = orb_window_new(-1, -1, width, height, "CairoDemo");
-  
-  //Cairo
-  uint32_t * frame_data = orb_window_data(window);
-  cairo_surface_t *surface = cairo_image_surface_create_for_data((uint8_t*) frame_data, CAIRO_FORMAT_ARGB32, width, height, cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width));
-  cairo_create(surface);
-  draw (surface);
-
-  orb_window_sync(window);
-
-  char running = 1;
-  while (running) {
-   void * event_iter = orb_window_events(window);
-
-   OrbEventOption event_option;
-   do {
-     event_option = orb_events_next(event_iter);
-     switch (event_option.tag) {
-       case OrbEventOption_Quit:
-         running = 0;
-         break;
-       default:
-         break;
-     }
-   } while (running && event_option.tag != OrbEventOption_None);
-
-   orb_events_destroy(event_iter);
-  }
-  orb_window_destroy(window);
-  return 0;             /* ANSI C requires main to return int. */
-}
-
+#endif
@@ -0,0 +1,399 @@
+/*
+ * Mesh generators shared by the OpenGL demo recipes.
+ *
+ * Every shape is tessellated at a fixed segment count given as a
+ * template argument, so its sin/cos values come from a table built at
+ * compile time. Generators write separate position, normal and index
+ * streams into caller-provided storage; indices describe quads
+ * (4 per face) to be drawn with GL_QUADS, matching the outlines the
+ * immediate-mode and GLU versions produced. cached_*() tessellate a
+ * shape once per process and return the same mesh afterwards.
+ *
+ * Include with -I "${COOKBOOK_RECIPE}/../common".
+ */
+
+#ifndef DEMO_GEOMETRY_HPP
+#define DEMO_GEOMETRY_HPP
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+namespace demo_geometry {
+
+constexpr double PI = 3.14159265358979323846;
+
+/* Taylor series, accurate to float precision over [-pi, pi] */
+constexpr double
+const_sin(double x)
+{
+   while (x > PI)
+      x -= 2.0 * PI;
+   while (x < -PI)
+      x += 2.0 * PI;
+   double term = x, sum = x;
+   for (int n = 1; n < 12; n++) {
+      term *= -x * x / ((2 * n) * (2 * n + 1));
+      sum += term;
+   }
+   return sum;
+}
+
+constexpr double
+const_cos(double x)
+{
+   return const_sin(x + PI / 2.0);
+}
+
+/* sin/cos of 2*pi*k/N for k = 0..N, the last entry repeats the first */
+template <unsigned N>
+struct TrigTable {
+   std::array<float, N + 1> sin{};
+   std::array<float, N + 1> cos{};
+
+   constexpr TrigTable()
+   {
+      for (unsigned k = 0; k <= N; k++) {
+         double angle = 2.0 * PI * (k % N) / N;
+         sin[k] = (float) const_sin(angle);
+         cos[k] = (float) const_cos(angle);
+      }
+   }
+};
+
+template <unsigned N>
+inline constexpr TrigTable<N> trig_table{};
+
+/* Caller-provided storage, sized with the *_counts() helpers */
+struct MeshView {
+   float *positions;
+   float *normals;
+   uint32_t *indices;
+   size_t vertex_count = 0;
+   size_t index_count = 0;
+
+   uint32_t
+   vertex(float x, float y, float z, float nx, float ny, float nz)
+   {
+      float *p = positions + vertex_count * 3;
+      float *n = normals + vertex_count * 3;
+      p[0] = x;
+      p[1] = y;
+      p[2] = z;
+      n[0] = nx;
+      n[1] = ny;
+      n[2] = nz;
+      return (uint32_t) vertex_count++;
+   }
+
+   void
+   quad(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+   {
+      uint32_t *i = indices + index_count;
+      i[0] = a;
+      i[1] = b;
+      i[2] = c;
+      i[3] = d;
+      index_count += 4;
+   }
+};
+
+struct Counts {
+   size_t vertices;
+   size_t indices;
+};
+
+/* Owning storage for a generated mesh */
+struct Mesh {
+   std::vector<float> positions;
+   std::vector<float> normals;
+   std::vector<uint32_t> indices;
+
+   MeshView
+   reserve(Counts counts)
+   {
+      positions.resize(counts.vertices * 3);
+      normals.resize(counts.vertices * 3);
+      indices.resize(counts.indices);
+      return MeshView{ positions.data(), normals.data(), indices.data() };
+   }
+};
+
+/**
+ * Gear wheel, with the faces and winding of the classic gears demo.
+ * Flat shaded faces get their own vertices; the inner cylinder is
+ * smooth shaded.
+ */
+template <unsigned Teeth>
+constexpr Counts
+gear_counts()
+{
+   return { Teeth * 40 + (Teeth + 1) * 2, Teeth * 40 + Teeth * 4 };
+}
+
+template <unsigned Teeth>
+void
+gear(MeshView &m, float inner_radius, float outer_radius, float width,
+     float tooth_depth)
+{
+   /* every angle is a multiple of a quarter tooth */
+   constexpr const TrigTable<Teeth * 4> &t = trig_table<Teeth * 4>;
+   const float r0 = inner_radius;
+   const float r1 = outer_radius - tooth_depth / 2.0f;
+   const float r2 = outer_radius + tooth_depth / 2.0f;
+   const float z = width * 0.5f;
+
+   auto face = [&](const float (*v)[3], const float *n) {
+      uint32_t a = m.vertex(v[0][0], v[0][1], v[0][2], n[0], n[1], n[2]);
+      uint32_t b = m.vertex(v[1][0], v[1][1], v[1][2], n[0], n[1], n[2]);
+      uint32_t c = m.vertex(v[2][0], v[2][1], v[2][2], n[0], n[1], n[2]);
+      uint32_t d = m.vertex(v[3][0], v[3][1], v[3][2], n[0], n[1], n[2]);
+      m.quad(a, b, c, d);
+   };
+   auto pt = [&](float *out, float r, unsigned j, float vz) {
+      out[0] = r * t.cos[j];
+      out[1] = r * t.sin[j];
+      out[2] = vz;
+   };
+   auto side = [&](float *n, float ra, unsigned ja, float rb, unsigned jb) {
+      float u = rb * t.cos[jb] - ra * t.cos[ja];
+      float w = rb * t.sin[jb] - ra * t.sin[ja];
+      float len = std::sqrt(u * u + w * w);
+      n[0] = w / len;
+      n[1] = -u / len;
+      n[2] = 0.0f;
+   };
+   auto quad = [&](const float *n, float ra, unsigned ja, float za,
+                   float rb, unsigned jb, float zb,
+                   float rc, unsigned jc, float zc,
+                   float rd, unsigned jd, float zd) {
+      float v[4][3];
+      pt(v[0], ra, ja, za);
+      pt(v[1], rb, jb, zb);
+      pt(v[2], rc, jc, zc);
+      pt(v[3], rd, jd, zd);
+      face(v, n);
+   };
+
+   const float front[3] = { 0.0f, 0.0f, 1.0f };
+   const float back[3] = { 0.0f, 0.0f, -1.0f };
+   for (unsigned i = 0; i < Teeth; i++) {
+      const unsigned a = i * 4, b = a + 1, c = a + 2, d = a + 3, e = a + 4;
+      const float radial[3] = { t.cos[a], t.sin[a], 0.0f };
+      float n[3];
+
+      /* front face */
+      quad(front, r0, a, z, r1, a, z, r1, d, z, r0, a, z);
+      quad(front, r0, a, z, r1, d, z, r1, e, z, r0, e, z);
+
+      /* front sides of teeth */
+      quad(front, r1, a, z, r2, b, z, r2, c, z, r1, d, z);
+
+      /* back face */
+      quad(back, r1, a, -z, r0, a, -z, r0, a, -z, r1, d, -z);
+      quad(back, r1, d, -z, r0, a, -z, r0, e, -z, r1, e, -z);
+
+      /* back sides of teeth */
+      quad(back, r1, d, -z, r2, c, -z, r2, b, -z, r1, a, -z);
+
+      /* outward faces of teeth */
+      side(n, r1, a, r2, b);
+      quad(n, r1, a, z, r1, a, -z, r2, b, -z, r2, b, z);
+      quad(radial, r2, b, z, r2, b, -z, r2, c, -z, r2, c, z);
+      side(n, r2, c, r1, d);
+      quad(n, r2, c, z, r2, c, -z, r1, d, -z, r1, d, z);
+      quad(radial, r1, d, z, r1, d, -z, r1, e, -z, r1, e, z);
+   }
+
+   /* inside radius cylinder, vertices are shared between faces */
+   const uint32_t base = (uint32_t) m.vertex_count;
+   for (unsigned i = 0; i <= Teeth; i++) {
+      const unsigned a = i * 4;
+      m.vertex(r0 * t.cos[a], r0 * t.sin[a], -z, -t.cos[a], -t.sin[a], 0.0f);
+      m.vertex(r0 * t.cos[a], r0 * t.sin[a], z, -t.cos[a], -t.sin[a], 0.0f);
+   }
+   for (unsigned i = 0; i < Teeth; i++) {
+      const uint32_t p = base + i * 2;
+      m.quad(p, p + 1, p + 3, p + 2);
+   }
+}
+
+/* Torus around the z axis, like glutSolidTorus */
+template <unsigned Sides, unsigned Rings>
+constexpr Counts
+torus_counts()
+{
+   return { (Rings + 1) * (Sides + 1), Rings * Sides * 4 };
+}
+
+template <unsigned Sides, unsigned Rings>
+void
+torus(MeshView &m, float inner_radius, float outer_radius)
+{
+   constexpr const TrigTable<Rings> &theta = trig_table<Rings>;
+   constexpr const TrigTable<Sides> &phi = trig_table<Sides>;
+
+   const uint32_t base = (uint32_t) m.vertex_count;
+   for (unsigned i = 0; i <= Rings; i++) {
+      for (unsigned k = 0; k <= Sides; k++) {
+         float dist = outer_radius + inner_radius * phi.cos[k];
+         m.vertex(theta.cos[i] * dist, -theta.sin[i] * dist,
+                  inner_radius * phi.sin[k],
+                  theta.cos[i] * phi.cos[k], -theta.sin[i] * phi.cos[k],
+                  phi.sin[k]);
+      }
+   }
+   for (unsigned i = 0; i < Rings; i++) {
+      for (unsigned k = 0; k < Sides; k++) {
+         uint32_t v = base + i * (Sides + 1) + k;
+         m.quad(v + Sides + 1, v, v + 1, v + Sides + 2);
+      }
+   }
+}
+
+/* Sphere around the z axis, like gluSphere with smooth normals */
+template <unsigned Slices, unsigned Stacks>
+constexpr Counts
+sphere_counts()
+{
+   return { (Stacks + 1) * (Slices + 1), Stacks * Slices * 4 };
+}
+
+template <unsigned Slices, unsigned Stacks>
+void
+sphere(MeshView &m, float radius)
+{
+   constexpr const TrigTable<Slices> &theta = trig_table<Slices>;
+   /* stacks span half a turn */
+   constexpr const TrigTable<Stacks * 2> &phi = trig_table<Stacks * 2>;
+
+   const uint32_t base = (uint32_t) m.vertex_count;
+   for (unsigned j = 0; j <= Stacks; j++) {
+      for (unsigned i = 0; i <= Slices; i++) {
+         float nx = phi.sin[j] * theta.sin[i];
+         float ny = phi.sin[j] * theta.cos[i];
+         float nz = phi.cos[j];
+         m.vertex(radius * nx, radius * ny, radius * nz, nx, ny, nz);
+      }
+   }
+   for (unsigned j = 0; j < Stacks; j++) {
+      for (unsigned i = 0; i < Slices; i++) {
+         uint32_t v = base + j * (Slices + 1) + i;
+         m.quad(v + Slices + 1, v, v + 1, v + Slices + 2);
+      }
+   }
+}
+
+/* Cone along the z axis, like gluCylinder with a zero top radius */
+template <unsigned Slices, unsigned Stacks>
+constexpr Counts
+cone_counts()
+{
+   return { (Stacks + 1) * (Slices + 1), Stacks * Slices * 4 };
+}
+
+template <unsigned Slices, unsigned Stacks>
+void
+cone(MeshView &m, float base_radius, float height)
+{
+   constexpr const TrigTable<Slices> &theta = trig_table<Slices>;
+   const float length = std::sqrt(base_radius * base_radius + height * height);
+   const float nz = base_radius / length;
+   const float nxy = height / length;
+
+   const uint32_t base = (uint32_t) m.vertex_count;
+   for (unsigned j = 0; j <= Stacks; j++) {
+      float radius = base_radius - base_radius * ((float) j / Stacks);
+      float z = j * height / Stacks;
+      for (unsigned i = 0; i <= Slices; i++) {
+         m.vertex(radius * theta.sin[i], radius * theta.cos[i], z,
+                  theta.sin[i] * nxy, theta.cos[i] * nxy, nz);
+      }
+   }
+   for (unsigned j = 0; j < Stacks; j++) {
+      for (unsigned i = 0; i < Slices; i++) {
+         uint32_t v = base + j * (Slices + 1) + i;
+         m.quad(v, v + Slices + 1, v + Slices + 2, v + 1);
+      }
+   }
+}
+
+/*
+ * Process-wide cache, so shapes drawn every frame or from several
+ * threads are tessellated once. Returned meshes live until exit.
+ */
+enum class Shape {
+   Gear,
+   Torus,
+   Sphere,
+   Cone,
+};
+
+typedef std::tuple<Shape, unsigned, unsigned, float, float, float, float> CacheKey;
+
+template <typename Generate>
+const Mesh &
+cached(const CacheKey &key, Counts counts, Generate generate)
+{
+   static std::mutex lock;
+   static std::map<CacheKey, Mesh> meshes;
+
+   std::lock_guard<std::mutex> guard(lock);
+   auto found = meshes.find(key);
+   if (found != meshes.end())
+      return found->second;
+
+   Mesh &mesh = meshes[key];
+   MeshView view = mesh.reserve(counts);
+   generate(view);
+   return mesh;
+}
+
+template <unsigned Teeth>
+const Mesh &
+cached_gear(float inner_radius, float outer_radius, float width, float tooth_depth)
+{
+   return cached(CacheKey(Shape::Gear, Teeth, 0, inner_radius, outer_radius, width, tooth_depth),
+                 gear_counts<Teeth>(), [&](MeshView &m) {
+                    gear<Teeth>(m, inner_radius, outer_radius, width, tooth_depth);
+                 });
+}
+
+template <unsigned Sides, unsigned Rings>
+const Mesh &
+cached_torus(float inner_radius, float outer_radius)
+{
+   return cached(CacheKey(Shape::Torus, Sides, Rings, inner_radius, outer_radius, 0.0f, 0.0f),
+                 torus_counts<Sides, Rings>(), [&](MeshView &m) {
+                    torus<Sides, Rings>(m, inner_radius, outer_radius);
+                 });
+}
+
+template <unsigned Slices, unsigned Stacks>
+const Mesh &
+cached_sphere(float radius)
+{
+   return cached(CacheKey(Shape::Sphere, Slices, Stacks, radius, 0.0f, 0.0f, 0.0f),
+                 sphere_counts<Slices, Stacks>(), [&](MeshView &m) {
+                    sphere<Slices, Stacks>(m, radius);
+                 });
+}
+
+template <unsigned Slices, unsigned Stacks>
+const Mesh &
+cached_cone(float base_radius, float height)
+{
+   return cached(CacheKey(Shape::Cone, Slices, Stacks, base_radius, height, 0.0f, 0.0f),
+                 cone_counts<Slices, Stacks>(), [&](MeshView &m) {
+                    cone<Slices, Stacks>(m, base_radius, height);
+                 });
+}
+
+} // namespace demo_geometry
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Frame time percentiles for the demo --bench modes and demo-bench.
+ */
+
+#ifndef FRAME_STATS_HPP
+#define FRAME_STATS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+namespace frame_stats {
+
+typedef std::chrono::steady_clock Clock;
+
+inline double
+elapsed_ms(Clock::time_point start, Clock::time_point end)
+{
+   return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/* all times in milliseconds */
+struct Summary {
+   size_t frames = 0;
+   double total = 0.0;
+   double mean = 0.0;
+   double p50 = 0.0;
+   double p90 = 0.0;
+   double p99 = 0.0;
+   double max = 0.0;
+};
+
+inline Summary
+summarize(std::vector<double> samples)
+{
+   Summary s;
+   if (samples.empty())
+      return s;
+
+   std::sort(samples.begin(), samples.end());
+   auto pct = [&](double p) {
+      return samples[std::min(samples.size() - 1, (size_t) (p * samples.size()))];
+   };
+   s.frames = samples.size();
+   for (double ms : samples)
+      s.total += ms;
+   s.mean = s.total / s.frames;
+   s.p50 = pct(0.50);
+   s.p90 = pct(0.90);
+   s.p99 = pct(0.99);
+   s.max = samples.back();
+   return s;
+}
+
+inline void
+print(const char *name, const Summary &s)
+{
+   printf("%-7s p50 %8.3f ms  p90 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n",
+          name, s.p50, s.p90, s.p99, s.max);
+}
+
+} // namespace frame_stats
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * The three-gear scene of the gears demos, shared by gears, sdl2-gears
+ * and demo-bench. Needs a current GL context for init() and draw().
+ *
+ * Define GL_GLEXT_PROTOTYPES before the first GL header (including
+ * GL/osmesa.h) so the buffer object entry points are declared.
+ */
+
+#ifndef GEARS_SCENE_HPP
+#define GEARS_SCENE_HPP
+
+#include <cstdio>
+#include <cstring>
+
+#ifndef GL_GLEXT_PROTOTYPES
+#define GL_GLEXT_PROTOTYPES
+#endif
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include "demo_geometry.hpp"
+
+namespace gears_scene {
+
+struct Gear {
+   const demo_geometry::Mesh *mesh = nullptr;
+   GLuint vbo = 0;
+   GLuint ibo = 0;
+   GLfloat color[4];
+};
+
+struct Scene {
+   Gear gears[3];
+   bool use_vbo = false;
+   GLfloat view_rotx = 20.0, view_roty = 30.0, view_rotz = 0.0;
+};
+
+inline void
+upload(const Scene &scene, Gear &gear)
+{
+   const demo_geometry::Mesh &mesh = *gear.mesh;
+   if (!scene.use_vbo)
+      return;
+   /* positions followed by normals in one buffer */
+   size_t stream = mesh.positions.size() * sizeof(GLfloat);
+   glGenBuffers(1, &gear.vbo);
+   glBindBuffer(GL_ARRAY_BUFFER, gear.vbo);
+   glBufferData(GL_ARRAY_BUFFER, stream * 2, NULL, GL_STATIC_DRAW);
+   glBufferSubData(GL_ARRAY_BUFFER, 0, stream, mesh.positions.data());
+   glBufferSubData(GL_ARRAY_BUFFER, stream, stream, mesh.normals.data());
+   glGenBuffers(1, &gear.ibo);
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gear.ibo);
+   glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(GLuint),
+                mesh.indices.data(), GL_STATIC_DRAW);
+}
+
+inline void
+draw_gear(const Scene &scene, const Gear &gear)
+{
+   const demo_geometry::Mesh &mesh = *gear.mesh;
+   const GLvoid *positions = mesh.positions.data();
+   const GLvoid *normals = mesh.normals.data();
+   const GLvoid *indices = mesh.indices.data();
+   if (scene.use_vbo) {
+      glBindBuffer(GL_ARRAY_BUFFER, gear.vbo);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gear.ibo);
+      positions = NULL;
+      normals = (const GLvoid *) (mesh.positions.size() * sizeof(GLfloat));
+      indices = NULL;
+   }
+   glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, gear.color);
+   glVertexPointer(3, GL_FLOAT, 0, positions);
+   glNormalPointer(GL_FLOAT, 0, normals);
+   glDrawElements(GL_QUADS, mesh.indices.size(), GL_UNSIGNED_INT, indices);
+}
+
+/* Set up lighting and upload the gear meshes */
+inline void
+init(Scene &scene)
+{
+   static const GLfloat pos[4] = { 5.0, 5.0, 10.0, 0.0 };
+   static const GLfloat red[4] = { 0.8, 0.1, 0.0, 1.0 };
+   static const GLfloat green[4] = { 0.0, 0.8, 0.2, 1.0 };
+   static const GLfloat blue[4] = { 0.2, 0.2, 1.0, 1.0 };
+
+   glLightfv(GL_LIGHT0, GL_POSITION, pos);
+   glEnable(GL_CULL_FACE);
+   glEnable(GL_LIGHTING);
+   glEnable(GL_LIGHT0);
+   glEnable(GL_DEPTH_TEST);
+
+   /* VBOs need GL 1.5, otherwise draw from client memory */
+   const char *version = (const char *) glGetString(GL_VERSION);
+   int major = 0, minor = 0;
+   if (version && sscanf(version, "%d.%d", &major, &minor) == 2)
+      scene.use_vbo = major > 1 || (major == 1 && minor >= 5);
+
+   /* make the gears */
+   memcpy(scene.gears[0].color, red, sizeof(red));
+   scene.gears[0].mesh = &demo_geometry::cached_gear<20>(1.0, 4.0, 1.0, 0.7);
+
+   memcpy(scene.gears[1].color, green, sizeof(green));
+   scene.gears[1].mesh = &demo_geometry::cached_gear<10>(0.5, 2.0, 2.0, 0.7);
+
+   memcpy(scene.gears[2].color, blue, sizeof(blue));
+   scene.gears[2].mesh = &demo_geometry::cached_gear<10>(1.3, 2.0, 0.5, 0.7);
+
+   for (Gear &gear : scene.gears)
+      upload(scene, gear);
+
+   glEnableClientState(GL_VERTEX_ARRAY);
+   glEnableClientState(GL_NORMAL_ARRAY);
+   glEnable(GL_NORMALIZE);
+}
+
+/* new window size or exposure */
+inline void
+reshape(int width, int height)
+{
+   GLfloat h = (GLfloat) height / (GLfloat) width;
+
+   glViewport(0, 0, (GLint) width, (GLint) height);
+   glMatrixMode(GL_PROJECTION);
+   glLoadIdentity();
+   glFrustum(-1.0, 1.0, -h, h, 5.0, 60.0);
+   glMatrixMode(GL_MODELVIEW);
+   glLoadIdentity();
+   glTranslatef(0.0, 0.0, -40.0);
+}
+
+/* Draw one frame, without waiting for it to finish */
+inline void
+draw(const Scene &scene, GLfloat angle)
+{
+   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+   glPushMatrix();
+   glRotatef(scene.view_rotx, 1.0, 0.0, 0.0);
+   glRotatef(scene.view_roty, 0.0, 1.0, 0.0);
+   glRotatef(scene.view_rotz, 0.0, 0.0, 1.0);
+
+   glPushMatrix();
+   glTranslatef(-3.0, -2.0, 0.0);
+   glRotatef(angle, 0.0, 0.0, 1.0);
+   draw_gear(scene, scene.gears[0]);
+   glPopMatrix();
+
+   glPushMatrix();
+   glTranslatef(3.1, -2.0, 0.0);
+   glRotatef(-2.0 * angle - 9.0, 0.0, 0.0, 1.0);
+   draw_gear(scene, scene.gears[1]);
+   glPopMatrix();
+
+   glPushMatrix();
+   glTranslatef(-3.1, 4.2, 0.0);
+   glRotatef(-2.0 * angle - 25.0, 0.0, 0.0, 1.0);
+   draw_gear(scene, scene.gears[2]);
+   glPopMatrix();
+
+   glPopMatrix();
+}
+
+} // namespace gears_scene
+
+#endif
@@ -0,0 +1,423 @@
+/*
+ * Headless benchmark for the demo render paths.
+ *
+ * Renders the gears and osdemo scenes into OSMesa buffers and the
+ * cairo-demo drawing into a cairo image surface, without a window, and
+ * prints one JSON object per benchmark and line:
+ *
+ *   {"name":"gears","width":800,"height":600,"frames":300,"mean_ms":...,
+ *    "p50_ms":...,"p90_ms":...,"p99_ms":...,"max_ms":...,
+ *    "pixels_per_second":...,"peak_rss_kb":...}
+ *
+ * peak_rss_kb is the peak resident set of the process after that
+ * benchmark, so it only grows along the list.
+ *
+ * Benchmarks the renderer cannot run (such as 32-bit osdemo on a Mesa
+ * built with 8-bit channels) are reported with a "skipped" reason.
+ *
+ * With --baseline, the p50 and p99 frame times are compared against an
+ * earlier output file and the exit status is 1 if any benchmark got
+ * slower than the tolerance allows.
+ *
+ * Usage: demo-bench [--frames N] [--warmup N] [--size WxH] [--only a,b]
+ *                   [--output FILE] [--baseline FILE] [--tolerance PCT]
+ *
+ * Builds on the host as well as in the cookbook:
+ *   g++ -O2 -I ../common demo-bench.cpp -o demo-bench \
+ *       $(pkg-config --libs osmesa cairo)
+ */
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/osmesa.h>
+#include <cairo/cairo.h>
+#include <sys/resource.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cairo_scene.h"
+#include "frame_stats.hpp"
+#include "gears_scene.hpp"
+#include "osdemo_scene.hpp"
+
+struct Options {
+   int frames = 300;
+   int warmup = 10;
+   int width = 800;
+   int height = 600;
+   std::vector<std::string> only;
+   const char *output = NULL;
+   const char *baseline = NULL;
+   double tolerance = 10.0;
+};
+
+struct Result {
+   std::string name;
+   /* empty unless the benchmark could not run */
+   std::string skipped;
+   int width = 0;
+   int height = 0;
+   frame_stats::Summary frames;
+   double pixels_per_second = 0.0;
+   long peak_rss_kb = 0;
+};
+
+/* Render one frame and wait for it to complete */
+typedef std::function<void(int frame)> FrameFn;
+
+/* peak resident set of the whole process so far */
+static long
+peak_rss_kb(void)
+{
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage) != 0)
+      return 0;
+   return usage.ru_maxrss;
+}
+
+static void
+run_frames(const Options &opts, const FrameFn &frame, Result &result)
+{
+   using frame_stats::Clock;
+
+   for (int i = 0; i < opts.warmup; i++)
+      frame(i);
+
+   std::vector<double> samples;
+   samples.reserve(opts.frames);
+   for (int i = 0; i < opts.frames; i++) {
+      Clock::time_point start = Clock::now();
+      frame(opts.warmup + i);
+      samples.push_back(frame_stats::elapsed_ms(start, Clock::now()));
+   }
+
+   result.width = opts.width;
+   result.height = opts.height;
+   result.frames = frame_stats::summarize(samples);
+   if (result.frames.total > 0.0)
+      result.pixels_per_second = (double) opts.width * opts.height *
+         result.frames.frames / (result.frames.total / 1000.0);
+   result.peak_rss_kb = peak_rss_kb();
+}
+
+/*
+ * Create an OSMesa context rendering into a fresh BGRA buffer with the
+ * given channel type. Returns false with result.skipped set on failure.
+ */
+static bool
+make_osmesa(const Options &opts, GLenum type, GLint bits, OSMesaContext &ctx,
+            std::vector<unsigned char> &buffer, Result &result)
+{
+   ctx = OSMesaCreateContextExt(OSMESA_BGRA, 16, 0, 0, NULL);
+   if (!ctx) {
+      result.skipped = "OSMesaCreateContextExt failed";
+      return false;
+   }
+   buffer.resize((size_t) opts.width * opts.height * 4 * bits / 8);
+   if (!OSMesaMakeCurrent(ctx, buffer.data(), type, opts.width, opts.height)) {
+      result.skipped = "OSMesaMakeCurrent failed";
+      OSMesaDestroyContext(ctx);
+      return false;
+   }
+   GLint red_bits = 0;
+   glGetIntegerv(GL_RED_BITS, &red_bits);
+   if (red_bits != bits) {
+      result.skipped = "no " + std::to_string(bits) + "-bit/channel renderbuffer";
+      OSMesaDestroyContext(ctx);
+      return false;
+   }
+   return true;
+}
+
+static void
+bench_gears(const Options &opts, Result &result)
+{
+   OSMesaContext ctx;
+   std::vector<unsigned char> buffer;
+   if (!make_osmesa(opts, GL_UNSIGNED_BYTE, 8, ctx, buffer, result))
+      return;
+
+   gears_scene::Scene scene;
+   glClearColor(0.0, 0.0, 0.0, 1.0);
+   gears_scene::init(scene);
+   gears_scene::reshape(opts.width, opts.height);
+
+   run_frames(opts, [&](int frame) {
+      gears_scene::draw(scene, (GLfloat) ((frame * 2) % 360));
+      glFinish();
+   }, result);
+
+   OSMesaDestroyContext(ctx);
+}
+
+static void
+bench_osdemo(const Options &opts, GLenum type, GLint bits, Result &result)
+{
+   OSMesaContext ctx;
+   std::vector<unsigned char> buffer;
+   if (!make_osmesa(opts, type, bits, ctx, buffer, result))
+      return;
+
+   OSMesaColorClamp(GL_TRUE);
+   osdemo_scene::init_context();
+
+   run_frames(opts, [&](int) {
+      osdemo_scene::render_image();
+      glFinish();
+   }, result);
+
+   OSMesaDestroyContext(ctx);
+}
+
+static void
+bench_cairo(const Options &opts, Result &result)
+{
+   cairo_surface_t *surface =
+      cairo_image_surface_create(CAIRO_FORMAT_ARGB32, opts.width, opts.height);
+   if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+      result.skipped = cairo_status_to_string(cairo_surface_status(surface));
+      cairo_surface_destroy(surface);
+      return;
+   }
+
+   run_frames(opts, [&](int) {
+      cairo_t *cr = cairo_create(surface);
+      cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+      cairo_paint(cr);
+      cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+      cairo_scene_travel_path(cr);
+      cairo_destroy(cr);
+      cairo_surface_flush(surface);
+   }, result);
+
+   cairo_surface_destroy(surface);
+}
+
+static std::string
+to_json(const Result &r)
+{
+   char buf[512];
+   if (!r.skipped.empty()) {
+      std::string reason;
+      for (char c : r.skipped) {
+         if (c == '"' || c == '\\')
+            reason += '\\';
+         reason += c;
+      }
+      return "{\"name\":\"" + r.name + "\",\"skipped\":\"" + reason + "\"}";
+   }
+   snprintf(buf, sizeof(buf),
+            "{\"name\":\"%s\",\"width\":%d,\"height\":%d,\"frames\":%zu,"
+            "\"mean_ms\":%.4f,\"p50_ms\":%.4f,\"p90_ms\":%.4f,\"p99_ms\":%.4f,"
+            "\"max_ms\":%.4f,\"pixels_per_second\":%.0f,\"peak_rss_kb\":%ld}",
+            r.name.c_str(), r.width, r.height, r.frames.frames, r.frames.mean,
+            r.frames.p50, r.frames.p90, r.frames.p99, r.frames.max,
+            r.pixels_per_second, r.peak_rss_kb);
+   return buf;
+}
+
+/* Read a number field from one of our own output lines */
+static bool
+json_number(const std::string &line, const char *key, double &value)
+{
+   std::string needle = std::string("\"") + key + "\":";
+   size_t pos = line.find(needle);
+   if (pos == std::string::npos)
+      return false;
+   value = strtod(line.c_str() + pos + needle.size(), NULL);
+   return true;
+}
+
+static bool
+json_string(const std::string &line, const char *key, std::string &value)
+{
+   std::string needle = std::string("\"") + key + "\":\"";
+   size_t pos = line.find(needle);
+   if (pos == std::string::npos)
+      return false;
+   pos += needle.size();
+   size_t end = line.find('"', pos);
+   if (end == std::string::npos)
+      return false;
+   value = line.substr(pos, end - pos);
+   return true;
+}
+
+/*
+ * Compare p50 and p99 against a previous run. Benchmarks missing from
+ * either side, skipped ones and different sizes are not compared.
+ * Returns false if anything regressed beyond the tolerance.
+ */
+static bool
+check_baseline(const Options &opts, const std::vector<Result> &results)
+{
+   std::ifstream file(opts.baseline);
+   if (!file) {
+      fprintf(stderr, "demo-bench: cannot read baseline %s\n", opts.baseline);
+      return false;
+   }
+
+   std::map<std::string, std::string> baseline;
+   std::string line;
+   while (std::getline(file, line)) {
+      std::string name;
+      if (json_string(line, "name", name))
+         baseline[name] = line;
+   }
+
+   bool ok = true;
+   double limit = 1.0 + opts.tolerance / 100.0;
+   for (const Result &r : results) {
+      auto it = baseline.find(r.name);
+      if (!r.skipped.empty() || it == baseline.end())
+         continue;
+
+      double width = 0, height = 0, p50 = 0, p99 = 0;
+      if (!json_number(it->second, "p50_ms", p50) ||
+          !json_number(it->second, "p99_ms", p99) ||
+          !json_number(it->second, "width", width) ||
+          !json_number(it->second, "height", height))
+         continue;
+      if ((int) width != r.width || (int) height != r.height) {
+         fprintf(stderr, "%-10s baseline is %dx%d, not compared\n",
+                 r.name.c_str(), (int) width, (int) height);
+         continue;
+      }
+
+      bool regressed = r.frames.p50 > p50 * limit || r.frames.p99 > p99 * limit;
+      fprintf(stderr, "%-10s p50 %8.3f -> %8.3f ms  p99 %8.3f -> %8.3f ms  %s\n",
+              r.name.c_str(), p50, r.frames.p50, p99, r.frames.p99,
+              regressed ? "REGRESSED" : "ok");
+      if (regressed)
+         ok = false;
+   }
+   return ok;
+}
+
+static void
+usage(void)
+{
+   fprintf(stderr,
+           "Usage: demo-bench [--frames N] [--warmup N] [--size WxH] [--only a,b]\n"
+           "                  [--output FILE] [--baseline FILE] [--tolerance PCT]\n"
+           "Benchmarks: gears, osdemo-8, osdemo-16, osdemo-32, cairo\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+   Options opts;
+
+   for (int i = 1; i < argc; i++) {
+      const char *arg = argv[i];
+      const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+      if (!value && strcmp(arg, "--help") != 0) {
+         usage();
+         return 2;
+      }
+      if (strcmp(arg, "--frames") == 0) {
+         opts.frames = atoi(value);
+      }
+      else if (strcmp(arg, "--warmup") == 0) {
+         opts.warmup = atoi(value);
+      }
+      else if (strcmp(arg, "--size") == 0) {
+         if (sscanf(value, "%dx%d", &opts.width, &opts.height) != 2 ||
+             opts.width <= 0 || opts.height <= 0) {
+            fprintf(stderr, "demo-bench: invalid size %s, expected WxH\n", value);
+            return 2;
+         }
+      }
+      else if (strcmp(arg, "--only") == 0) {
+         std::stringstream list(value);
+         std::string name;
+         while (std::getline(list, name, ','))
+            if (!name.empty())
+               opts.only.push_back(name);
+      }
+      else if (strcmp(arg, "--output") == 0) {
+         opts.output = value;
+      }
+      else if (strcmp(arg, "--baseline") == 0) {
+         opts.baseline = value;
+      }
+      else if (strcmp(arg, "--tolerance") == 0) {
+         opts.tolerance = atof(value);
+      }
+      else {
+         usage();
+         return 2;
+      }
+      i++;
+   }
+   if (opts.frames <= 0 || opts.warmup < 0 || opts.tolerance < 0.0) {
+      usage();
+      return 2;
+   }
+
+   struct Bench {
+      const char *name;
+      std::function<void(const Options &, Result &)> run;
+   };
+   const Bench benches[] = {
+      { "gears", bench_gears },
+      { "osdemo-8", [](const Options &o, Result &r) {
+           bench_osdemo(o, GL_UNSIGNED_BYTE, 8, r);
+        } },
+      { "osdemo-16", [](const Options &o, Result &r) {
+           bench_osdemo(o, GL_UNSIGNED_SHORT, 16, r);
+        } },
+      { "osdemo-32", [](const Options &o, Result &r) {
+           bench_osdemo(o, GL_FLOAT, 32, r);
+        } },
+      { "cairo", bench_cairo },
+   };
+
+   FILE *out = stdout;
+   if (opts.output) {
+      out = fopen(opts.output, "w");
+      if (!out) {
+         fprintf(stderr, "demo-bench: cannot write %s\n", opts.output);
+         return 2;
+      }
+   }
+
+   std::vector<Result> results;
+   for (const Bench &bench : benches) {
+      if (!opts.only.empty()) {
+         bool wanted = false;
+         for (const std::string &name : opts.only)
+            wanted |= name == bench.name;
+         if (!wanted)
+            continue;
+      }
+
+      Result result;
+      result.name = bench.name;
+      bench.run(opts, result);
+      if (result.skipped.empty())
+         fprintf(stderr, "%-10s %dx%d %zu frames, p50 %.3f ms, %.2f MP/s\n",
+                 bench.name, result.width, result.height, result.frames.frames,
+                 result.frames.p50, result.pixels_per_second / 1e6);
+      else
+         fprintf(stderr, "%-10s skipped: %s\n", bench.name, result.skipped.c_str());
+
+      fprintf(out, "%s\n", to_json(result).c_str());
+      fflush(out);
+      results.push_back(result);
+   }
+
+   if (out != stdout)
+      fclose(out);
+
+   if (opts.baseline && !check_baseline(opts, results))
+      return 1;
+   return 0;
+}
@@ -0,0 +1,333 @@
+/* gears.cpp */
+
+/*
+ * 3-D gear wheels.  This program is in the public domain.
+ *
+ * Brian Paul
+ */
+
+/* Conversion to GLUT by Mark J. Kilgard */
+
+/*
+ * The scene lives in ../common/gears_scene.hpp: gear meshes come from
+ * the demo_geometry tessellator and are drawn with VBOs (or client
+ * vertex arrays if VBOs are unavailable).
+ *
+ * OSMesa renders straight into the orbital window buffer. With --copy
+ * it renders into a private buffer that is copied on every sync.
+ *
+ * Usage: gears [--copy] [frames]
+ *        gears [--copy] --bench N
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/osmesa.h>
+#include <orbital.h>
+
+#include "frame_stats.hpp"
+#include "gears_scene.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static int width = 800;
+static int height = 600;
+
+static OSMesaContext ctx = NULL;
+static void * buffer = NULL;
+static void * window = NULL;
+
+/* what the context currently renders into */
+static void * bound = NULL;
+static int bound_width = 0;
+static int bound_height = 0;
+static bool copy_mode = false;
+
+static gears_scene::Scene scene;
+static GLfloat angle = 0.0;
+
+static GLuint limit;
+static GLuint count = 1;
+
+/* copy pixels, forcing alpha to opaque */
+
+static void
+copy_alpha_scalar(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    dst[i] = src[i] | 0xFF000000;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) static void
+copy_alpha_sse2(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  const __m128i alpha = _mm_set1_epi32(0xFF000000);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i px = _mm_loadu_si128((const __m128i *) (src + i));
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_or_si128(px, alpha));
+  }
+  copy_alpha_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2"))) static void
+copy_alpha_avx2(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256i a = _mm256_loadu_si256((const __m256i *) (src + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *) (src + i + 8));
+    _mm256_storeu_si256((__m256i *) (dst + i), _mm256_or_si256(a, alpha));
+    _mm256_storeu_si256((__m256i *) (dst + i + 8), _mm256_or_si256(b, alpha));
+  }
+  copy_alpha_scalar(dst + i, src + i, n - i);
+}
+#elif defined(__aarch64__)
+static void
+copy_alpha_neon(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  const uint32x4_t alpha = vdupq_n_u32(0xFF000000);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    vst1q_u32(dst + i, vorrq_u32(vld1q_u32(src + i), alpha));
+  copy_alpha_scalar(dst + i, src + i, n - i);
+}
+#endif
+
+typedef void (*copy_alpha_fn)(uint32_t *, const uint32_t *, size_t);
+
+static copy_alpha_fn
+select_copy_alpha(const char **name)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    *name = "avx2";
+    return copy_alpha_avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    *name = "sse2";
+    return copy_alpha_sse2;
+  }
+#elif defined(__aarch64__)
+  *name = "neon";
+  return copy_alpha_neon;
+#endif
+  *name = "scalar";
+  return copy_alpha_scalar;
+}
+
+static const char *copy_alpha_name = "scalar";
+static copy_alpha_fn copy_alpha = select_copy_alpha(&copy_alpha_name);
+
+/*
+ * Point the context at the window buffer (or the private buffer in copy
+ * mode), again whenever the window was resized or its buffer moved.
+ */
+static bool
+bind_framebuffer(void)
+{
+  void *target;
+  if (copy_mode) {
+    if (width != bound_width || height != bound_height) {
+      free(buffer);
+      buffer = malloc((size_t) width * height * 4);
+      if (!buffer) {
+        printf("malloc failed\n");
+        return false;
+      }
+    }
+    target = buffer;
+  } else {
+    target = orb_window_data(window);
+  }
+
+  if (target == bound && width == bound_width && height == bound_height)
+    return true;
+
+  if (!OSMesaMakeCurrent(ctx, target, GL_UNSIGNED_BYTE, width, height)) {
+    printf("OSMesaMakeCurrent failed\n");
+    return false;
+  }
+  OSMesaPixelStore(OSMESA_Y_UP, 0);
+
+  if (width != bound_width || height != bound_height)
+    gears_scene::reshape(width, height);
+
+  bound = target;
+  bound_width = width;
+  bound_height = height;
+  return true;
+}
+
+static void
+sync(void)
+{
+  if (copy_mode)
+    copy_alpha(orb_window_data(window), (const uint32_t *) buffer,
+               (size_t) width * height);
+
+  orb_window_sync(window);
+}
+
+static void
+draw(void)
+{
+  gears_scene::draw(scene, angle);
+  glFinish();
+}
+
+static void
+init(void)
+{
+  /* the window buffer is shown as is, so background alpha must be opaque */
+  glClearColor(0.0, 0.0, 0.0, 1.0);
+
+  gears_scene::init(scene);
+}
+
+/* render a fixed number of frames as fast as possible and report frame times */
+static void
+bench(GLuint frames)
+{
+  std::vector<double> render_ms, sync_ms, total_ms;
+  render_ms.reserve(frames);
+  sync_ms.reserve(frames);
+  total_ms.reserve(frames);
+
+  for (GLuint i = 0; i < frames; i++) {
+    angle += 2.0;
+    frame_stats::Clock::time_point t0 = frame_stats::Clock::now();
+    draw();
+    frame_stats::Clock::time_point t1 = frame_stats::Clock::now();
+    sync();
+    frame_stats::Clock::time_point t2 = frame_stats::Clock::now();
+
+    render_ms.push_back(frame_stats::elapsed_ms(t0, t1));
+    sync_ms.push_back(frame_stats::elapsed_ms(t1, t2));
+    total_ms.push_back(frame_stats::elapsed_ms(t0, t2));
+  }
+
+  frame_stats::Summary total = frame_stats::summarize(total_ms);
+  printf("gears: %u frames, %dx%d, %s, %s, %.1f fps\n", frames, width, height,
+         scene.use_vbo ? "vbo" : "vertex arrays",
+         copy_mode ? copy_alpha_name : "zero-copy", frames * 1000.0 / total.total);
+  frame_stats::print("render", frame_stats::summarize(render_ms));
+  frame_stats::print("sync", frame_stats::summarize(sync_ms));
+  frame_stats::print("total", total);
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "Usage: gears [--copy] [frames]\n"
+                  "       gears [--copy] --bench <frames>\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  GLuint bench_frames = 0;
+  limit = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--copy") == 0) {
+      copy_mode = true;
+    } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+      bench_frames = atoi(argv[++i]);
+      if (bench_frames == 0) {
+        usage();
+        return 1;
+      }
+    } else if (argv[i][0] != '-') {
+      /* do 'n' frames then exit */
+      limit = atoi(argv[i]) + 1;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  ctx = OSMesaCreateContextExt(OSMESA_BGRA, 16, 0, 0, NULL);
+  if (!ctx) {
+    printf("OSMesaCreateContextExt failed\n");
+    return 1;
+  }
+
+  window = orb_window_new_flags(-1, -1, width, height, "Gears",
+                                ORB_WINDOW_ASYNC | ORB_WINDOW_RESIZABLE);
+  if (!window) {
+    printf("orb_window_new_flags failed\n");
+    OSMesaDestroyContext(ctx);
+    return 1;
+  }
+
+  if (!bind_framebuffer()) {
+    orb_window_destroy(window);
+    OSMesaDestroyContext(ctx);
+    free(buffer);
+    return 1;
+  }
+
+  OSMesaColorClamp(GL_TRUE);
+
+  init();
+
+  char running = !bench_frames;
+  if (bench_frames)
+    bench(bench_frames);
+
+  while (running) {
+   if (!bind_framebuffer())
+     break;
+
+   angle += 2.0;
+   draw();
+   sync();
+
+   count++;
+   if (count == limit) {
+     break;
+   }
+
+   void * event_iter = orb_window_events(window);
+
+   OrbEventOption event_option;
+   do {
+     event_option = orb_events_next(event_iter);
+     switch (event_option.tag) {
+       case OrbEventOption_Quit:
+         running = 0;
+         break;
+       case OrbEventOption_Resize:
+         /* rebound and reshaped before the next frame */
+         if (event_option.resize.width && event_option.resize.height) {
+           width = event_option.resize.width;
+           height = event_option.resize.height;
+         }
+         break;
+       default:
+         break;
+     }
+   } while (running && event_option.tag != OrbEventOption_None);
+
+   orb_events_destroy(event_iter);
+  }
+
+  orb_window_destroy(window);
+  OSMesaDestroyContext(ctx);
+  free(buffer);
+
+  return 0;             /* ANSI C requires main to return int. */
+}
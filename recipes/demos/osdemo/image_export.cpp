@@ -0,0 +1,387 @@
+/*
+ * Pixel conversion and image file output for OSMesa color buffers.
+ *
+ * Conversion is done in two steps per chunk of a row: the source
+ * channels are narrowed to BGRA8, then swizzled into the destination
+ * layout. Both steps have SSE2/SSSE3 (x86) or NEON (aarch64) kernels
+ * with scalar fallbacks, selected once at startup.
+ */
+
+#include "image_export.hpp"
+
+#include <cstdio>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace image_export {
+
+namespace {
+
+/* pixels converted per step, small enough to stay in L1 */
+const size_t CHUNK = 256;
+
+typedef void (*narrow_u16_fn)(const uint16_t *, uint8_t *, size_t);
+typedef void (*narrow_f32_fn)(const float *, uint8_t *, size_t);
+typedef void (*swizzle_fn)(const uint8_t *, uint8_t *, size_t);
+
+struct Kernels {
+   const char *name;
+   narrow_u16_fn u16;
+   narrow_f32_fn f32;
+   swizzle_fn rgb;
+   swizzle_fn rgba;
+   swizzle_fn bgrx;
+};
+
+/* scalar kernels, counts are in channels for narrowing and pixels for swizzles */
+
+void
+u16_scalar(const uint16_t *src, uint8_t *dst, size_t n)
+{
+   for (size_t i = 0; i < n; i++)
+      dst[i] = src[i] >> 8;
+}
+
+inline uint8_t
+f32_to_u8(float x)
+{
+   /* also maps NaN to 0 */
+   x = x > 0.0f ? (x < 1.0f ? x : 1.0f) : 0.0f;
+   return (uint8_t) (x * 255.0f + 0.5f);
+}
+
+void
+f32_scalar(const float *src, uint8_t *dst, size_t n)
+{
+   for (size_t i = 0; i < n; i++)
+      dst[i] = f32_to_u8(src[i]);
+}
+
+void
+rgb_scalar(const uint8_t *src, uint8_t *dst, size_t n)
+{
+   for (size_t i = 0; i < n; i++) {
+      dst[i * 3 + 0] = src[i * 4 + 2];
+      dst[i * 3 + 1] = src[i * 4 + 1];
+      dst[i * 3 + 2] = src[i * 4 + 0];
+   }
+}
+
+void
+rgba_scalar(const uint8_t *src, uint8_t *dst, size_t n)
+{
+   for (size_t i = 0; i < n; i++) {
+      dst[i * 4 + 0] = src[i * 4 + 2];
+      dst[i * 4 + 1] = src[i * 4 + 1];
+      dst[i * 4 + 2] = src[i * 4 + 0];
+      dst[i * 4 + 3] = src[i * 4 + 3];
+   }
+}
+
+void
+bgrx_scalar(const uint8_t *src, uint8_t *dst, size_t n)
+{
+   for (size_t i = 0; i < n; i++) {
+      dst[i * 4 + 0] = src[i * 4 + 0];
+      dst[i * 4 + 1] = src[i * 4 + 1];
+      dst[i * 4 + 2] = src[i * 4 + 2];
+      dst[i * 4 + 3] = 0xFF;
+   }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2"))) void
+u16_sse2(const uint16_t *src, uint8_t *dst, size_t n)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16) {
+      __m128i a = _mm_srli_epi16(_mm_loadu_si128((const __m128i *) (src + i)), 8);
+      __m128i b = _mm_srli_epi16(_mm_loadu_si128((const __m128i *) (src + i + 8)), 8);
+      _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(a, b));
+   }
+   u16_scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("sse2"))) void
+f32_sse2(const float *src, uint8_t *dst, size_t n)
+{
+   const __m128 zero = _mm_setzero_ps();
+   const __m128 one = _mm_set1_ps(1.0f);
+   const __m128 scale = _mm_set1_ps(255.0f);
+   const __m128 half = _mm_set1_ps(0.5f);
+   __m128i v[4];
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16) {
+      for (int k = 0; k < 4; k++) {
+         /* max(x, 0) returns 0 for NaN, like the scalar version */
+         __m128 x = _mm_loadu_ps(src + i + k * 4);
+         x = _mm_min_ps(_mm_max_ps(x, zero), one);
+         v[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(x, scale), half));
+      }
+      __m128i lo = _mm_packs_epi32(v[0], v[1]);
+      __m128i hi = _mm_packs_epi32(v[2], v[3]);
+      _mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(lo, hi));
+   }
+   f32_scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("ssse3"))) void
+rgb_ssse3(const uint8_t *src, uint8_t *dst, size_t n)
+{
+   const __m128i shuf = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                      -1, -1, -1, -1);
+   size_t i = 0;
+   /* each store writes 16 bytes of which 12 are used, keep clear of the end */
+   for (; i + 6 <= n; i += 4) {
+      __m128i px = _mm_loadu_si128((const __m128i *) (src + i * 4));
+      _mm_storeu_si128((__m128i *) (dst + i * 3), _mm_shuffle_epi8(px, shuf));
+   }
+   rgb_scalar(src + i * 4, dst + i * 3, n - i);
+}
+
+__attribute__((target("sse2"))) void
+rgba_sse2(const uint8_t *src, uint8_t *dst, size_t n)
+{
+   const __m128i ga = _mm_set1_epi32(0xFF00FF00);
+   const __m128i low = _mm_set1_epi32(0x000000FF);
+   size_t i = 0;
+   for (; i + 4 <= n; i += 4) {
+      __m128i px = _mm_loadu_si128((const __m128i *) (src + i * 4));
+      __m128i r = _mm_and_si128(_mm_srli_epi32(px, 16), low);
+      __m128i b = _mm_slli_epi32(_mm_and_si128(px, low), 16);
+      px = _mm_or_si128(_mm_and_si128(px, ga), _mm_or_si128(r, b));
+      _mm_storeu_si128((__m128i *) (dst + i * 4), px);
+   }
+   rgba_scalar(src + i * 4, dst + i * 4, n - i);
+}
+
+__attribute__((target("sse2"))) void
+bgrx_sse2(const uint8_t *src, uint8_t *dst, size_t n)
+{
+   const __m128i alpha = _mm_set1_epi32(0xFF000000);
+   size_t i = 0;
+   for (; i + 4 <= n; i += 4) {
+      __m128i px = _mm_loadu_si128((const __m128i *) (src + i * 4));
+      _mm_storeu_si128((__m128i *) (dst + i * 4), _mm_or_si128(px, alpha));
+   }
+   bgrx_scalar(src + i * 4, dst + i * 4, n - i);
+}
+
+#elif defined(__aarch64__)
+
+void
+u16_neon(const uint16_t *src, uint8_t *dst, size_t n)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16) {
+      uint8x8_t a = vshrn_n_u16(vld1q_u16(src + i), 8);
+      uint8x8_t b = vshrn_n_u16(vld1q_u16(src + i + 8), 8);
+      vst1q_u8(dst + i, vcombine_u8(a, b));
+   }
+   u16_scalar(src + i, dst + i, n - i);
+}
+
+void
+f32_neon(const float *src, uint8_t *dst, size_t n)
+{
+   const float32x4_t zero = vdupq_n_f32(0.0f);
+   const float32x4_t one = vdupq_n_f32(1.0f);
+   const float32x4_t scale = vdupq_n_f32(255.0f);
+   const float32x4_t half = vdupq_n_f32(0.5f);
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8) {
+      uint16x4_t v[2];
+      for (int k = 0; k < 2; k++) {
+         float32x4_t x = vld1q_f32(src + i + k * 4);
+         /* vmaxnm returns the number for NaN inputs */
+         x = vminq_f32(vmaxnmq_f32(x, zero), one);
+         v[k] = vmovn_u32(vcvtq_u32_f32(vmlaq_f32(half, x, scale)));
+      }
+      vst1_u8(dst + i, vmovn_u16(vcombine_u16(v[0], v[1])));
+   }
+   f32_scalar(src + i, dst + i, n - i);
+}
+
+void
+rgb_neon(const uint8_t *src, uint8_t *dst, size_t n)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16) {
+      uint8x16x4_t px = vld4q_u8(src + i * 4);
+      uint8x16x3_t out = { { px.val[2], px.val[1], px.val[0] } };
+      vst3q_u8(dst + i * 3, out);
+   }
+   rgb_scalar(src + i * 4, dst + i * 3, n - i);
+}
+
+void
+rgba_neon(const uint8_t *src, uint8_t *dst, size_t n)
+{
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16) {
+      uint8x16x4_t px = vld4q_u8(src + i * 4);
+      uint8x16_t b = px.val[0];
+      px.val[0] = px.val[2];
+      px.val[2] = b;
+      vst4q_u8(dst + i * 4, px);
+   }
+   rgba_scalar(src + i * 4, dst + i * 4, n - i);
+}
+
+void
+bgrx_neon(const uint8_t *src, uint8_t *dst, size_t n)
+{
+   const uint32x4_t alpha = vdupq_n_u32(0xFF000000);
+   size_t i = 0;
+   for (; i + 4 <= n; i += 4) {
+      uint32x4_t px = vld1q_u32((const uint32_t *) (src + i * 4));
+      vst1q_u32((uint32_t *) (dst + i * 4), vorrq_u32(px, alpha));
+   }
+   bgrx_scalar(src + i * 4, dst + i * 4, n - i);
+}
+
+#endif
+
+Kernels
+select_kernels()
+{
+   Kernels k = { "scalar", u16_scalar, f32_scalar, rgb_scalar, rgba_scalar, bgrx_scalar };
+#if defined(__x86_64__) || defined(__i386__)
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("sse2")) {
+      k = { "sse2", u16_sse2, f32_sse2, rgb_scalar, rgba_sse2, bgrx_sse2 };
+      if (__builtin_cpu_supports("ssse3")) {
+         k.name = "ssse3";
+         k.rgb = rgb_ssse3;
+      }
+   }
+#elif defined(__aarch64__)
+   k = { "neon", u16_neon, f32_neon, rgb_neon, rgba_neon, bgrx_neon };
+#endif
+   return k;
+}
+
+const Kernels &
+kernels()
+{
+   static const Kernels k = select_kernels();
+   return k;
+}
+
+swizzle_fn
+swizzle_for(Layout layout)
+{
+   switch (layout) {
+   case Layout::RGB8:
+      return kernels().rgb;
+   case Layout::RGBA8:
+      return kernels().rgba;
+   case Layout::BGRX8:
+   default:
+      return kernels().bgrx;
+   }
+}
+
+} // namespace
+
+size_t
+source_pixel_size(ChannelType type)
+{
+   switch (type) {
+   case ChannelType::U16:
+      return 8;
+   case ChannelType::F32:
+      return 16;
+   case ChannelType::U8:
+   default:
+      return 4;
+   }
+}
+
+size_t
+layout_pixel_size(Layout layout)
+{
+   return layout == Layout::RGB8 ? 3 : 4;
+}
+
+void
+convert_row(const void *src, ChannelType type, uint8_t *dst, Layout layout,
+            size_t pixels)
+{
+   swizzle_fn swizzle = swizzle_for(layout);
+   if (type == ChannelType::U8) {
+      swizzle((const uint8_t *) src, dst, pixels);
+      return;
+   }
+
+   uint8_t scratch[CHUNK * 4];
+   size_t dst_size = layout_pixel_size(layout);
+   for (size_t i = 0; i < pixels; i += CHUNK) {
+      size_t n = pixels - i < CHUNK ? pixels - i : CHUNK;
+      if (type == ChannelType::U16)
+         kernels().u16((const uint16_t *) src + i * 4, scratch, n * 4);
+      else
+         kernels().f32((const float *) src + i * 4, scratch, n * 4);
+      swizzle(scratch, dst + i * dst_size, n);
+   }
+}
+
+void
+convert_image(const void *src, ChannelType type, int width, int height,
+              bool bottom_up, uint8_t *dst, size_t dst_stride, Layout layout)
+{
+   size_t src_stride = (size_t) width * source_pixel_size(type);
+   for (int y = 0; y < height; y++) {
+      int sy = bottom_up ? height - 1 - y : y;
+      convert_row((const uint8_t *) src + sy * src_stride, type,
+                  dst + y * dst_stride, layout, width);
+   }
+}
+
+bool
+write_image(const char *filename, FileFormat format, const void *src,
+            ChannelType type, int width, int height, bool bottom_up)
+{
+   FILE *f = fopen(filename, "wb");
+   if (!f)
+      return false;
+
+   Layout layout;
+   if (format == FileFormat::PAM) {
+      layout = Layout::RGBA8;
+      fprintf(f, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\n"
+                 "TUPLTYPE RGB_ALPHA\nENDHDR\n", width, height);
+   }
+   else {
+      layout = Layout::RGB8;
+      fprintf(f, "P6\n# ppm-file created by osdemo\n%d %d\n255\n",
+              width, height);
+   }
+
+   size_t src_stride = (size_t) width * source_pixel_size(type);
+   std::vector<uint8_t> row((size_t) width * layout_pixel_size(layout));
+   for (int y = 0; y < height; y++) {
+      int sy = bottom_up ? height - 1 - y : y;
+      convert_row((const uint8_t *) src + sy * src_stride, type, row.data(),
+                  layout, width);
+      if (fwrite(row.data(), 1, row.size(), f) != row.size())
+         break;
+   }
+
+   bool ok = !ferror(f);
+   return fclose(f) == 0 && ok;
+}
+
+const char *
+kernel_name()
+{
+   return kernels().name;
+}
+
+} // namespace image_export
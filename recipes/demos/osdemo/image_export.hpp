@@ -0,0 +1,63 @@
+/*
+ * Pixel conversion and image file output for OSMesa color buffers.
+ *
+ * OSMesa buffers are BGRA with 8, 16 or 32 (float) bits per channel.
+ * Rows are converted one at a time into a small scratch buffer, so
+ * display and file output never hold a second full-size image.
+ */
+
+#ifndef IMAGE_EXPORT_HPP
+#define IMAGE_EXPORT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace image_export {
+
+/* channel type of a BGRA source buffer */
+enum class ChannelType {
+   U8,
+   U16,
+   F32,
+};
+
+/* 8-bit destination layouts */
+enum class Layout {
+   RGB8,
+   RGBA8,
+   /* BGRA with alpha forced opaque, as orbital windows expect */
+   BGRX8,
+};
+
+enum class FileFormat {
+   /* binary P6 */
+   PPM,
+   /* P7 RGB_ALPHA */
+   PAM,
+};
+
+size_t source_pixel_size(ChannelType type);
+size_t layout_pixel_size(Layout layout);
+
+/* Convert one row of BGRA pixels to an 8-bit layout, clamping floats */
+void convert_row(const void *src, ChannelType type, uint8_t *dst,
+                 Layout layout, size_t pixels);
+
+/*
+ * Convert a whole image into dst with the given stride. Rows are read
+ * bottom-up when bottom_up is set (the OSMesa default orientation).
+ */
+void convert_image(const void *src, ChannelType type, int width, int height,
+                   bool bottom_up, uint8_t *dst, size_t dst_stride,
+                   Layout layout);
+
+/* Write an image file, top row first. Returns false on I/O errors. */
+bool write_image(const char *filename, FileFormat format, const void *src,
+                 ChannelType type, int width, int height, bool bottom_up);
+
+/* name of the conversion kernels selected for this CPU */
+const char *kernel_name();
+
+} // namespace image_export
+
+#endif
@@ -0,0 +1,332 @@
+/*
+ * Test OSMesa interface at 8, 16 and 32 bits/channel.
+ *
+ * Usage: osdemo [options]
+ *
+ * Options:
+ *   -d     display images
+ *   -f     generate image files (binary PPM)
+ *   -pam   generate PAM files with alpha instead of PPM
+ *   -g     render gradient and print color values
+ *   -j     render the 8, 16 and 32 bit variants concurrently, one thread
+ *          and OSMesa context each
+ *   -s WxH render at this resolution, may be given several times
+ *   -n N   render each image N times and report throughput
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <GL/osmesa.h>
+#include <orbital.h>
+
+#include "image_export.hpp"
+#include "osdemo_scene.hpp"
+
+#define WIDTH 600
+#define HEIGHT 600
+
+struct Resolution {
+   int width;
+   int height;
+};
+
+struct Result {
+   GLint bits;
+   Resolution res;
+   int frames;
+   double seconds;
+};
+
+static GLboolean DisplayImages = GL_FALSE;
+static GLboolean WriteFiles = GL_FALSE;
+static GLboolean Gradient = GL_FALSE;
+static image_export::FileFormat FileFormat = image_export::FileFormat::PPM;
+static GLboolean Threaded = GL_FALSE;
+static std::vector<Resolution> Resolutions;
+static int Repeats = 1;
+
+
+/**
+ * Draw red/green gradient across bottom of image.
+ * Read pixels to check deltas.
+ */
+static void
+render_gradient(int width)
+{
+   std::vector<GLfloat> row(width * 4);
+   int i;
+
+   glMatrixMode(GL_PROJECTION);
+   glLoadIdentity();
+   glOrtho(-1, 1, -1, 1, -1, 1);
+   glMatrixMode(GL_MODELVIEW);
+   glLoadIdentity();
+
+   glBegin(GL_POLYGON);
+   glColor3f(1, 0, 0);
+   glVertex2f(-1, -1.0);
+   glVertex2f(-1, -0.9);
+   glColor3f(0, 1, 0);
+   glVertex2f(1, -0.9);
+   glVertex2f(1, -1.0);
+   glEnd();
+   glFinish();
+
+   glReadPixels(0, 0, width, 1, GL_RGBA, GL_FLOAT, row.data());
+   for (i = 0; i < 4; i++) {
+      printf("row[i] = %f, %f, %f\n", row[i * 4], row[i * 4 + 1], row[i * 4 + 2]);
+   }
+}
+
+
+static void
+display_image(const char *filename, const void *buffer, image_export::ChannelType type,
+              int width, int height)
+{
+  void * window = orb_window_new(-1, -1, width, height, filename);
+
+  /* OSMesa rows are bottom-up, convert straight into the window */
+  image_export::convert_image(buffer, type, width, height, true,
+                              (uint8_t *)orb_window_data(window), width * 4,
+                              image_export::Layout::BGRX8);
+
+  orb_window_sync(window);
+
+  char running = 1;
+  while (running) {
+   void * event_iter = orb_window_events(window);
+
+   OrbEventOption event_option;
+   do {
+     event_option = orb_events_next(event_iter);
+     switch (event_option.tag) {
+       case OrbEventOption_Quit:
+         running = 0;
+         break;
+       default:
+         break;
+     }
+   } while (running && event_option.tag != OrbEventOption_None);
+
+   orb_events_destroy(event_iter);
+  }
+
+  orb_window_destroy(window);
+}
+
+
+/**
+ * Render one bit depth at every requested resolution with a single
+ * context and image buffer, appending timings to results.
+ */
+static GLboolean
+test(GLenum type, GLint bits, std::vector<Result> &results)
+{
+   const GLint z = 16, stencil = 0, accum = 0;
+   OSMesaContext ctx;
+   void *buffer;
+   GLint cBits;
+   size_t max_pixels = 0;
+   size_t r;
+
+   assert(bits == 8 ||
+          bits == 16 ||
+          bits == 32);
+
+   assert(type == GL_UNSIGNED_BYTE ||
+          type == GL_UNSIGNED_SHORT ||
+          type == GL_FLOAT);
+
+   ctx = OSMesaCreateContextExt(OSMESA_BGRA, z, stencil, accum, NULL );
+   if (!ctx) {
+      printf("OSMesaCreateContextExt() failed!\n");
+      return 0;
+   }
+
+   /* Allocate the image buffer once, for the largest resolution */
+   for (r = 0; r < Resolutions.size(); r++) {
+      size_t pixels = (size_t) Resolutions[r].width * Resolutions[r].height;
+      if (pixels > max_pixels)
+         max_pixels = pixels;
+   }
+   buffer = malloc(max_pixels * 4 * bits / 8);
+   if (!buffer) {
+      printf("Alloc image buffer failed!\n");
+      OSMesaDestroyContext(ctx);
+      return 0;
+   }
+
+   image_export::ChannelType channels = image_export::ChannelType::U8;
+   if (type == GL_UNSIGNED_SHORT)
+      channels = image_export::ChannelType::U16;
+   else if (type == GL_FLOAT)
+      channels = image_export::ChannelType::F32;
+
+   for (r = 0; r < Resolutions.size(); r++) {
+      const Resolution res = Resolutions[r];
+
+      /* Bind the buffer to the context and make it current */
+      if (!OSMesaMakeCurrent( ctx, buffer, type, res.width, res.height )) {
+         printf("OSMesaMakeCurrent (%d bits/channel) failed!\n", bits);
+         free(buffer);
+         OSMesaDestroyContext(ctx);
+         return 0;
+      }
+      /* Mesa only sizes the viewport on the first make-current */
+      glViewport(0, 0, res.width, res.height);
+
+      if (r == 0) {
+         /* sanity checks */
+         glGetIntegerv(GL_RED_BITS, &cBits);
+         if (cBits != bits) {
+            fprintf(stderr, "Unable to create %d-bit/channel renderbuffer.\n", bits);
+            fprintf(stderr, "May need to recompile Mesa with CHAN_BITS=16 or 32.\n");
+            free(buffer);
+            OSMesaDestroyContext(ctx);
+            return 0;
+         }
+         glGetIntegerv(GL_GREEN_BITS, &cBits);
+         assert(cBits == bits);
+         glGetIntegerv(GL_BLUE_BITS, &cBits);
+         assert(cBits == bits);
+         glGetIntegerv(GL_ALPHA_BITS, &cBits);
+         assert(cBits == bits);
+
+         OSMesaColorClamp(GL_TRUE);
+
+         osdemo_scene::init_context();
+      }
+
+      std::string filename = "image" + std::to_string(bits);
+      if (res.width != WIDTH || res.height != HEIGHT)
+         filename += "_" + std::to_string(res.width) + "x" + std::to_string(res.height);
+      filename += FileFormat == image_export::FileFormat::PAM ? ".pam" : ".ppm";
+
+      if (WriteFiles)
+         printf("Rendering %d bit/channel image %dx%d: %s\n", bits,
+                res.width, res.height, filename.c_str());
+      else
+         printf("Rendering %d bit/channel image %dx%d\n", bits,
+                res.width, res.height);
+
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for (int i = 0; i < Repeats; i++) {
+         osdemo_scene::render_image();
+         /* Make sure buffered commands are finished! */
+         glFinish();
+      }
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      results.push_back({ bits, res, Repeats, elapsed.count() });
+
+      if (Gradient) {
+         render_gradient(res.width);
+         glFinish();
+      }
+
+      if (DisplayImages) {
+         display_image(filename.c_str(), buffer, channels, res.width, res.height);
+      }
+
+      if (WriteFiles) {
+         if (!image_export::write_image(filename.c_str(), FileFormat, buffer,
+                                        channels, res.width, res.height, true))
+            fprintf(stderr, "Writing %s failed\n", filename.c_str());
+      }
+   }
+
+   OSMesaDestroyContext(ctx);
+
+   free(buffer);
+
+   return 1;
+}
+
+
+int
+main( int argc, char *argv[] )
+{
+   static const GLenum types[3] = { GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_FLOAT };
+   static const GLint bits[3] = { 8, 16, 32 };
+   std::vector<Result> results[3];
+   int i;
+
+   printf("Use -f to write image files\n");
+
+   for (i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-d") == 0)
+         DisplayImages = GL_TRUE;
+      else if (strcmp(argv[i], "-f") == 0)
+         WriteFiles = GL_TRUE;
+      else if (strcmp(argv[i], "-pam") == 0)
+         FileFormat = image_export::FileFormat::PAM;
+      else if (strcmp(argv[i], "-g") == 0)
+         Gradient = GL_TRUE;
+      else if (strcmp(argv[i], "-j") == 0)
+         Threaded = GL_TRUE;
+      else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+         Resolution res;
+         if (sscanf(argv[++i], "%dx%d", &res.width, &res.height) != 2 ||
+             res.width <= 0 || res.height <= 0) {
+            fprintf(stderr, "Invalid resolution %s, expected WxH\n", argv[i]);
+            return 1;
+         }
+         Resolutions.push_back(res);
+      }
+      else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+         Repeats = atoi(argv[++i]);
+         if (Repeats <= 0) {
+            fprintf(stderr, "Invalid repeat count %s\n", argv[i]);
+            return 1;
+         }
+      }
+   }
+
+   if (Resolutions.empty())
+      Resolutions.push_back({ WIDTH, HEIGHT });
+
+   if (Threaded && DisplayImages) {
+      /* each window blocks its thread until closed */
+      printf("Ignoring -d with -j\n");
+      DisplayImages = GL_FALSE;
+   }
+
+   if (WriteFiles)
+      printf("Converting with %s kernels\n", image_export::kernel_name());
+
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   if (Threaded) {
+      std::vector<std::thread> threads;
+      for (i = 0; i < 3; i++)
+         threads.emplace_back(test, types[i], bits[i], std::ref(results[i]));
+      for (i = 0; i < 3; i++)
+         threads[i].join();
+   }
+   else {
+      for (i = 0; i < 3; i++)
+         test(types[i], bits[i], results[i]);
+   }
+   std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+   double total_pixels = 0.0;
+   for (i = 0; i < 3; i++) {
+      for (const Result &result : results[i]) {
+         double pixels = (double) result.res.width * result.res.height * result.frames;
+         total_pixels += pixels;
+         printf("%2d bit %5dx%-5d %4d frames %9.3f s %9.2f MP/s\n", result.bits,
+                result.res.width, result.res.height, result.frames,
+                result.seconds, pixels / result.seconds / 1e6);
+      }
+   }
+   printf("total %.3f s wall, %.2f MP/s%s\n", wall.count(),
+          total_pixels / wall.count() / 1e6, Threaded ? " (threaded)" : "");
+
+   return 0;
+}
@@ -1,4 +1,4 @@
-/* gears.c */
+/* gears.cpp */
 
 /*
  * 3-D gear wheels.  This program is in the public domain.
@@ -8,149 +8,29 @@
 
 /* Conversion to GLUT by Mark J. Kilgard */
 
+/*
+ * Gear meshes come from the shared demo_geometry tessellator and are
+ * drawn with VBOs (or client vertex arrays if VBOs are unavailable).
+ *
+ * Usage: sdl2_gears
+ *        sdl2_gears --bench N
+ */
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define GL_GLEXT_PROTOTYPES
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_mixer.h>
 #include <SDL2/SDL_ttf.h>
 
-#ifndef M_PI
-#define M_PI 3.14159265
-#endif
-
-/**
-
-  Draw a gear wheel.  You'll probably want to call this function when
-  building a display list since we do a lot of trig here.
-
-  Input:  inner_radius - radius of hole at center
-          outer_radius - radius at center of teeth
-          width - width of gear
-          teeth - number of teeth
-          tooth_depth - depth of tooth
-
- **/
-
-static void
-gear(GLfloat inner_radius, GLfloat outer_radius, GLfloat width,
-     GLint teeth, GLfloat tooth_depth)
-{
-    GLint i;
-    GLfloat r0, r1, r2;
-    GLfloat angle, da;
-    GLfloat u, v, len;
-
-    r0 = inner_radius;
-    r1 = outer_radius - tooth_depth / 2.0;
-    r2 = outer_radius + tooth_depth / 2.0;
-
-    da = 2.0 * M_PI / teeth / 4.0;
-
-    glShadeModel(GL_FLAT);
-
-    glNormal3f(0.0, 0.0, 1.0);
-
-    /* draw front face */
-    glBegin(GL_QUAD_STRIP);
-    for (i = 0; i <= teeth; i++)
-    {
-        angle = i * 2.0 * M_PI / teeth;
-        glVertex3f(r0 * cos(angle), r0 * sin(angle), width * 0.5);
-
-        glVertex3f(r1 * cos(angle), r1 * sin(angle), width * 0.5);
-        glVertex3f(r0 * cos(angle), r0 * sin(angle), width * 0.5);
-        glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da), width * 0.5);
-    }
-    glEnd();
-
-    /* draw front sides of teeth */
-    glBegin(GL_QUADS);
-    da = 2.0 * M_PI / teeth / 4.0;
-    for (i = 0; i < teeth; i++)
-    {
-        angle = i * 2.0 * M_PI / teeth;
-
-        glVertex3f(r1 * cos(angle), r1 * sin(angle), width * 0.5);
-        glVertex3f(r2 * cos(angle + da), r2 * sin(angle + da), width * 0.5);
-        glVertex3f(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da), width * 0.5);
-        glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da), width * 0.5);
-    }
-    glEnd();
-
-    glNormal3f(0.0, 0.0, -1.0);
-
-    /* draw back face */
-    glBegin(GL_QUAD_STRIP);
-    for (i = 0; i <= teeth; i++)
-    {
-        angle = i * 2.0 * M_PI / teeth;
-        glVertex3f(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
-        glVertex3f(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
-        glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da), -width * 0.5);
-        glVertex3f(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
-    }
-    glEnd();
-
-    /* draw back sides of teeth */
-    glBegin(GL_QUADS);
-    da = 2.0 * M_PI / teeth / 4.0;
-    for (i = 0; i < teeth; i++)
-    {
-        angle = i * 2.0 * M_PI / teeth;
-
-        glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da), -width * 0.5);
-        glVertex3f(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da), -width * 0.5);
-        glVertex3f(r2 * cos(angle + da), r2 * sin(angle + da), -width * 0.5);
-        glVertex3f(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
-    }
-    glEnd();
-
-    /* draw outward faces of teeth */
-    glBegin(GL_QUAD_STRIP);
-    for (i = 0; i < teeth; i++)
-    {
-        angle = i * 2.0 * M_PI / teeth;
-
-        glVertex3f(r1 * cos(angle), r1 * sin(angle), width * 0.5);
-        glVertex3f(r1 * cos(angle), r1 * sin(angle), -width * 0.5);
-        u = r2 * cos(angle + da) - r1 * cos(angle);
-        v = r2 * sin(angle + da) - r1 * sin(angle);
-        len = sqrt(u * u + v * v);
-        u /= len;
-        v /= len;
-        glNormal3f(v, -u, 0.0);
-        glVertex3f(r2 * cos(angle + da), r2 * sin(angle + da), width * 0.5);
-        glVertex3f(r2 * cos(angle + da), r2 * sin(angle + da), -width * 0.5);
-        glNormal3f(cos(angle), sin(angle), 0.0);
-        glVertex3f(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da), width * 0.5);
-        glVertex3f(r2 * cos(angle + 2 * da), r2 * sin(angle + 2 * da), -width * 0.5);
-        u = r1 * cos(angle + 3 * da) - r2 * cos(angle + 2 * da);
-        v = r1 * sin(angle + 3 * da) - r2 * sin(angle + 2 * da);
-        glNormal3f(v, -u, 0.0);
-        glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da), width * 0.5);
-        glVertex3f(r1 * cos(angle + 3 * da), r1 * sin(angle + 3 * da), -width * 0.5);
-        glNormal3f(cos(angle), sin(angle), 0.0);
-    }
-
-    glVertex3f(r1 * cos(0), r1 * sin(0), width * 0.5);
-    glVertex3f(r1 * cos(0), r1 * sin(0), -width * 0.5);
-
-    glEnd();
-
-    glShadeModel(GL_SMOOTH);
-
-    /* draw inside radius cylinder */
-    glBegin(GL_QUAD_STRIP);
-    for (i = 0; i <= teeth; i++)
-    {
-        angle = i * 2.0 * M_PI / teeth;
-
-        glNormal3f(-cos(angle), -sin(angle), 0.0);
-        glVertex3f(r0 * cos(angle), r0 * sin(angle), -width * 0.5);
-        glVertex3f(r0 * cos(angle), r0 * sin(angle), width * 0.5);
-    }
-    glEnd();
-}
+#include "frame_stats.hpp"
+#include "gears_scene.hpp"
 
 static int width = 800;
 static int height = 600;
@@ -158,42 +38,10 @@ static int height = 600;
 static SDL_Window *window = NULL;
 static SDL_GLContext context = NULL;
 
-static GLfloat view_rotx = 20.0, view_roty = 30.0, view_rotz = 0.0;
-static GLint gear1, gear2, gear3;
+static gears_scene::Scene scene;
 static GLfloat angle = 0.0;
 static GLfloat delta = 2.0f;
 
-static void
-draw(void)
-{
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    glPushMatrix();
-    glRotatef(view_rotx, 1.0, 0.0, 0.0);
-    glRotatef(view_roty, 0.0, 1.0, 0.0);
-    glRotatef(view_rotz, 0.0, 0.0, 1.0);
-
-    glPushMatrix();
-    glTranslatef(-3.0, -2.0, 0.0);
-    glRotatef(angle, 0.0, 0.0, 1.0);
-    glCallList(gear1);
-    glPopMatrix();
-
-    glPushMatrix();
-    glTranslatef(3.1, -2.0, 0.0);
-    glRotatef(-2.0 * angle - 9.0, 0.0, 0.0, 1.0);
-    glCallList(gear2);
-    glPopMatrix();
-
-    glPushMatrix();
-    glTranslatef(-3.1, 4.2, 0.0);
-    glRotatef(-2.0 * angle - 25.0, 0.0, 0.0, 1.0);
-    glCallList(gear3);
-    glPopMatrix();
-
-    glPopMatrix();
-}
-
 static void
 idle(void)
 {
@@ -201,70 +49,59 @@ idle(void)
     if (angle > 360.0f)
         angle -= 360.0f;
 
-    draw();
+    gears_scene::draw(scene, angle);
 
     SDL_GL_SwapWindow(window);
 }
 
-/* new window size or exposure */
+/* render a fixed number of frames as fast as possible and report frame times */
 static void
-reshape(int width, int height)
+bench(int frames)
 {
-    GLfloat h = (GLfloat)height / (GLfloat)width;
-
-    glViewport(0, 0, (GLint)width, (GLint)height);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glFrustum(-1.0, 1.0, -h, h, 5.0, 60.0);
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    glTranslatef(0.0, 0.0, -40.0);
-}
+    using frame_stats::Clock;
+    using frame_stats::elapsed_ms;
 
-static void
-init(void)
-{
-    static GLfloat pos[4] =
-        {5.0, 5.0, 10.0, 0.0};
-    static GLfloat red[4] =
-        {0.8, 0.1, 0.0, 1.0};
-    static GLfloat green[4] =
-        {0.0, 0.8, 0.2, 1.0};
-    static GLfloat blue[4] =
-        {0.2, 0.2, 1.0, 1.0};
-
-    glLightfv(GL_LIGHT0, GL_POSITION, pos);
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
-    glEnable(GL_DEPTH_TEST);
-
-    /* make the gears */
-    gear1 = glGenLists(1);
-    glNewList(gear1, GL_COMPILE);
-    glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, red);
-    gear(1.0, 4.0, 1.0, 20, 0.7);
-    glEndList();
-
-    gear2 = glGenLists(1);
-    glNewList(gear2, GL_COMPILE);
-    glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, green);
-    gear(0.5, 2.0, 2.0, 10, 0.7);
-    glEndList();
-
-    gear3 = glGenLists(1);
-    glNewList(gear3, GL_COMPILE);
-    glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, blue);
-    gear(1.3, 2.0, 0.5, 10, 0.7);
-    glEndList();
-
-    glEnable(GL_NORMALIZE);
+    std::vector<double> render_ms, sync_ms, total_ms;
+    render_ms.reserve(frames);
+    sync_ms.reserve(frames);
+    total_ms.reserve(frames);
+
+    for (int i = 0; i < frames; i++)
+    {
+        angle += delta;
+        if (angle > 360.0f)
+            angle -= 360.0f;
+
+        Clock::time_point t0 = Clock::now();
+        gears_scene::draw(scene, angle);
+        glFinish();
+        Clock::time_point t1 = Clock::now();
+        SDL_GL_SwapWindow(window);
+        Clock::time_point t2 = Clock::now();
+
+        render_ms.push_back(elapsed_ms(t0, t1));
+        sync_ms.push_back(elapsed_ms(t1, t2));
+        total_ms.push_back(elapsed_ms(t0, t2));
+
+        /* keep the window responsive */
+        SDL_Event event;
+        while (SDL_PollEvent(&event))
+        {
+        }
+    }
+
+    frame_stats::Summary total = frame_stats::summarize(total_ms);
+    printf("sdl2_gears: %d frames, %dx%d, %s, %.1f fps\n", frames, width, height,
+           scene.use_vbo ? "vbo" : "vertex arrays", frames * 1000.0 / total.total);
+    frame_stats::print("render", frame_stats::summarize(render_ms));
+    frame_stats::print("sync", frame_stats::summarize(sync_ms));
+    frame_stats::print("total", total);
 }
 
 void CheckSDLError(int line)
 {
     const char *error = SDL_GetError();
-    if (error != "")
+    if (error[0] != '\0')
     {
         printf("SLD Error: %s\n", error);
 
@@ -323,6 +160,18 @@ void cleanup()
 
 int main(int argc, char *argv[])
 {
+    int bench_frames = 0;
+    if (argc > 1)
+    {
+        if (argc > 2 && strcmp(argv[1], "--bench") == 0)
+            bench_frames = atoi(argv[2]);
+        if (bench_frames <= 0)
+        {
+            fprintf(stderr, "Usage: sdl2_gears [--bench <frames>]\n");
+            return 1;
+        }
+    }
+
     // Main
     printf("Initializing SDL\n");
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0)
@@ -360,9 +209,17 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    init();
+    gears_scene::init(scene);
 
-    reshape(width, height);
+    gears_scene::reshape(width, height);
+
+    if (bench_frames)
+    {
+        // Assets and audio are not part of the render path
+        bench(bench_frames);
+        cleanup();
+        return 0;
+    }
 
     // Image
     printf("Initializing SDL image supporting formats png and jpeg\n");
@@ -3,16 +3,22 @@ use cookbook::config::{CookConfig, CookLockOpt, get_config, init_config};
 use cookbook::cook::cook_build::{build, get_stage_dirs, remove_stage_dir};
 use cookbook::cook::fetch::{FetchResult, fetch, fetch_offline};
 use cookbook::cook::fs::{
-    create_dir, create_target_dir, get_git_commit_date, get_git_head_rev, get_git_rev_before_date,
-    remove_all, run_command,
+    create_dir, create_dir_clean, create_target_dir, get_git_commit_date, get_git_head_rev,
+    get_git_rev_before_date, remove_all, run_command,
 };
-use cookbook::cook::package::{package, package_handle_push};
-use cookbook::cook::pty::{PtyOut, UnixSlavePty, flush_pty, setup_pty, write_to_pty};
+use cookbook::cook::image::ImageWriter;
+use cookbook::cook::log::{self, Level, Logger};
+use cookbook::cook::metrics::{self, Phase, RecipeState};
+use cookbook::cook::package::{PushJob, package, package_prepare_push};
+use cookbook::cook::plan;
+use cookbook::cook::pty::{PtyOut, PtyReader, UnixSlavePty, flush_pty, setup_pty};
 use cookbook::cook::script::KILL_ALL_PID;
+use cookbook::cook::tar_store::TarStore;
+use cookbook::cook::trash;
 use cookbook::cook::tree::{self, WalkTreeEntry};
-use cookbook::cook::{fetch_repo, ident};
+use cookbook::cook::{fetch_repo, freshness, ident, memory};
 use cookbook::recipe::{
-    CookRecipe, SourceRecipe, recipes_flatten_package_names, recipes_mark_as_deps,
+    BuildKind, CookRecipe, SourceRecipe, recipes_flatten_package_names, recipes_mark_as_deps,
 };
 use cookbook::{Error, Result, staged_pkg};
 use pkg::{PackageName, PackageState};
@@ -25,12 +31,12 @@ use ratatui::widgets::{Block, Borders, Clear, List, ListItem, ListState, Paragra
 use redox_installer::PackageConfig;
 use std::borrow::Cow;
 use std::collections::{BTreeMap, HashMap, HashSet};
-use std::io::{Read, Write, stderr, stdin, stdout};
-use std::path::PathBuf;
+use std::io::{Write, stderr, stdin, stdout};
+use std::path::{Path, PathBuf};
 use std::process::Command;
 use std::str::FromStr;
-use std::sync::atomic::{AtomicBool, AtomicU32, Ordering};
-use std::sync::{Arc, OnceLock, mpsc};
+use std::sync::atomic::{AtomicBool, AtomicU32, AtomicUsize, Ordering};
+use std::sync::{Arc, Condvar, Mutex, mpsc};
 use std::time::{Duration, Instant};
 use std::{cmp, env, fs};
 use std::{process, thread};
@@ -58,6 +64,8 @@ const REPO_HELP_STR: &str = r#"
         capture-rev  write lock to git recipes
         change-rule  override rule to recipes
         change-rule-local  override rule to specific recipes
+        store-export copy recipe tarballs from the tar store to --store-dir
+        store-import copy recipe tarballs from --store-dir into the tar store
 
     common flags:
         --cookbook=<cookbook_dir>  the "recipes" folder, default to $PWD/recipes
@@ -68,9 +76,17 @@ const REPO_HELP_STR: &str = r#"
         --filesystem=<filesystem>  override recipes config using installer file
         --repo-binary              override recipes config to use repo_binary
         --sysroot=<sysroot_dir>    used in "push", the "root" dir, default to $PWD/sysroot
+        --image=<image>            used in "push", write into a RedoxFS disk or filesystem
+                                     image without mounting it, instead of --sysroot
         --set-rule=<rule>          used in "change-rule", set wanted config rule
         --rollback                 used in "capture-rev", allow git to rollback
         --unset                    used in "capture-rev" and "change-rule", unset locks
+        --plan[=text|json]         used in "cook", print which recipes would rebuild and why,
+                                     without fetching or building anything
+        --targets=<t1>,<t2>,...    used in "cook", build for several targets in one run,
+                                     fetching and building host recipes once (disables TUI)
+        --store-dir=<dir>          used in "store-export" and "store-import", holds
+                                     tarballs named <blake3>.tar
 
     cook env and their defaults:
         CI=                          set to any value to disable TUI
@@ -83,8 +99,27 @@ const REPO_HELP_STR: &str = r#"
         COOKBOOK_CLEAN_BUILD=false   remove build directory before building
         COOKBOOK_CLEAN_TARGET=false  remove target directory after building
         COOKBOOK_WRITE_FILETREE=false whether to write stage files tree
-        COOKBOOK_MAKE_JOBS=          override build jobs count from nproc
+        COOKBOOK_MAKE_JOBS=          override build jobs count from nproc,
+                                        also used as parallel push and plan workers
         COOKBOOK_WEB=false           whether to generate package web files
+        COOKBOOK_TAR_STORE=build/tar-store  tarballs shared between recipes and
+                                        checkouts, empty to disable
+        COOKBOOK_TAR_STORE_LIMIT=32768  size in MiB to prune the tar store to
+        COOKBOOK_MEMORY_BUDGET=      MiB that builds running together with --targets
+                                        may expect to use, 0 for no limit,
+                                        default is the system memory; only
+                                        --targets builds several recipes at once
+        COOKBOOK_METRICS=            serve live metrics over HTTP on a loopback
+                                        host:port or unix:<path>, at /metrics
+                                        (Prometheus) and /metrics.json
+        COOKBOOK_RAM_DIR=            directory in RAM, such as a tmpfs, to build
+                                        recipes that fit COOKBOOK_RAM_BUDGET in,
+                                        empty to build on disk
+        COOKBOOK_RAM_BUDGET=4096     size in MiB of builds kept in COOKBOOK_RAM_DIR
+        COOKBOOK_BUILD_SNAPSHOTS=    directory to archive build dirs in before
+                                        COOKBOOK_CLEAN_TARGET removes them, restored
+                                        on the next build, empty to disable
+        COOKBOOK_BUILD_SNAPSHOTS_LIMIT=16384  size in MiB to prune snapshots to
 "#;
 
 #[derive(Clone)]
@@ -100,6 +135,16 @@ struct CliConfig {
     with_rollback: bool,
     with_package_deps: bool,
     all: bool,
+    /// print rebuild plan in "text" or "json" instead of cooking
+    plan: Option<String>,
+    /// extra targets to cook in one run, empty means only redoxer::target()
+    targets: Vec<&'static str>,
+    /// sources are already fetched in this run, only check them offline
+    prefetched: bool,
+    /// where "store-export" and "store-import" put and find tarballs
+    store_dir: Option<PathBuf>,
+    /// RedoxFS image "push" writes into directly, instead of sysroot_dir
+    image: Option<PathBuf>,
     cook: CookConfig,
 }
 
@@ -117,6 +162,8 @@ enum CliCommand {
     CaptureRev,
     ChangeRule,
     ChangeRuleLocal,
+    StoreExport,
+    StoreImport,
 }
 
 impl CliCommand {
@@ -157,6 +204,8 @@ impl FromStr for CliCommand {
             "capture-rev" => Ok(CliCommand::CaptureRev),
             "change-rule" => Ok(CliCommand::ChangeRule),
             "change-rule-local" => Ok(CliCommand::ChangeRuleLocal),
+            "store-export" => Ok(CliCommand::StoreExport),
+            "store-import" => Ok(CliCommand::StoreImport),
             _ => bail_options_err!("Unknown command {:?}", s),
         }
     }
@@ -177,6 +226,8 @@ impl ToString for CliCommand {
             CliCommand::CaptureRev => "capture-rev".to_string(),
             CliCommand::ChangeRule => "change-rule".to_string(),
             CliCommand::ChangeRuleLocal => "change-rule-local".to_string(),
+            CliCommand::StoreExport => "store-export".to_string(),
+            CliCommand::StoreImport => "store-import".to_string(),
         }
     }
 }
@@ -203,6 +254,11 @@ impl CliConfig {
             filesystem: None,
             with_rollback: false,
             set_rule: None,
+            plan: None,
+            targets: Vec::new(),
+            prefetched: false,
+            store_dir: None,
+            image: None,
         })
     }
 }
@@ -226,9 +282,31 @@ fn main_inner() -> Result<()> {
     }
 
     let (config, command, recipes) = parse_args(args)?;
+    log::set_stderr_max_level(Level::max_for(config.cook.verbose));
+    trash::reap_leftovers();
+    if let Some(addr) = &config.cook.metrics {
+        metrics::serve(addr)?;
+    }
+    if matches!(command, CliCommand::Fetch | CliCommand::Cook) {
+        for recipe in expand_targets(&recipes, &config.targets) {
+            metrics::set_state(recipe.name.as_str(), recipe.target, RecipeState::Pending);
+        }
+    }
     if command.is_building() {
         ident::init_ident();
     }
+    if matches!(command, CliCommand::Fetch | CliCommand::Cook)
+        && !config.cook.offline
+        && !config.prefetched
+    {
+        freshness::prefetch_remote_heads(&recipes, config.cook.jobs);
+    }
+    if command == CliCommand::Cook && config.plan.is_some() {
+        return handle_plan(&expand_targets(&recipes, &config.targets), &config);
+    }
+    if command == CliCommand::Cook && !config.targets.is_empty() {
+        return handle_cook_targets(&recipes, &config);
+    }
     if command == CliCommand::Cook && config.cook.tui {
         match run_tui_cook(config.clone(), recipes.clone()) {
             Ok(TuiApp {
@@ -256,7 +334,7 @@ fn main_inner() -> Result<()> {
             }
             Err(e) => return Err(e),
         }
-        return publish_packages(&recipes, &config.repo_dir);
+        return publish_packages(&recipes, &config.repo_dir, redoxer::target());
     }
     if command == CliCommand::PushTree {
         return handle_tree(&recipes, false, &config);
@@ -304,7 +382,7 @@ fn main_inner() -> Result<()> {
     }
 
     if command == CliCommand::Cook {
-        return publish_packages(&recipes, &config.repo_dir);
+        return publish_packages(&recipes, &config.repo_dir, redoxer::target());
     }
 
     if verbose && recipes.len() > 1 {
@@ -362,6 +440,11 @@ fn repo_inner(config: &CliConfig, command: &CliCommand, recipe: &CookRecipe) ->
                 let cached = if is_cook {
                     handle_cook(recipe, config, fetch_result.source_dir, logger)?
                 } else {
+                    let state = match fetch_result.cached {
+                        true => RecipeState::Cached,
+                        false => RecipeState::Done,
+                    };
+                    metrics::set_state(recipe.name.as_str(), recipe.target, state);
                     fetch_result.cached
                 };
                 Ok(cached)
@@ -371,7 +454,7 @@ fn repo_inner(config: &CliConfig, command: &CliCommand, recipe: &CookRecipe) ->
             };
 
             let (status_tx, status_rx) = mpsc::channel::<StatusUpdate>();
-            let (mut stdout_writer, mut stderr_writer) = setup_logger(&status_tx, &recipe.name);
+            let (mut pty, recipe_log) = setup_logger(&status_tx, &recipe.name, config.cook.verbose);
             let mut app = TuiApp::new(vec![recipe.clone()]);
             app.dump_logs_anyway = config.cook.verbose;
             let dump_fail_logs = !app.dump_logs_anyway;
@@ -389,10 +472,10 @@ fn repo_inner(config: &CliConfig, command: &CliCommand, recipe: &CookRecipe) ->
                     }
                 }
             });
-            let mut logger = Some((&mut stdout_writer, &mut stderr_writer));
+            let mut logger = Some((&mut pty, &recipe_log));
             let result = repo_inner_fn(&logger);
             if let Err(err_ctx) = &result {
-                write_to_pty(&logger, &format!("\n{err_ctx}"));
+                log::log(&logger, Level::Error, format_args!("{err_ctx}"));
             }
             // successful cached build is not that useful to log
             if !matches!(result, Ok(true)) {
@@ -421,11 +504,18 @@ fn repo_inner(config: &CliConfig, command: &CliCommand, recipe: &CookRecipe) ->
             println!("{}", recipe.dir.display());
             false
         }
+        CliCommand::StoreExport | CliCommand::StoreImport => {
+            handle_tar_store(recipe, config, command)?
+        }
         _ => unreachable!(),
     })
 }
 
-fn publish_packages(recipe_names: &Vec<CookRecipe>, repo_path: &PathBuf) -> Result<()> {
+fn publish_packages(
+    recipe_names: &Vec<CookRecipe>,
+    repo_path: &PathBuf,
+    target: &str,
+) -> Result<()> {
     let repo_bin = env::current_exe()
         .map_err(|e| Error::from_io_error(e, "Getting exe path"))?
         .parent()
@@ -433,6 +523,7 @@ fn publish_packages(recipe_names: &Vec<CookRecipe>, repo_path: &PathBuf) -> Resu
         .join("repo_builder");
     let mut command = Command::new(repo_bin);
     command
+        .env("TARGET", target)
         .arg(repo_path)
         .args(recipe_names.iter().filter_map(|n| {
             if !n.is_deps {
@@ -459,6 +550,21 @@ fn parse_args(args: Vec<String>) -> Result<(CliConfig, CliCommand, Vec<CookRecip
                     "--sysroot" => config.sysroot_dir = PathBuf::from(value),
                     "--category" => config.category = Some(PathBuf::from(value)),
                     "--set-rule" => config.set_rule = Some(value.into()),
+                    "--store-dir" => config.store_dir = Some(PathBuf::from(value)),
+                    "--image" => config.image = Some(PathBuf::from(value)),
+                    "--targets" => {
+                        for target in value.split(',').filter(|t| !t.is_empty()) {
+                            // targets live as long as CookRecipe::target
+                            let target: &'static str = Box::leak(target.to_string().into());
+                            if !config.targets.contains(&target) {
+                                config.targets.push(target);
+                            }
+                        }
+                    }
+                    "--plan" => match value {
+                        "text" | "json" => config.plan = Some(value.into()),
+                        _ => bail_options_err!("Error: Unknown plan format: {}", value),
+                    },
                     "--filesystem" => {
                         config.filesystem = Some({
                             let r = redox_installer::Config::from_file(&PathBuf::from(value));
@@ -477,6 +583,7 @@ fn parse_args(args: Vec<String>) -> Result<(CliConfig, CliCommand, Vec<CookRecip
                     "--rollback" => config.with_rollback = true,
                     "--unset" => config.unset = true,
                     "--all" => config.all = true,
+                    "--plan" => config.plan = Some("text".into()),
                     _ => bail_options_err!("Error: Unknown flag: {}", arg),
                 }
             }
@@ -500,13 +607,28 @@ fn parse_args(args: Vec<String>) -> Result<(CliConfig, CliCommand, Vec<CookRecip
     if let Some(c) = config.logs_dir.as_mut() {
         create_dir(&c.join(redoxer::target()))?;
         create_dir(&c.join(redoxer::host_target()))?;
+        for target in &config.targets {
+            create_dir(&c.join(target))?;
+        }
     }
 
     let Some(command) = command else {
         bail_options_err!("Error: No command specified");
     };
     let command: CliCommand = str::parse(&command)?;
-    if command.is_informational() {
+    if config.plan.is_some() && command != CliCommand::Cook {
+        bail_options_err!("Error: --plan can only be used with \"cook\"");
+    }
+    if !config.targets.is_empty() && command != CliCommand::Cook {
+        bail_options_err!("Error: --targets can only be used with \"cook\"");
+    }
+    if matches!(command, CliCommand::StoreExport | CliCommand::StoreImport) {
+        let Some(dir) = &config.store_dir else {
+            bail_options_err!("Error: {} needs --store-dir", command.to_string());
+        };
+        create_dir(dir)?;
+    }
+    if command.is_informational() || config.plan.is_some() {
         // avoid extra data that clobber stdout
         config.cook.verbose = false;
     }
@@ -768,10 +890,17 @@ fn handle_fetch(
     allow_offline: bool,
     logger: &PtyOut,
 ) -> Result<FetchResult> {
-    match config.cook.offline && allow_offline {
+    log::set_phase(logger, "fetch");
+    metrics::set_state(recipe.name.as_str(), recipe.target, RecipeState::Fetching);
+    let _timer = metrics::time_phase(Phase::Fetch);
+    let result = match (config.cook.offline || config.prefetched) && allow_offline {
         true => fetch_offline(&recipe, logger),
         false => fetch(&recipe, !recipe.is_deps, logger),
+    };
+    if result.is_err() {
+        metrics::set_state(recipe.name.as_str(), recipe.target, RecipeState::Failed);
     }
+    result
 }
 
 fn handle_cook(
@@ -779,9 +908,28 @@ fn handle_cook(
     config: &CliConfig,
     source_dir: PathBuf,
     logger: &PtyOut,
+) -> Result<bool> {
+    metrics::set_state(recipe.name.as_str(), recipe.target, RecipeState::Cooking);
+    let result = handle_cook_phases(recipe, config, source_dir, logger);
+    let state = match result {
+        Ok(true) => RecipeState::Cached,
+        Ok(false) => RecipeState::Done,
+        Err(_) => RecipeState::Failed,
+    };
+    metrics::set_state(recipe.name.as_str(), recipe.target, state);
+    result
+}
+
+fn handle_cook_phases(
+    recipe: &CookRecipe,
+    config: &CliConfig,
+    source_dir: PathBuf,
+    logger: &PtyOut,
 ) -> Result<bool> {
     let recipe_dir = &recipe.dir;
     let target_dir = create_target_dir(recipe_dir, recipe.target)?;
+    log::set_phase(logger, "build");
+    let timer = metrics::time_phase(Phase::Build);
     let build_result = build(
         recipe_dir,
         &source_dir,
@@ -790,16 +938,26 @@ fn handle_cook(
         &config.cook,
         logger,
     )?;
+    drop(timer);
 
+    log::set_phase(logger, "package");
+    let _timer = metrics::time_phase(Phase::Package);
     package(&recipe, &build_result, &config.cook, logger)?;
 
     if config.cook.clean_target || config.cook.write_filetree {
-        for stage_dir in &build_result.stage_dirs {
+        for (i, stage_dir) in build_result.stage_dirs.iter().enumerate() {
             if stage_dir.is_dir() {
                 if config.cook.write_filetree {
-                    let mut stage_files_buf = Vec::new();
-                    tree::walk_file_tree(&stage_dir, "", &mut stage_files_buf)
-                        .map_err(|e| Error::from_io_error(e, "Walking files tree"))?;
+                    // a fresh build already has the manifest from splitting the stage
+                    let mut stage_files_buf = match &build_result.scan {
+                        Some(scan) => scan.file_tree(i),
+                        None => {
+                            let mut buf = Vec::new();
+                            tree::walk_file_tree(&stage_dir, "", &mut buf)
+                                .map_err(|e| Error::from_io_error(e, "Walking files tree"))?;
+                            buf
+                        }
+                    };
                     stage_files_buf.push("".into()); // trailing eol
                     fs::write(
                         stage_dir.with_added_extension("files"),
@@ -816,6 +974,235 @@ fn handle_cook(
     Ok(build_result.cached)
 }
 
+fn handle_plan(recipes: &Vec<CookRecipe>, config: &CliConfig) -> Result<()> {
+    let entries = plan::plan(recipes, config.cook.jobs)?;
+    if config.plan.as_deref() == Some("json") {
+        let json = serde_json::to_string_pretty(&entries)
+            .map_err(|e| Error::Other(format!("Serializing plan: {e}")))?;
+        println!("{json}");
+        return Ok(());
+    }
+
+    let width = entries.iter().map(|e| e.name.len()).max().unwrap_or(0);
+    let mut rebuilds = 0;
+    for entry in &entries {
+        match (entry.reason, &entry.cause) {
+            (Some(reason), Some(cause)) => {
+                println!("rebuild {:width$} {} ({})", entry.name, reason, cause)
+            }
+            (Some(reason), None) => println!("rebuild {:width$} {}", entry.name, reason),
+            (None, _) => println!("cached  {}", entry.name),
+        }
+        if entry.rebuild {
+            rebuilds += 1;
+        }
+    }
+    println!(
+        "\n{} of {} recipes would be rebuilt.",
+        rebuilds,
+        entries.len()
+    );
+    Ok(())
+}
+
+/// Clone recipes for each target, keeping dependency order and building host recipes once
+fn expand_targets(recipes: &Vec<CookRecipe>, targets: &[&'static str]) -> Vec<CookRecipe> {
+    if targets.is_empty() {
+        return recipes.clone();
+    }
+    let mut expanded = Vec::new();
+    for recipe in recipes {
+        if recipe.name.is_host() {
+            expanded.push(recipe.clone());
+            continue;
+        }
+        for target in targets {
+            expanded.push(recipe.with_target(target));
+        }
+    }
+    expanded
+}
+
+#[derive(Clone, Copy, PartialEq)]
+enum TargetJobState {
+    Pending,
+    Running,
+    Done,
+    Failed,
+}
+
+/// Cook for several targets: fetch every recipe once, then build each (recipe, target)
+/// on a shared pool as soon as its build dependencies for that target are done and
+/// its expected peak memory fits the memory budget next to the running builds.
+fn handle_cook_targets(recipes: &Vec<CookRecipe>, config: &CliConfig) -> Result<()> {
+    if recipes
+        .iter()
+        .any(|r| r.recipe.build.kind == BuildKind::Remote && !r.name.is_host())
+    {
+        bail_options_err!("Error: --targets does not support recipes using binary packages");
+    }
+
+    // sources are shared between targets
+    let mut fetch_failed: HashSet<PackageName> = HashSet::new();
+    for recipe in recipes {
+        let recipe = recipe.with_target(config.targets[0]);
+        if let Err(e) = repo_inner(config, &CliCommand::Fetch, &recipe) {
+            print_failed(&CliCommand::Fetch, &recipe.name);
+            if !config.cook.nonstop {
+                return Err(e);
+            }
+            eprintln!("{}", e);
+            fetch_failed.insert(recipe.name.clone());
+        }
+    }
+
+    let mut cook_config = config.clone();
+    cook_config.prefetched = true;
+    let jobs: Vec<CookRecipe> = expand_targets(recipes, &config.targets)
+        .into_iter()
+        .filter(|r| !fetch_failed.contains(&r.name))
+        .collect();
+    let job_index: HashMap<(&PackageName, &str), usize> = jobs
+        .iter()
+        .enumerate()
+        .map(|(i, r)| ((&r.name, r.target), i))
+        .collect();
+    let job_deps: Vec<Vec<usize>> = jobs
+        .iter()
+        .map(|r| {
+            let build = &r.recipe.build;
+            build
+                .dependencies
+                .iter()
+                .chain(build.dev_dependencies.iter())
+                .filter_map(|dep| {
+                    let target = if dep.is_host() {
+                        redoxer::host_target()
+                    } else {
+                        r.target
+                    };
+                    job_index.get(&(dep, target)).copied()
+                })
+                .collect()
+        })
+        .collect();
+
+    let job_memory: Vec<u64> = jobs.iter().map(memory::expected_peak).collect();
+
+    let state = Mutex::new((
+        vec![TargetJobState::Pending; jobs.len()],
+        None::<Error>,
+        memory::MemoryBudget::new(config.cook.memory_budget),
+    ));
+    let changed = Condvar::new();
+    // one build per target at a time, sharing the make jobs so that they add up to cook.jobs
+    let workers = config
+        .targets
+        .len()
+        .clamp(1, config.cook.jobs.max(1))
+        .min(jobs.len().max(1));
+    let make_jobs = (config.cook.jobs / workers).max(1);
+    thread::scope(|s| {
+        for _ in 0..workers {
+            s.spawn(|| {
+                let mut guard = state.lock().unwrap();
+                loop {
+                    let (states, err, budget) = &mut *guard;
+                    if err.is_some() {
+                        break;
+                    }
+                    let mut next = None;
+                    for i in 0..jobs.len() {
+                        if states[i] != TargetJobState::Pending {
+                            continue;
+                        }
+                        if job_deps[i]
+                            .iter()
+                            .any(|d| states[*d] == TargetJobState::Failed)
+                        {
+                            states[i] = TargetJobState::Failed;
+                            print_failed(&CliCommand::Cook, &jobs[i].name);
+                            continue;
+                        }
+                        // one target at a time per recipe, as they share the source dir
+                        let ready = job_deps[i]
+                            .iter()
+                            .all(|d| states[*d] == TargetJobState::Done)
+                            && !jobs.iter().zip(states.iter()).any(|(r, s)| {
+                                *s == TargetJobState::Running && r.dir == jobs[i].dir
+                            })
+                            && budget.admits(job_memory[i]);
+                        if ready {
+                            next = Some(i);
+                            break;
+                        }
+                    }
+                    let Some(i) = next else {
+                        if !states.contains(&TargetJobState::Pending) {
+                            break;
+                        }
+                        guard = changed.wait(guard).unwrap();
+                        continue;
+                    };
+                    states[i] = TargetJobState::Running;
+                    budget.reserve(job_memory[i]);
+                    let mut job_config = cook_config.clone();
+                    job_config.cook.jobs = budget.jobs_for(job_memory[i], make_jobs);
+                    drop(guard);
+
+                    let recipe = &jobs[i];
+                    let result = repo_inner(&job_config, &CliCommand::Cook, recipe);
+                    match &result {
+                        Ok(true) => print_cached(&CliCommand::Cook, &recipe.name),
+                        Ok(false) => print_success(&CliCommand::Cook, &recipe.name),
+                        Err(e) => {
+                            if config.cook.nonstop {
+                                if config.cook.verbose {
+                                    eprintln!("{}", e);
+                                }
+                                if let Err(e) = handle_nonstop_fail(recipe) {
+                                    eprintln!("{}", e)
+                                };
+                            }
+                            print_failed(&CliCommand::Cook, &recipe.name);
+                        }
+                    }
+
+                    guard = state.lock().unwrap();
+                    let (states, err, budget) = &mut *guard;
+                    budget.release(job_memory[i]);
+                    match result {
+                        Ok(_) => states[i] = TargetJobState::Done,
+                        Err(e) => {
+                            states[i] = TargetJobState::Failed;
+                            if !config.cook.nonstop && err.is_none() {
+                                *err = Some(e);
+                            }
+                        }
+                    }
+                    changed.notify_all();
+                }
+            });
+        }
+    });
+
+    if let (_, Some(e), _) = state.into_inner().unwrap() {
+        return Err(e);
+    }
+
+    for target in &config.targets {
+        publish_packages(recipes, &config.repo_dir, target)?;
+    }
+    if config.cook.verbose {
+        println!(
+            "\nCommand 'cook' completed for {} recipes on {} targets.",
+            recipes.len(),
+            config.targets.len()
+        );
+    }
+    Ok(())
+}
+
 /// delete stage artifacts upon nonstop failure to let repo_builder know
 fn handle_nonstop_fail(recipe: &CookRecipe) -> cookbook::Result<()> {
     let target_dir = recipe.target_dir();
@@ -836,15 +1223,52 @@ fn handle_clean(recipe: &CookRecipe, _config: &CliConfig, command: &CliCommand)
         remove_all(&dir)?;
         cached = false;
     }
-    let dir = recipe.dir.join("source");
-    if dir.exists() && matches!(*command, CliCommand::Unfetch) {
-        remove_all(&dir)?;
-        cached = false;
+    if matches!(*command, CliCommand::Unfetch) {
+        for dir in [
+            recipe.dir.join("source"),
+            recipe.dir.join("source.cache"),
+            recipe.dir.join("source.blake3"),
+        ] {
+            if dir.exists() {
+                remove_all(&dir)?;
+                cached = false;
+            }
+        }
     }
     Ok(cached)
 }
 
-static PUSH_SYSROOT_DIR: OnceLock<PathBuf> = OnceLock::new();
+fn handle_tar_store(recipe: &CookRecipe, config: &CliConfig, command: &CliCommand) -> Result<bool> {
+    let Some(SourceRecipe::Tar {
+        blake3: Some(blake3),
+        ..
+    }) = &recipe.recipe.source
+    else {
+        return Ok(true);
+    };
+    let Some(store) = TarStore::from_config()? else {
+        return Err(Error::from("Tar store is disabled by COOKBOOK_TAR_STORE"));
+    };
+    let store_dir = config.store_dir.as_ref().unwrap();
+    let found = if *command == CliCommand::StoreExport {
+        store.adopt_if_matching(&recipe.dir.join("source.tar"), blake3)?;
+        store.export(blake3, store_dir)?
+    } else {
+        store.import(blake3, store_dir)?
+    };
+    if !found {
+        return Err(Error::from(format!(
+            "Tarball {blake3} is not in {}",
+            if *command == CliCommand::StoreExport {
+                "the tar store, fetch the recipe first"
+            } else {
+                "--store-dir"
+            }
+        )));
+    }
+    Ok(false)
+}
+
 fn handle_push(recipes: &Vec<CookRecipe>, config: &CliConfig) -> Result<()> {
     let recipe_map: HashMap<&PackageName, &CookRecipe> =
         recipes.iter().map(|r| (&r.name, r)).collect();
@@ -852,23 +1276,31 @@ fn handle_push(recipes: &Vec<CookRecipe>, config: &CliConfig) -> Result<()> {
     let mut total_count: u64 = 0;
     let mut visited: HashSet<PackageName> = HashSet::new();
     let num_recipes = recipes.len();
-    PUSH_SYSROOT_DIR.set(config.sysroot_dir.clone()).unwrap();
-    let handle_push_inner = move |package_name: &PackageName,
-                                  _prefix: &str,
-                                  _is_last: bool,
-                                  entry: &WalkTreeEntry|
-          -> Result<bool> {
+    // with an image, the package state and heads are read from and written to a local copy
+    let meta_dir = env::temp_dir().join(format!("cookbook-push-{}", process::id()));
+    let image = match &config.image {
+        Some(image) => {
+            create_dir_clean(&meta_dir)?;
+            Some(ImageWriter::open(image, &meta_dir, config.cook.jobs)?)
+        }
+        None => None,
+    };
+    let install_path = if image.is_some() {
+        &meta_dir
+    } else {
+        &config.sysroot_dir
+    };
+    let mut state = PackageState::from_sysroot(install_path).map_err(Error::from)?;
+    let mut jobs: Vec<(PackageName, PushJob)> = Vec::new();
+    // the tree walk only collects what to push, extraction is done in parallel later
+    let mut handle_push_inner = |package_name: &PackageName,
+                                 _prefix: &str,
+                                 _is_last: bool,
+                                 entry: &WalkTreeEntry|
+     -> Result<bool> {
         let r = match entry {
             WalkTreeEntry::Built(archive_path, _) => {
-                let install_path = PUSH_SYSROOT_DIR.get().unwrap();
-                let mut state = PackageState::from_sysroot(install_path).map_err(Error::from)?;
-                let r = package_handle_push(&mut state, archive_path, &install_path, false);
-                if matches!(r, Ok(false)) {
-                    state
-                        .to_sysroot(install_path)
-                        .map_err(|e| Error::from_io_error(e, "Extracting package"))?;
-                }
-                r
+                package_prepare_push(&state, archive_path, false)
             }
             WalkTreeEntry::NotBuilt => Err(Error::Other(format!(
                 "Package {} has not been built",
@@ -880,12 +1312,12 @@ fn handle_push(recipes: &Vec<CookRecipe>, config: &CliConfig) -> Result<()> {
             }
         };
         match r {
-            Ok(true) => {
+            Ok(None) => {
                 print_cached(&CliCommand::Push, package_name);
                 Ok(true)
             }
-            Ok(false) => {
-                print_success(&CliCommand::Push, package_name);
+            Ok(Some(job)) => {
+                jobs.push((package_name.clone(), job));
                 Ok(false)
             }
             Err(e) => {
@@ -908,10 +1340,55 @@ fn handle_push(recipes: &Vec<CookRecipe>, config: &CliConfig) -> Result<()> {
             &mut visited,
             &mut total_size,
             &mut total_count,
-            handle_push_inner,
+            &mut handle_push_inner,
         )?;
     }
 
+    let results = match &image {
+        Some(image) => {
+            push_extract_parallel(&jobs, install_path, config.cook.jobs, &|job: &PushJob| {
+                job.extract_image(install_path, image)
+            })
+        }
+        None => push_extract_parallel(&jobs, install_path, config.cook.jobs, &|job: &PushJob| {
+            job.extract(install_path)
+        }),
+    };
+    let mut push_err = None;
+    let has_jobs = !jobs.is_empty();
+    for ((package_name, job), result) in jobs.into_iter().zip(results) {
+        match result {
+            Ok(()) => {
+                job.commit(&mut state);
+                print_success(&CliCommand::Push, &package_name);
+            }
+            Err(e) => {
+                print_failed(&CliCommand::Push, &package_name);
+                if !config.cook.nonstop && push_err.is_none() {
+                    push_err = Some(e);
+                }
+            }
+        }
+    }
+    // written once, including packages that succeeded before an error
+    if has_jobs {
+        state
+            .to_sysroot(install_path)
+            .map_err(|e| Error::from_io_error(e, "Extracting package"))?;
+    }
+    if let Some(image) = image {
+        let result = if has_jobs {
+            image.finish(&meta_dir)
+        } else {
+            Ok(())
+        };
+        remove_all(&meta_dir)?;
+        result?;
+    }
+    if let Some(e) = push_err {
+        return Err(e);
+    }
+
     if config.cook.verbose {
         println!("");
         println!(
@@ -929,6 +1406,68 @@ fn handle_push(recipes: &Vec<CookRecipe>, config: &CliConfig) -> Result<()> {
     Ok(())
 }
 
+/// Extract packages concurrently. Packages that write or remove a path claimed by an earlier
+/// package are extracted after the others, in push order, so the later package still wins.
+fn push_extract_parallel(
+    jobs: &[(PackageName, PushJob)],
+    sysroot_dir: &Path,
+    num_jobs: usize,
+    extract: &(dyn Fn(&PushJob) -> Result<()> + Sync),
+) -> Vec<Result<()>> {
+    let mut claimed: HashSet<PathBuf> = HashSet::new();
+    let mut parallel = Vec::new();
+    let mut serial = Vec::new();
+    for (i, (_, job)) in jobs.iter().enumerate() {
+        let Ok(paths) = job.entry_paths(sysroot_dir) else {
+            // report the error from extract
+            serial.push(i);
+            continue;
+        };
+        // also the paths a delta install removes, which another package may write
+        let paths: HashSet<PathBuf> = paths.into_iter().collect();
+        let mut overlaps = false;
+        for path in paths {
+            if !claimed.insert(path) {
+                overlaps = true;
+            }
+        }
+        if overlaps {
+            serial.push(i);
+        } else {
+            parallel.push(i);
+        }
+    }
+
+    let mut results: Vec<Option<Result<()>>> = jobs.iter().map(|_| None).collect();
+    let next = AtomicUsize::new(0);
+    thread::scope(|s| {
+        let workers: Vec<_> = (0..num_jobs.clamp(1, parallel.len().max(1)))
+            .map(|_| {
+                s.spawn(|| {
+                    let mut done = Vec::new();
+                    loop {
+                        let k = next.fetch_add(1, Ordering::Relaxed);
+                        let Some(&i) = parallel.get(k) else {
+                            break;
+                        };
+                        done.push((i, extract(&jobs[i].1)));
+                    }
+                    done
+                })
+            })
+            .collect();
+        for worker in workers {
+            for (i, result) in worker.join().expect("push worker panicked") {
+                results[i] = Some(result);
+            }
+        }
+    });
+    for i in serial {
+        results[i] = Some(extract(&jobs[i].1));
+    }
+    results.into_iter().map(|r| r.unwrap()).collect()
+}
+
 fn handle_tree(recipes: &Vec<CookRecipe>, is_build_tree: bool, _config: &CliConfig) -> Result<()> {
     let recipe_map: HashMap<&PackageName, &CookRecipe> =
         recipes.iter().map(|r| (&r.name, r)).collect();
@@ -1161,9 +1700,12 @@ const PROMPT_WAIT: Duration = Duration::from_millis(101);
 
 struct TuiApp {
     recipes: Vec<(CookRecipe, RecipeStatus)>,
+    recipe_index: HashMap<PackageName, usize>,
     active_fetch: Option<PackageName>,
     active_cook: Option<PackageName>,
     logs: HashMap<PackageName, Vec<String>>,
+    /// ANSI-stripped and lowercased copy of logs, for searching
+    log_search_index: HashMap<PackageName, Vec<String>>,
     log_byte_buffer: HashMap<PackageName, Vec<u8>>,
     log_scroll: usize,
     log_view_job: JobType,
@@ -1179,6 +1721,8 @@ struct TuiApp {
     search_query: String,
     search_results: Option<Vec<usize>>,
     search_idx: usize,
+    /// whether something changed since last draw
+    dirty: bool,
 }
 
 impl TuiApp {
@@ -1189,9 +1733,15 @@ impl TuiApp {
                 .cloned()
                 .map(|r| (r, RecipeStatus::Pending))
                 .collect(),
+            recipe_index: recipes
+                .iter()
+                .enumerate()
+                .map(|(i, r)| (r.name.clone(), i))
+                .collect(),
             active_fetch: None,
             active_cook: None,
             logs: HashMap::new(),
+            log_search_index: HashMap::new(),
             log_byte_buffer: HashMap::new(),
             log_scroll: 0,
             auto_scroll: true,
@@ -1207,6 +1757,7 @@ impl TuiApp {
             search_query: String::new(),
             search_results: None,
             search_idx: 0,
+            dirty: true,
         }
     }
 
@@ -1259,13 +1810,20 @@ impl TuiApp {
         return Ok(());
     }
 
+    fn clear_log(&mut self, name: &PackageName) {
+        self.logs.insert(name.clone(), Vec::new());
+        self.log_search_index.insert(name.clone(), Vec::new());
+        self.log_byte_buffer.insert(name.clone(), Vec::new());
+    }
+
     // Update the state based on a message from a worker thread
     fn update_status(&mut self, update: StatusUpdate) {
+        let was_dirty = self.dirty;
+        self.dirty = true;
         let (name, new_status) = match update {
             StatusUpdate::StartFetch(name) => {
                 self.active_fetch = Some(name.clone());
-                self.logs.insert(name.clone(), Vec::new());
-                self.log_byte_buffer.insert(name.clone(), Vec::new());
+                self.clear_log(&name);
                 self.log_scroll = 0;
                 self.auto_scroll = true;
                 (name.clone(), RecipeStatus::Fetching)
@@ -1277,8 +1835,7 @@ impl TuiApp {
             }
             StatusUpdate::StartCook(name) => {
                 self.active_cook = Some(name.clone());
-                self.logs.insert(name.clone(), Vec::new());
-                self.log_byte_buffer.insert(name.clone(), Vec::new());
+                self.clear_log(&name);
                 (name.clone(), RecipeStatus::Cooking)
             }
             StatusUpdate::PushLog(name, chunk) => {
@@ -1288,14 +1845,20 @@ impl TuiApp {
                     let _ = std::io::stdout().write_all(&chunk);
                 }
                 let log_list = self.logs.entry(name.clone()).or_default();
+                let search_list = self.log_search_index.entry(name.clone()).or_default();
                 // TODO: multibyte-aware line split?
                 while let Some(newline_pos) = buffer.iter().position(|&b| b == b'\n') {
                     let line_bytes = buffer.drain(..=newline_pos);
                     let line_str = String::from_utf8_lossy(&line_bytes.as_slice());
                     let line_str_pos = line_str.trim_end();
                     let line_str = line_str_pos.rsplit('\r').next().unwrap_or(&line_str_pos);
+                    search_list.push(strip_ansi_escapes::strip_str(line_str).to_lowercase());
                     log_list.push(line_str.to_owned());
                 }
+                // only the active log is visible
+                if self.get_active_name().as_ref() != Some(&name) {
+                    self.dirty = was_dirty;
+                }
                 return;
             }
             StatusUpdate::FlushLog(name, path) => {
@@ -1333,8 +1896,8 @@ impl TuiApp {
             }
         };
 
-        if let Some((_, status)) = self.recipes.iter_mut().find(|(r, _)| r.name == name) {
-            *status = new_status;
+        if let Some(i) = self.recipe_index.get(&name) {
+            self.recipes[*i].1 = new_status;
         }
     }
 }
@@ -1346,6 +1909,7 @@ fn run_tui_cook(config: CliConfig, recipes: Vec<CookRecipe>) -> Result<TuiApp> {
     let running = Arc::new(AtomicBool::new(true));
     let prompting = Arc::new(AtomicU32::new(0));
     const TICK_RATE: Duration = Duration::from_millis(100);
+    const SPINNER_RATE: Duration = Duration::from_millis(250);
 
     // ---- Cooker Thread ----
     let cooker_config = config.clone();
@@ -1354,8 +1918,9 @@ fn run_tui_cook(config: CliConfig, recipes: Vec<CookRecipe>) -> Result<TuiApp> {
     let cooker_handle = thread::spawn(move || {
         'done: for (mut recipe, fetch_result) in work_rx {
             let name = recipe.name.clone();
-            let (mut stdout_writer, mut stderr_writer) = setup_logger(&cooker_status_tx, &name);
-            let mut logger = Some((&mut stdout_writer, &mut stderr_writer));
+            let (mut pty, recipe_log) =
+                setup_logger(&cooker_status_tx, &name, cooker_config.cook.verbose);
+            let mut logger = Some((&mut pty, &recipe_log));
             'again: loop {
                 cooker_status_tx
                     .send(StatusUpdate::StartCook(name.clone()))
@@ -1372,7 +1937,7 @@ fn run_tui_cook(config: CliConfig, recipes: Vec<CookRecipe>) -> Result<TuiApp> {
                     && !matches!(handler, Ok(true))
                 {
                     if let Err(err_ctx) = &handler {
-                        write_to_pty(&logger, &format!("\n{err_ctx}"));
+                        log::log(&logger, Level::Error, format_args!("{err_ctx}"));
                     }
                     flush_pty(&mut logger);
                     let log_path = log_path.join(format!("{}/{}.log", recipe.target, name.name()));
@@ -1464,8 +2029,9 @@ fn run_tui_cook(config: CliConfig, recipes: Vec<CookRecipe>) -> Result<TuiApp> {
     let fetcher_handle = thread::spawn(move || {
         'done: for mut recipe in fetcher_recipes {
             let name = recipe.name.clone();
-            let (mut stdout_writer, mut stderr_writer) = setup_logger(&fetcher_status_tx, &name);
-            let mut logger = Some((&mut stdout_writer, &mut stderr_writer));
+            let (mut pty, recipe_log) =
+                setup_logger(&fetcher_status_tx, &name, fetcher_config.cook.verbose);
+            let mut logger = Some((&mut pty, &recipe_log));
             'again: loop {
                 fetcher_status_tx
                     .send(StatusUpdate::StartFetch(name.clone()))
@@ -1477,7 +2043,7 @@ fn run_tui_cook(config: CliConfig, recipes: Vec<CookRecipe>) -> Result<TuiApp> {
                     && !matches!(handler, Ok(FetchResult { cached: true, .. }))
                 {
                     if let Err(err_ctx) = &handler {
-                        write_to_pty(&logger, &format!("\n{err_ctx}"));
+                        log::log(&logger, Level::Error, format_args!("{err_ctx}"));
                     }
                     flush_pty(&mut logger);
                     let log_path = log_path.join(format!("{}/{}.log", recipe.target, name.name()));
@@ -1554,11 +2120,44 @@ fn run_tui_cook(config: CliConfig, recipes: Vec<CookRecipe>) -> Result<TuiApp> {
 
     let spinner = ['-', '\\', '|', '/'];
     let mut spinner_i = 0;
+    let mut last_spin = Instant::now();
+    let mut last_size = terminal.size().ok();
 
     while running.load(Ordering::SeqCst) {
         let frame_start = Instant::now();
-        let r = terminal.draw(|f| {
+
+        while let Ok(update) = status_rx.try_recv() {
+            app.update_status(update);
+        }
+        while let Ok(event) = input_rx.try_recv() {
+            handle_tui_event(&event, &mut app, &prompting, &running);
+        }
+        if (app.active_fetch.is_some() || app.active_cook.is_some())
+            && last_spin.elapsed() >= SPINNER_RATE
+        {
             spinner_i = (spinner_i + 1) % spinner.len();
+            last_spin = frame_start;
+            app.dirty = true;
+        }
+        let size = terminal.size().ok();
+        if size != last_size {
+            last_size = size;
+            app.dirty = true;
+        }
+
+        // nothing to draw, avoid stealing CPU from builds
+        if !app.dirty {
+            if app.cook_complete {
+                running.swap(false, Ordering::SeqCst);
+            }
+            if let Some(sleep_duration) = TICK_RATE.checked_sub(frame_start.elapsed()) {
+                thread::sleep(sleep_duration);
+            }
+            continue;
+        }
+        app.dirty = false;
+
+        let r = terminal.draw(|f| {
             let spin = spinner[spinner_i];
 
             let mut constraints = Vec::new();
@@ -1579,11 +2178,12 @@ fn run_tui_cook(config: CliConfig, recipes: Vec<CookRecipe>) -> Result<TuiApp> {
             let panel_height = chunks[0].height.saturating_sub(2) as usize;
 
             if !app.is_inspecting {
-                // Left Pane
+                // Left Pane, only items visible in the viewport are built
                 let fetch_items: Vec<ListItem> = app
                     .recipes
                     .iter()
                     .filter(|(_, s)| s.fetch_is_part_of())
+                    .take(panel_height)
                     .map(|(r, s)| {
                         let icon = s.fetch_icon(spin);
                         ListItem::new(format!("{icon} {}", r.name)).style(s.fetch_style())
@@ -1597,20 +2197,14 @@ fn run_tui_cook(config: CliConfig, recipes: Vec<CookRecipe>) -> Result<TuiApp> {
                 f.render_widget(fetch_list, chunks[0]);
 
                 // Right Pane
-                let cook_items: Vec<ListItem> = app
+                let cook_recipes: Vec<&(CookRecipe, RecipeStatus)> = app
                     .recipes
                     .iter()
                     .filter(|(_, s)| s.cook_is_part_of())
-                    .map(|(r, s)| {
-                        let icon = s.cook_icon(spin);
-                        ListItem::new(format!("{icon} {}", r.name)).style(s.cook_style())
-                    })
                     .collect();
                 {
-                    let cooking_index = app
-                        .recipes
+                    let cooking_index = cook_recipes
                         .iter()
-                        .filter(|(_, s)| s.cook_is_part_of())
                         .position(|(_r, s)| *s == RecipeStatus::Cooking);
 
                     if let Some(index) = cooking_index {
@@ -1622,14 +2216,34 @@ fn run_tui_cook(config: CliConfig, recipes: Vec<CookRecipe>) -> Result<TuiApp> {
                         *app.cook_list_state.offset_mut() = new_offset;
                     }
                 }
-                let cook_items: Vec<ListItem> = cook_items[app.cook_scroll..].into();
+                let window = app.cook_list_state.offset();
+                let offset = cmp::min(app.cook_scroll + window, cook_recipes.len());
+                let end = cmp::min(offset + panel_height, cook_recipes.len());
+                let cook_items: Vec<ListItem> = cook_recipes[offset..end]
+                    .iter()
+                    .map(|(r, s)| {
+                        let icon = s.cook_icon(spin);
+                        ListItem::new(format!("{icon} {}", r.name)).style(s.cook_style())
+                    })
+                    .collect();
                 let cook_chunk = chunks[if app.fetch_complete { 0 } else { 1 }];
                 let cook_list = List::new(cook_items).block(
                     Block::default()
                         .title("Cook Queue [2]")
                         .borders(Borders::ALL),
                 );
+                // the list only holds the visible items, so shift the state to them
+                // while rendering and back afterwards
+                let selected = app.cook_list_state.selected();
+                *app.cook_list_state.offset_mut() = 0;
+                app.cook_list_state.select(
+                    selected
+                        .and_then(|i| i.checked_sub(offset))
+                        .filter(|i| *i < end - offset),
+                );
                 f.render_stateful_widget(cook_list, cook_chunk, &mut app.cook_list_state);
+                *app.cook_list_state.offset_mut() += window;
+                app.cook_list_state.select(selected);
             }
 
             let log_area = if app.is_inspecting {
@@ -1804,39 +2418,10 @@ fn run_tui_cook(config: CliConfig, recipes: Vec<CookRecipe>) -> Result<TuiApp> {
             if intended_scroll_pos > 0 {
                 app.log_scroll = intended_scroll_pos;
             }
-
-            while let Ok(event) = input_rx.try_recv() {
-                if app.is_inspecting {
-                    if handle_inspect_event(&event, &mut app) {
-                        app.is_inspecting = false;
-                    }
-                    continue;
-                }
-                if let Some((app, res)) = handle_prompt_input(&event, &mut app) {
-                    prompting.swap(res as u32, Ordering::SeqCst);
-                    if res == PromptOption::Exit {
-                        // TODO: This can be a different log with what prompted on nonstop mode
-                        let (name, log, line) = app.get_active_log();
-                        if let Some(name) = name
-                            && let Some(log) = log
-                        {
-                            app.dump_logs_on_exit = Some((name.to_owned(), join_logs(log, line)));
-                        }
-                        running.store(false, Ordering::SeqCst);
-                    }
-                    app.prompt = None;
-                } else {
-                    handle_main_event(&mut app, &event);
-                }
-            }
         });
 
         r.map_err(|e| Error::from_io_error(e, "Drawing to terminal pty"))?;
 
-        while let Ok(update) = status_rx.try_recv() {
-            app.update_status(update);
-        }
-
         if app.cook_complete {
             running.swap(false, Ordering::SeqCst);
         }
@@ -1859,6 +2444,32 @@ fn run_tui_cook(config: CliConfig, recipes: Vec<CookRecipe>) -> Result<TuiApp> {
     Ok(app)
 }
 
+fn handle_tui_event(event: &Event, app: &mut TuiApp, prompting: &AtomicU32, running: &AtomicBool) {
+    app.dirty = true;
+    if app.is_inspecting {
+        if handle_inspect_event(event, app) {
+            app.is_inspecting = false;
+        }
+        return;
+    }
+    if let Some((app, res)) = handle_prompt_input(event, app) {
+        prompting.swap(res as u32, Ordering::SeqCst);
+        if res == PromptOption::Exit {
+            // TODO: This can be a different log with what prompted on nonstop mode
+            let (name, log, line) = app.get_active_log();
+            if let Some(name) = name
+                && let Some(log) = log
+            {
+                app.dump_logs_on_exit = Some((name.to_owned(), join_logs(log, line)));
+            }
+            running.store(false, Ordering::SeqCst);
+        }
+        app.prompt = None;
+    } else {
+        handle_main_event(app, event);
+    }
+}
+
 fn join_logs(log: &Vec<String>, line: Option<Cow<'_, str>>) -> String {
     let mut logs = log.join("\n");
     if let Some(line) = line {
@@ -1921,16 +2532,15 @@ fn perform_search(app: &mut TuiApp) {
         return;
     }
 
-    let (_, log_text, _) = app.get_active_log();
+    let search_index = app
+        .get_active_name()
+        .and_then(|name| app.log_search_index.get(&name));
+    let query = app.search_query.to_lowercase();
     let mut search_results = Vec::new();
     let mut first_index = None;
-    if let Some(logs) = log_text {
-        for (i, line) in logs.iter().enumerate() {
-            let stripped = strip_ansi_escapes::strip_str(line);
-            if stripped
-                .to_lowercase()
-                .contains(&app.search_query.to_lowercase())
-            {
+    if let Some(lines) = search_index {
+        for (i, line) in lines.iter().enumerate() {
+            if line.contains(&query) {
                 search_results.push(i);
                 if first_index.is_none() && i >= app.log_scroll {
                     first_index = Some((i, search_results.len() - 1));
@@ -2150,41 +2760,50 @@ fn draw_prompt(f: &mut ratatui::Frame, prompt: &FailurePrompt, is_nonstop: bool)
     f.render_widget(paragraph, popup_area);
 }
 
-fn spawn_log_reader<R>(
-    mut reader: R,
+fn spawn_log_reader(
+    reader: Arc<PtyReader>,
     package_name: PackageName,
     status_tx: mpsc::Sender<StatusUpdate>,
-) where
-    R: Read + Send + 'static,
-{
+) {
     thread::spawn(move || {
-        let mut buffer = [0; 1024];
         loop {
-            let buf = match reader.read(&mut buffer) {
-                Ok(0) => break,
-                Ok(n) => buffer[..n].to_vec(),
-                Err(e) => format!("[IO Error] {}", e).into_bytes(),
-            };
-            if status_tx
-                .send(StatusUpdate::PushLog(package_name.clone(), buf))
-                .is_err()
-            {
-                // TUI thread hung up
+            let mut hung_up = false;
+            let open = reader.pump(&mut |buf| {
+                if status_tx
+                    .send(StatusUpdate::PushLog(package_name.clone(), buf.to_vec()))
+                    .is_err()
+                {
+                    hung_up = true;
+                }
+            });
+            if !open || hung_up {
+                // pty closed or TUI thread hung up
                 break;
             }
         }
     });
 }
 
+/// Route a recipe's command output and log lines into the TUI, in order.
 fn setup_logger(
     status_tx: &mpsc::Sender<StatusUpdate>,
     name: &PackageName,
-) -> (UnixSlavePty, std::io::PipeWriter) {
-    let (pty_reader, log_reader, pipes) = setup_pty();
-
-    spawn_log_reader(pty_reader, name.clone(), status_tx.clone());
-    spawn_log_reader(log_reader, name.clone(), status_tx.clone());
-    pipes
+    verbose: bool,
+) -> (UnixSlavePty, Logger) {
+    let (pty_reader, pty) = setup_pty();
+    spawn_log_reader(pty_reader.clone(), name.clone(), status_tx.clone());
+
+    let log_tx = status_tx.clone();
+    let log_name = name.clone();
+    let logger = Logger::new(
+        name.as_str(),
+        Box::new(move |buf: &[u8]| {
+            let _ = log_tx.send(StatusUpdate::PushLog(log_name.clone(), buf.to_vec()));
+        }),
+    )
+    .with_max_level(Level::max_for(verbose))
+    .with_pty(pty_reader);
+    (pty, logger)
 }
 
 #[derive(PartialEq, Clone, Copy)]
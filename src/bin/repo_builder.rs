@@ -1,15 +1,21 @@
+use cookbook::config::{get_config, init_config};
 use cookbook::cook::ident::{get_ident, init_ident};
-use cookbook::cook::{fetch, fs, package as cook_package};
+use cookbook::cook::{delta, fetch, fs, package as cook_package};
 use cookbook::recipe::CookRecipe;
 use cookbook::web::{CliWebConfig, generate_web};
 use cookbook::{Error, Result, WALK_DEPTH, staged_pkg};
 use pkg::PackageName;
-use pkg::{Repository, SourceIdentifier};
-use std::collections::{BTreeMap, BTreeSet, HashMap};
+use pkg::{Package, Repository, SourceIdentifier};
+use pkgar_keys::PublicKeyFile;
+use std::collections::{BTreeMap, BTreeSet};
 use std::env;
 use std::path::{Path, PathBuf};
 use std::process::Command;
+use std::sync::Mutex;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::thread;
 use toml::Value;
+use walkdir::WalkDir;
 
 #[derive(Clone)]
 struct CliConfig {
@@ -37,17 +43,243 @@ impl CliConfig {
 }
 
 fn main() -> Result<()> {
+    init_config();
     init_ident();
     let conf = CliConfig::parse_args()?;
     Ok(publish_packages(&conf)?)
 }
 
+/// Log how many files of the previously published pkgar the new one changes.
+/// Clients compute their own delta against the installed head, so nothing is
+/// written. Not fatal: the full pkgar is always published.
+fn report_delta(recipe_name: &str, old_pkgar: &Path, new_pkgar: &Path) {
+    let result = PublicKeyFile::open("build/id_ed25519.pub.toml")
+        .map_err(Error::from)
+        .and_then(|key| delta::pkgar_delta(old_pkgar, new_pkgar, &key.pkey));
+    match result {
+        Ok(delta) => eprintln!(
+            "repo - delta {}: {} changed ({} bytes), {} removed, {} unchanged",
+            recipe_name,
+            delta.changed.len(),
+            delta.changed_size,
+            delta.removed.len(),
+            delta.unchanged
+        ),
+        Err(e) => eprintln!("repo - unable to compute delta for {}: {e}", recipe_name),
+    }
+}
+
+/// AppStream metadata of one package, composed on its own and cached in
+/// `dir` until the package's stage pkgar changes.
+struct AppstreamPiece {
+    name: String,
+    stage_dir: PathBuf,
+    /// blake3 of the stage pkgar
+    key: String,
+    dir: PathBuf,
+}
+
+impl AppstreamPiece {
+    fn root(&self) -> PathBuf {
+        self.dir.join("root")
+    }
+
+    fn is_cached(&self) -> bool {
+        self.root().is_dir()
+            && std::fs::read_to_string(self.dir.join("key")).is_ok_and(|key| key == self.key)
+    }
+
+    /// Run `appstreamcli compose` on the stage dir alone. Returns false if
+    /// it failed, after printing its report.
+    fn compose(&self) -> Result<bool> {
+        let root_tmp = self.dir.join("root.tmp");
+        fs::create_dir_clean(&root_tmp)?;
+        let output = Command::new("appstreamcli")
+            .arg("compose")
+            .arg("--origin=pkgar")
+            .arg("--print-report=full")
+            .arg(format!("--result-root={}", root_tmp.display()))
+            .arg(&self.stage_dir)
+            .output()
+            .map_err(|e| Error::from_io_error(e, "Running appstreamcli"))?;
+        // one print per package, so parallel reports don't interleave
+        eprint!(
+            "{}{}",
+            String::from_utf8_lossy(&output.stdout),
+            String::from_utf8_lossy(&output.stderr)
+        );
+        if !output.status.success() {
+            eprintln!(
+                "\x1b[1;91;49mrepo - appstreamcli failed for {}:\x1b[0m {:?}",
+                self.name, output.status
+            );
+            return Ok(false);
+        }
+        let root = self.root();
+        if root.exists() {
+            fs::remove_all(&root)?;
+        }
+        fs::rename(&root_tmp, &root)?;
+        std::fs::write(self.dir.join("key"), &self.key)
+            .map_err(|e| Error::from_io_error(e, "Writing appstream key"))?;
+        Ok(true)
+    }
+}
+
+/// Key of the AppStream metadata of a package: the pkgar hash in its
+/// stage.toml, or the time stage.toml was written if it has no pkgar.
+fn appstream_key(toml_src: &Path) -> String {
+    match fs::read_toml::<Package>(toml_src) {
+        Ok(package) if !package.blake3.is_empty() => package.blake3,
+        _ => {
+            let modified = fs::modified(toml_src).unwrap_or(std::time::UNIX_EPOCH);
+            let secs = modified
+                .duration_since(std::time::UNIX_EPOCH)
+                .unwrap_or_default()
+                .as_secs();
+            format!("modified-{secs}")
+        }
+    }
+}
+
+/// Compose the pieces that are not cached yet, `jobs` at a time. Returns
+/// the names of the packages that failed.
+fn compose_appstream_pieces(pieces: &[&AppstreamPiece], jobs: usize) -> Vec<String> {
+    let next = AtomicUsize::new(0);
+    let failed = Mutex::new(Vec::new());
+    thread::scope(|s| {
+        for _ in 0..jobs.clamp(1, pieces.len().max(1)) {
+            s.spawn(|| {
+                loop {
+                    let i = next.fetch_add(1, Ordering::SeqCst);
+                    let Some(piece) = pieces.get(i) else {
+                        break;
+                    };
+                    match piece.compose() {
+                        Ok(true) => {}
+                        Ok(false) => failed.lock().unwrap().push(piece.name.clone()),
+                        Err(e) => {
+                            eprintln!("repo - unable to compose {}: {e}", piece.name);
+                            failed.lock().unwrap().push(piece.name.clone());
+                        }
+                    }
+                }
+            });
+        }
+    });
+    let mut failed = failed.into_inner().unwrap();
+    failed.sort();
+    failed
+}
+
+/// Whether `rel` is a catalogue file of a compose result root, such as
+/// `usr/share/swcatalog/xml/pkgar.xml.gz`.
+fn is_appstream_catalog(rel: &Path) -> bool {
+    let name = rel.file_name().unwrap_or_default().to_string_lossy();
+    (name.ends_with(".xml.gz") || name.ends_with(".xml"))
+        && rel
+            .components()
+            .any(|c| c.as_os_str() == "swcatalog" || c.as_os_str() == "app-info")
+}
+
+fn read_appstream_catalog(path: &Path) -> Result<String> {
+    if path.extension().is_some_and(|ext| ext == "gz") {
+        let output = Command::new("gzip")
+            .arg("-dc")
+            .arg(path)
+            .output()
+            .map_err(|e| Error::from_io_error(e, "Running gzip"))?;
+        if !output.status.success() {
+            return Err(Error::Other(format!("gzip failed on {}", path.display())));
+        }
+        Ok(String::from_utf8_lossy(&output.stdout).into_owned())
+    } else {
+        fs::read_to_string(path)
+    }
+}
+
+fn write_appstream_catalog(path: &Path, xml: &str) -> Result<()> {
+    let Some(plain) = path.to_str().and_then(|p| p.strip_suffix(".gz")) else {
+        return std::fs::write(path, xml).map_err(|e| Error::from_io_error(e, "Writing catalog"));
+    };
+    std::fs::write(plain, xml).map_err(|e| Error::from_io_error(e, "Writing catalog"))?;
+    let status = Command::new("gzip")
+        .arg("-nf")
+        .arg(plain)
+        .status()
+        .map_err(|e| Error::from_io_error(e, "Running gzip"))?;
+    if !status.success() {
+        return Err(Error::Other(format!("gzip failed on {plain}")));
+    }
+    Ok(())
+}
+
+/// Split a catalogue into everything up to and including its `<components>`
+/// tag, and the components inside it.
+fn split_appstream_catalog(xml: &str) -> Option<(String, &str)> {
+    let start = xml.find("<components")?;
+    let end = start + xml[start..].find('>')?;
+    if xml[..end].ends_with('/') {
+        // no components at all
+        return Some((format!("{}>", &xml[..end - 1]), ""));
+    }
+    let close = xml.rfind("</components>")?;
+    Some((xml[..=end].to_string(), &xml[end + 1..close]))
+}
+
+/// Build the catalogue at `appstream_root` from composed pieces: icons and
+/// other files are copied, and the components of each catalogue file are
+/// concatenated.
+fn merge_appstream(pieces: &[&AppstreamPiece], appstream_root: &Path) -> Result<()> {
+    fs::create_dir_clean(appstream_root)?;
+    let mut catalogs: BTreeMap<PathBuf, (String, String)> = BTreeMap::new();
+    for piece in pieces {
+        let root = piece.root();
+        for entry in WalkDir::new(&root) {
+            let entry =
+                entry.map_err(|e| Error::from_io_error(e.into(), "Reading appstream piece"))?;
+            if entry.file_type().is_dir() {
+                continue;
+            }
+            let rel = entry.path().strip_prefix(&root).unwrap();
+            if is_appstream_catalog(rel) {
+                let xml = read_appstream_catalog(entry.path())?;
+                let Some((head, body)) = split_appstream_catalog(&xml) else {
+                    eprintln!("repo - {} has no components", entry.path().display());
+                    continue;
+                };
+                catalogs
+                    .entry(rel.to_path_buf())
+                    .or_insert_with(|| (head, String::new()))
+                    .1
+                    .push_str(body);
+            } else {
+                let dst = appstream_root.join(rel);
+                fs::create_dir(dst.parent().unwrap())?;
+                std::fs::copy(entry.path(), &dst)
+                    .map_err(|e| Error::from_io_error(e, "Copying file"))?;
+            }
+        }
+    }
+    for (rel, (head, body)) in catalogs {
+        let path = appstream_root.join(rel);
+        fs::create_dir(path.parent().unwrap())?;
+        write_appstream_catalog(&path, &format!("{head}{body}</components>\n"))?;
+    }
+    Ok(())
+}
+
 // TODO: Make this callable from repo bin
 fn publish_packages(config: &CliConfig) -> Result<()> {
     let repo_path = &config.repo_dir.join(redoxer::target());
     if !repo_path.is_dir() {
         fs::create_dir(repo_path)?;
     }
+    // delta lists that older versions published, which nothing reads
+    let old_delta_dir = repo_path.join("delta");
+    if old_delta_dir.is_dir() {
+        fs::remove_all(&old_delta_dir)?;
+    }
 
     // Don't publish host packages
     let target_packages = &config
@@ -81,7 +313,8 @@ fn publish_packages(config: &CliConfig) -> Result<()> {
         return Err(Error::Other(format!("Zero packages are passing the build")));
     }
 
-    let mut appstream_sources: HashMap<String, PathBuf> = HashMap::new();
+    // stage dir and key by package name
+    let mut appstream_sources: BTreeMap<String, (PathBuf, String)> = BTreeMap::new();
     let mut packages: BTreeMap<String, String> = BTreeMap::new();
     let mut outdated_packages: BTreeMap<String, SourceIdentifier> = BTreeMap::new();
 
@@ -113,6 +346,9 @@ fn publish_packages(config: &CliConfig) -> Result<()> {
             if fs::modified_is_newer(&toml_src, &toml_dst) {
                 eprintln!("\x1b[01;38;5;155mrepo - publishing {}\x1b[0m", recipe_name);
                 if pkgar_src.is_file() {
+                    if pkgar_dst.is_file() {
+                        report_delta(&recipe_name, &pkgar_dst, &pkgar_src);
+                    }
                     std::fs::copy(&pkgar_src, &pkgar_dst)
                         .map_err(|e| Error::from_io_error(e, "Copying file"))?;
                 }
@@ -122,7 +358,8 @@ fn publish_packages(config: &CliConfig) -> Result<()> {
 
             // TODO: Extract from pkgar instead to handle config.cook.clean_target == true
             if stage_dir.join("usr/share/metainfo").exists() {
-                appstream_sources.insert(recipe.name().to_string(), stage_dir.clone());
+                let key = appstream_key(&toml_src);
+                appstream_sources.insert(recipe_name.clone(), (stage_dir.clone(), key));
             }
         }
     }
@@ -138,38 +375,64 @@ fn publish_packages(config: &CliConfig) -> Result<()> {
             .join(&target)
             .join("appstream");
 
-        fs::create_dir_clean(&appstream_root)?;
-
-        if !appstream_sources.is_empty() {
-            let mut compose_cmd = Command::new("appstreamcli");
-            compose_cmd
-                .arg("compose")
-                .arg("--origin=pkgar")
-                .arg("--print-report=full")
-                .arg(format!("--result-root={}", appstream_root.display()));
-
-            for (_recipe, source_path) in &appstream_sources {
-                compose_cmd.arg(source_path);
+        let cache_root = appstream_root.with_file_name("appstream-cache");
+        fs::create_dir(&cache_root)?;
+
+        // packages that are gone from the repo are not in the catalogue
+        for entry in std::fs::read_dir(&cache_root)
+            .map_err(|e| Error::from_io_error(e, "Listing appstream cache"))?
+        {
+            let entry = entry.map_err(|e| Error::from_io_error(e, "Reading appstream cache"))?;
+            let name = entry.file_name().to_string_lossy().into_owned();
+            if entry.path().is_dir() && !appstream_sources.contains_key(&name) {
+                fs::remove_all(&entry.path())?;
             }
+        }
 
-            let exit_status = compose_cmd
-                .status()
-                .map_err(|e| Error::from_io_error(e, "Reading exit status"))?;
-            if exit_status.success() {
-                let appstream_pkg = repo_path.join("repo-appstream.pkgar");
-                let _ = fs::remove_all(&appstream_pkg);
-                pkgar::create(
-                    format!("{}/build/id_ed25519.toml", root),
-                    &appstream_pkg,
-                    &appstream_root,
-                )?;
-            } else {
-                eprintln!("\x1b[1;91;49mrepo - appstreamcli failed:\x1b[0m {exit_status:?}");
-                for (_recipe, source_path) in &appstream_sources {
-                    eprintln!("- {}", source_path.display());
-                }
-                eprintln!();
+        let pieces: Vec<AppstreamPiece> = appstream_sources
+            .iter()
+            .map(|(name, (stage_dir, key))| AppstreamPiece {
+                name: name.clone(),
+                stage_dir: stage_dir.clone(),
+                key: key.clone(),
+                dir: cache_root.join(name),
+            })
+            .collect();
+        let outdated: Vec<&AppstreamPiece> = pieces.iter().filter(|p| !p.is_cached()).collect();
+        eprintln!(
+            "repo - composing {} of {} appstream packages",
+            outdated.len(),
+            pieces.len()
+        );
+        let failed = compose_appstream_pieces(&outdated, get_config().cook.jobs);
+        if !failed.is_empty() {
+            eprintln!("\x1b[1;91;49mrepo - appstreamcli failed for:\x1b[0m");
+            for name in &failed {
+                eprintln!("- {}", appstream_sources[name].0.display());
             }
+            eprintln!();
+        }
+
+        // the catalogue and its pkgar only change with the set of pieces
+        let ready: Vec<&AppstreamPiece> = pieces.iter().filter(|p| p.is_cached()).collect();
+        let merged_state: String = ready
+            .iter()
+            .map(|p| format!("{} {}\n", p.name, p.key))
+            .collect();
+        let merged_path = cache_root.join(".merged");
+        let appstream_pkg = repo_path.join("repo-appstream.pkgar");
+        let unchanged = appstream_pkg.is_file()
+            && std::fs::read_to_string(&merged_path).is_ok_and(|s| s == merged_state);
+        if !ready.is_empty() && !unchanged {
+            merge_appstream(&ready, &appstream_root)?;
+            let _ = fs::remove_all(&appstream_pkg);
+            pkgar::create(
+                format!("{}/build/id_ed25519.toml", root),
+                &appstream_pkg,
+                &appstream_root,
+            )?;
+            std::fs::write(&merged_path, merged_state)
+                .map_err(|e| Error::from_io_error(e, "Writing appstream state"))?;
         }
     }
 
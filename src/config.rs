@@ -1,6 +1,7 @@
 use std::{
     collections::{BTreeMap, HashMap},
     env, fs,
+    path::PathBuf,
     str::FromStr,
     sync::OnceLock,
 };
@@ -37,6 +38,27 @@ pub struct CookConfigOpt {
     pub clean_target: Option<bool>,
     /// whether to always write stage.files metadata
     pub write_filetree: Option<bool>,
+    /// directory of source tarballs shared between recipes and checkouts,
+    /// empty to keep tarballs only in recipe dirs
+    pub tar_store: Option<String>,
+    /// size in MiB the tarball store is pruned to, 0 for no limit
+    pub tar_store_limit: Option<u64>,
+    /// memory in MiB that builds running together with --targets may expect
+    /// to use, 0 for no limit, default is the system memory
+    pub memory_budget: Option<u64>,
+    /// loopback host:port or unix:<path> to serve live metrics on,
+    /// empty to disable
+    pub metrics: Option<String>,
+    /// directory in RAM, such as a tmpfs, to build small recipes in,
+    /// empty to build everything on disk
+    pub ram_dir: Option<String>,
+    /// size in MiB that builds in `ram_dir` may use together
+    pub ram_budget: Option<u64>,
+    /// directory to archive build dirs in before `clean_target` removes them,
+    /// empty to disable
+    pub build_snapshots: Option<String>,
+    /// size in MiB the build snapshots are pruned to, 0 for no limit
+    pub build_snapshots_limit: Option<u64>,
 }
 
 #[derive(Debug, Default, Clone, PartialEq)]
@@ -52,6 +74,18 @@ pub struct CookConfig {
     pub clean_build: bool,
     pub clean_target: bool,
     pub write_filetree: bool,
+    pub tar_store: Option<PathBuf>,
+    /// in bytes
+    pub tar_store_limit: u64,
+    /// in bytes
+    pub memory_budget: u64,
+    pub metrics: Option<String>,
+    pub ram_dir: Option<PathBuf>,
+    /// in bytes
+    pub ram_budget: u64,
+    pub build_snapshots: Option<PathBuf>,
+    /// in bytes
+    pub build_snapshots_limit: u64,
 }
 
 impl From<CookConfigOpt> for CookConfig {
@@ -68,6 +102,17 @@ impl From<CookConfigOpt> for CookConfig {
             clean_build: value.clean_build.unwrap(),
             clean_target: value.clean_target.unwrap(),
             write_filetree: value.write_filetree.unwrap(),
+            tar_store: value.tar_store.filter(|s| !s.is_empty()).map(PathBuf::from),
+            tar_store_limit: value.tar_store_limit.unwrap() * 1024 * 1024,
+            memory_budget: value.memory_budget.unwrap() * 1024 * 1024,
+            metrics: value.metrics.filter(|s| !s.is_empty()),
+            ram_dir: value.ram_dir.filter(|s| !s.is_empty()).map(PathBuf::from),
+            ram_budget: value.ram_budget.unwrap() * 1024 * 1024,
+            build_snapshots: value
+                .build_snapshots
+                .filter(|s| !s.is_empty())
+                .map(PathBuf::from),
+            build_snapshots_limit: value.build_snapshots_limit.unwrap() * 1024 * 1024,
         }
     }
 }
@@ -170,6 +215,36 @@ pub fn init_config() {
             config.cook_opt.clean_target.unwrap_or(false) || extract_env("COOKBOOK_WEB", false),
         ));
     }
+    if config.cook_opt.tar_store.is_none() {
+        config.cook_opt.tar_store = Some(extract_env(
+            "COOKBOOK_TAR_STORE",
+            "build/tar-store".to_string(),
+        ));
+    }
+    if config.cook_opt.tar_store_limit.is_none() {
+        config.cook_opt.tar_store_limit = Some(extract_env("COOKBOOK_TAR_STORE_LIMIT", 32768));
+    }
+    if config.cook_opt.memory_budget.is_none() {
+        let total = crate::cook::memory::total_memory().unwrap_or(0) / 1024 / 1024;
+        config.cook_opt.memory_budget = Some(extract_env("COOKBOOK_MEMORY_BUDGET", total));
+    }
+    if config.cook_opt.metrics.is_none() {
+        config.cook_opt.metrics = Some(extract_env("COOKBOOK_METRICS", String::new()));
+    }
+    if config.cook_opt.ram_dir.is_none() {
+        config.cook_opt.ram_dir = Some(extract_env("COOKBOOK_RAM_DIR", String::new()));
+    }
+    if config.cook_opt.ram_budget.is_none() {
+        config.cook_opt.ram_budget = Some(extract_env("COOKBOOK_RAM_BUDGET", 4096));
+    }
+    if config.cook_opt.build_snapshots.is_none() {
+        config.cook_opt.build_snapshots =
+            Some(extract_env("COOKBOOK_BUILD_SNAPSHOTS", String::new()));
+    }
+    if config.cook_opt.build_snapshots_limit.is_none() {
+        config.cook_opt.build_snapshots_limit =
+            Some(extract_env("COOKBOOK_BUILD_SNAPSHOTS_LIMIT", 16384));
+    }
     if config.mirrors.len() == 0 {
         // The GNU FTP mirror below is automatically inserted for convenience
         // You can choose other mirrors by setting it on cookbook.toml
@@ -1,10 +1,23 @@
+pub mod build_snapshot;
 // avoid confusion with build.rs
 pub mod cook_build;
+pub mod delta;
 pub mod fetch;
 pub mod fetch_repo;
+pub mod freshness;
 pub mod fs;
 pub mod ident;
+pub mod image;
+pub mod log;
+pub mod memory;
+pub mod metrics;
 pub mod package;
+pub mod pkgar_cache;
+pub mod plan;
 pub mod pty;
+pub mod scratch;
 pub mod script;
+pub mod stage;
+pub mod tar_store;
+pub mod trash;
 pub mod tree;
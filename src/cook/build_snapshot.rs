@@ -0,0 +1,335 @@
+//! Compressed snapshots of build dirs.
+//!
+//! With `clean_target`, the build dir is removed after every cook to save disk
+//! space, and the next change to the source would configure and compile the
+//! recipe from scratch. When `build_snapshots` is set, the build dir is archived
+//! there first, as `<target>/<name>.tar.zst` with zstd on all cores, or
+//! `.tar.gz` where zstd is not installed. The snapshot is keyed by the
+//! toolchain it was built with, the pkgar hashes in the `.tags` of the sysroot
+//! and toolchain dirs, and is restored on the next build of the recipe, so
+//! make, cmake, ninja and cargo can build incrementally again. The least
+//! recently restored snapshots are removed once they grow over
+//! `build_snapshots_limit`.
+
+use std::env;
+use std::fs::{self, File};
+use std::path::{Path, PathBuf};
+use std::process::Command;
+use std::time::{Duration, SystemTime};
+
+use serde::{Deserialize, Serialize};
+use walkdir::WalkDir;
+
+use crate::config::CookConfig;
+use crate::cook::fs::{create_dir_clean, read_toml, run_command, serialize_and_write};
+use crate::cook::pty::PtyOut;
+use crate::recipe::CookRecipe;
+use crate::{Result, log_debug, log_info, log_warn, wrap_io_err};
+
+/// zstd finds repeated content, such as objects also packed into static
+/// libraries, up to this many bytes apart
+const ZSTD: &str = "zstd -T0 -3 --long=27 -q";
+
+#[derive(Clone, Copy, Debug, Deserialize, PartialEq, Serialize)]
+#[serde(rename_all = "lowercase")]
+enum Codec {
+    Zstd,
+    Gzip,
+}
+
+impl Codec {
+    fn detect() -> Self {
+        let found = env::var_os("PATH")
+            .is_some_and(|path| env::split_paths(&path).any(|dir| dir.join("zstd").is_file()));
+        if found { Codec::Zstd } else { Codec::Gzip }
+    }
+
+    fn extension(self) -> &'static str {
+        match self {
+            Codec::Zstd => "tar.zst",
+            Codec::Gzip => "tar.gz",
+        }
+    }
+
+    /// tar handles both directions, adding `-d` to the program to extract
+    fn tar_arg(self) -> String {
+        match self {
+            Codec::Zstd => format!("--use-compress-program={ZSTD}"),
+            Codec::Gzip => "--gzip".to_string(),
+        }
+    }
+}
+
+#[derive(Deserialize, Serialize)]
+struct Meta {
+    /// hash of the dependency pkgars the build dir was built against
+    toolchain: String,
+    codec: Codec,
+    /// absolute path the build dir had, which build systems record
+    build_dir: PathBuf,
+    /// seconds since the epoch at which the sysroot was created
+    deps_time: u64,
+}
+
+/// Hash of the pkgars installed in `deps_dirs`, as recorded in their tags.
+fn toolchain_key(deps_dirs: &[&Path]) -> String {
+    let mut hasher = blake3::Hasher::new();
+    for dir in deps_dirs {
+        let mut tags: Vec<PathBuf> = fs::read_dir(dir.join(".tags"))
+            .into_iter()
+            .flatten()
+            .flatten()
+            .map(|entry| entry.path())
+            .collect();
+        tags.sort();
+        for tag in tags {
+            hasher.update(tag.file_name().unwrap_or_default().as_encoded_bytes());
+            hasher.update(b"=");
+            hasher.update(&fs::read(&tag).unwrap_or_default());
+            hasher.update(b"\n");
+        }
+        hasher.update(b"\0");
+    }
+    hasher.finalize().to_hex()[..16].to_string()
+}
+
+/// When the oldest of `deps_dirs` was created.
+fn deps_time(deps_dirs: &[&Path]) -> u64 {
+    deps_dirs
+        .iter()
+        .filter_map(|dir| fs::metadata(dir.join(".tags")).ok()?.modified().ok())
+        .min()
+        .and_then(|time| time.duration_since(SystemTime::UNIX_EPOCH).ok())
+        .map_or(0, |time| time.as_secs())
+}
+
+fn snapshot_paths(root: &Path, recipe: &CookRecipe) -> (PathBuf, PathBuf) {
+    let dir = root.join(recipe.target);
+    let name = recipe.name.name();
+    (dir.join(format!("{name}.toml")), dir.join(name))
+}
+
+/// Archive `build_dir` before it is removed. A snapshot that can't be taken
+/// only costs a cold build later, so failures are logged and ignored.
+pub fn save(
+    recipe: &CookRecipe,
+    build_dir: &Path,
+    deps_dirs: &[&Path],
+    config: &CookConfig,
+    logger: &PtyOut,
+) {
+    let Some(root) = &config.build_snapshots else {
+        return;
+    };
+    if !build_dir.is_dir() {
+        return;
+    }
+    if let Err(e) = save_inner(root, recipe, build_dir, deps_dirs, config, logger) {
+        log_warn!(logger, "unable to snapshot build dir: {e}");
+    }
+}
+
+fn save_inner(
+    root: &Path,
+    recipe: &CookRecipe,
+    build_dir: &Path,
+    deps_dirs: &[&Path],
+    config: &CookConfig,
+    logger: &PtyOut,
+) -> Result<()> {
+    let build_dir = build_dir
+        .canonicalize()
+        .map_err(wrap_io_err!(build_dir, "Resolving"))?;
+    let (meta_path, base) = snapshot_paths(root, recipe);
+    let dir = base.parent().unwrap();
+    fs::create_dir_all(dir).map_err(wrap_io_err!(dir, "Creating snapshot dir"))?;
+
+    let codec = Codec::detect();
+    let archive = base.with_added_extension(codec.extension());
+    let tmp = base.with_added_extension(format!("{}.tmp", std::process::id()));
+    let mut command = Command::new("tar");
+    command.arg("--create").arg(codec.tar_arg());
+    command.arg("--file").arg(&tmp);
+    command.arg("--directory").arg(&build_dir);
+    command.arg(".");
+    if let Err(e) = run_command(command, logger) {
+        let _ = fs::remove_file(&tmp);
+        return Err(e);
+    }
+
+    // the old snapshot is unusable from here on
+    let _ = fs::remove_file(&meta_path);
+    for other in [Codec::Zstd, Codec::Gzip] {
+        let _ = fs::remove_file(base.with_added_extension(other.extension()));
+    }
+    fs::rename(&tmp, &archive).map_err(wrap_io_err!(tmp, archive, "Renaming snapshot"))?;
+    let meta = Meta {
+        toolchain: toolchain_key(deps_dirs),
+        codec,
+        build_dir,
+        deps_time: deps_time(deps_dirs),
+    };
+    serialize_and_write(&meta_path, &meta)?;
+    log_debug!(logger, "saved build dir to {}", archive.display());
+
+    prune(root, config.build_snapshots_limit, &archive)
+}
+
+/// Extract the snapshot of `recipe` into the empty `build_dir`, if there is
+/// one built against what is now in `deps_dirs`. A snapshot that can't be
+/// restored leaves `build_dir` empty, for a cold build.
+pub fn restore(
+    recipe: &CookRecipe,
+    build_dir: &Path,
+    deps_dirs: &[&Path],
+    config: &CookConfig,
+    logger: &PtyOut,
+) -> Result<()> {
+    let Some(root) = &config.build_snapshots else {
+        return Ok(());
+    };
+    match restore_inner(root, recipe, build_dir, deps_dirs, logger) {
+        Ok(true) => log_info!(logger, "restored build dir from snapshot"),
+        Ok(false) => {}
+        Err(e) => {
+            log_warn!(logger, "unable to restore build dir: {e}");
+            let build_dir = build_dir
+                .canonicalize()
+                .map_err(wrap_io_err!(build_dir, "Resolving"))?;
+            create_dir_clean(&build_dir)?;
+        }
+    }
+    Ok(())
+}
+
+fn restore_inner(
+    root: &Path,
+    recipe: &CookRecipe,
+    build_dir: &Path,
+    deps_dirs: &[&Path],
+    logger: &PtyOut,
+) -> Result<bool> {
+    let (meta_path, base) = snapshot_paths(root, recipe);
+    if !meta_path.is_file() {
+        return Ok(false);
+    }
+    let meta: Meta = read_toml(&meta_path)?;
+    if meta.toolchain != toolchain_key(deps_dirs) {
+        log_debug!(logger, "not restoring build dir, dependencies changed");
+        return Ok(false);
+    }
+    let build_dir = build_dir
+        .canonicalize()
+        .map_err(wrap_io_err!(build_dir, "Resolving"))?;
+    if meta.build_dir != build_dir {
+        log_debug!(
+            logger,
+            "not restoring build dir, it was at {}",
+            meta.build_dir.display()
+        );
+        return Ok(false);
+    }
+
+    let archive = base.with_added_extension(meta.codec.extension());
+    let mut command = Command::new("tar");
+    command.arg("--extract").arg("--no-same-owner");
+    command.arg(meta.codec.tar_arg());
+    command.arg("--file").arg(&archive);
+    command.arg("--directory").arg(&build_dir);
+    run_command(command, logger)?;
+    if let Ok(file) = File::open(&archive) {
+        let _ = file.set_modified(SystemTime::now());
+    }
+
+    // the sysroot was recreated since, and its headers must not look
+    // newer than the objects built against them
+    let deps_time = SystemTime::UNIX_EPOCH + Duration::from_secs(meta.deps_time);
+    if meta.deps_time > 0 {
+        for dir in deps_dirs {
+            backdate(dir, deps_time);
+        }
+    }
+    Ok(true)
+}
+
+fn backdate(dir: &Path, time: SystemTime) {
+    for entry in WalkDir::new(dir).into_iter().flatten() {
+        if !entry.file_type().is_file() {
+            continue;
+        }
+        let newer = entry
+            .metadata()
+            .ok()
+            .and_then(|meta| meta.modified().ok())
+            .is_some_and(|modified| modified > time);
+        if newer && let Ok(file) = File::open(entry.path()) {
+            let _ = file.set_modified(time);
+        }
+    }
+}
+
+/// Remove least recently used snapshots, other than `keep`, until all of
+/// them fit `limit` bytes.
+fn prune(root: &Path, limit: u64, keep: &Path) -> Result<()> {
+    if limit == 0 {
+        return Ok(());
+    }
+    let mut snapshots = Vec::new();
+    let mut total = 0;
+    for entry in WalkDir::new(root).min_depth(2).max_depth(2) {
+        let entry = entry.map_err(|e| wrap_io_err!(root, "Reading snapshots")(e.into()))?;
+        let name = entry.file_name().to_string_lossy();
+        if !name.ends_with(".tar.zst") && !name.ends_with(".tar.gz") {
+            continue;
+        }
+        let meta = entry
+            .metadata()
+            .map_err(|e| wrap_io_err!(entry.path(), "Reading metadata")(e.into()))?;
+        total += meta.len();
+        if entry.path() != keep {
+            let modified = meta.modified().unwrap_or(SystemTime::UNIX_EPOCH);
+            snapshots.push((modified, meta.len(), entry.into_path()));
+        }
+    }
+    snapshots.sort();
+    for (_, size, path) in snapshots {
+        if total <= limit {
+            break;
+        }
+        let name = path.file_name().unwrap().to_string_lossy();
+        let name = name
+            .strip_suffix(".tar.zst")
+            .or_else(|| name.strip_suffix(".tar.gz"))
+            .unwrap();
+        let _ = fs::remove_file(path.with_file_name(format!("{name}.toml")));
+        fs::remove_file(&path).map_err(wrap_io_err!(path, "Pruning snapshot"))?;
+        total -= size;
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn toolchain_key_follows_tags() {
+        let root = env::temp_dir().join(format!("cook-build-snapshot-{}", std::process::id()));
+        let _ = fs::remove_dir_all(&root);
+        let sysroot = root.join("sysroot");
+        let toolchain = root.join("toolchain");
+        fs::create_dir_all(sysroot.join(".tags")).unwrap();
+        fs::write(sysroot.join(".tags/libc"), "aaaa").unwrap();
+
+        let key = toolchain_key(&[&sysroot, &toolchain]);
+        assert_eq!(key.len(), 16);
+        assert_eq!(key, toolchain_key(&[&sysroot, &toolchain]));
+        // the same tags in the toolchain dir are another toolchain
+        assert_ne!(key, toolchain_key(&[&toolchain, &sysroot]));
+        fs::write(sysroot.join(".tags/libc"), "bbbb").unwrap();
+        assert_ne!(key, toolchain_key(&[&sysroot, &toolchain]));
+        assert!(deps_time(&[&sysroot, &toolchain]) > 0);
+
+        fs::remove_dir_all(&root).unwrap();
+    }
+}
@@ -4,44 +4,43 @@ use pkgar_core::PackageSrc;
 use pkgar_keys::PublicKeyFile;
 
 use crate::config::CookConfig;
-use crate::cook::package::{package_source_paths, package_target};
-use crate::cook::{fetch, fs, pty::PtyOut, script::*};
+use crate::cook::metrics::{self, Counter};
+use crate::cook::package::package_source_paths;
+use crate::cook::plan::PlanReason;
+use crate::cook::stage::{self, StageScan};
+use crate::cook::{
+    build_snapshot, fetch, fs, memory, pkgar_cache, pty::PtyOut, scratch, script::*,
+};
 use crate::recipe::{AutoDeps, BuildKind, CookRecipe, OptionalPackageRecipe, Recipe};
 use std::{
     collections::{BTreeSet, VecDeque},
     path::{Path, PathBuf},
     process::Command,
-    str,
 };
 
-use crate::{Error, Result, is_redox, log_to_pty, wrap_io_err};
+use crate::{Error, Result, is_redox, log_debug, wrap_io_err};
 
-fn auto_deps_from_dynamic_linking(
+pub fn auto_deps_from_dynamic_linking(
     stage_dirs: &[PathBuf],
     dep_pkgars: &BTreeSet<(PackageName, PathBuf)>,
     logger: &PtyOut,
 ) -> BTreeSet<PackageName> {
     let mut paths = BTreeSet::new();
     let mut visited = BTreeSet::new();
-    let verbose = crate::config::get_config().cook.verbose;
     // Base directories may need to be updated for packages that place binaries in odd locations.
     let mut walk = VecDeque::new();
 
     for stage_dir in stage_dirs {
-        walk.push_back((stage_dir, stage_dir.join("usr/bin")));
-        walk.push_back((stage_dir, stage_dir.join("usr/games")));
-        walk.push_back((stage_dir, stage_dir.join("usr/lib")));
-        walk.push_back((stage_dir, stage_dir.join("usr/libexec")));
+        for dir in stage::ELF_DIRS {
+            walk.push_back((stage_dir, stage_dir.join(dir)));
+        }
     }
 
     // Recursively (DFS) walk each directory to ensure nested libs and bins are checked.
     while let Some((rel_path, dir)) = walk.pop_front() {
         if visited.contains(&dir) {
             #[cfg(debug_assertions)]
-            log_to_pty!(
-                logger,
-                "DEBUG: auto_deps => Skipping `{dir:?}` (already visited)"
-            );
+            log_debug!(logger, "auto_deps => Skipping `{dir:?}` (already visited)");
             continue;
         }
         assert!(
@@ -67,43 +66,36 @@ fn auto_deps_from_dynamic_linking(
         }
     }
 
-    let mut needed = BTreeSet::new();
+    let mut needed = Vec::new();
     for (rel_path, path) in paths {
-        let Ok(file) = std::fs::File::open(&path) else {
-            continue;
-        };
-        let read_cache = object::ReadCache::new(file);
-        let Ok(object) = object::build::elf::Builder::read(&read_cache) else {
-            continue;
-        };
-        let Some(dynamic_data) = object.dynamic_data() else {
+        let Ok(relative_path) = path.strip_prefix(rel_path) else {
+            log_debug!(
+                logger,
+                "autopath failed {} is outside {}",
+                path.display(),
+                rel_path.display()
+            );
             continue;
         };
-        for dynamic in dynamic_data {
-            let object::build::elf::Dynamic::String { tag, val } = dynamic else {
-                continue;
-            };
-            if *tag == object::elf::DT_NEEDED {
-                let Ok(name) = str::from_utf8(val) else {
-                    continue;
-                };
-                if let Ok(relative_path) = path.strip_prefix(rel_path) {
-                    if verbose {
-                        log_to_pty!(logger, "DEBUG: {} needs {}", relative_path.display(), name);
-                    }
-                }
-                needed.insert(name.to_string());
-            } else {
-                log_to_pty!(
-                    logger,
-                    "DEBUG: autopath failed {} is outside {}",
-                    path.display(),
-                    rel_path.display()
-                );
-            }
+        for name in stage::elf_needed(&path) {
+            needed.push((relative_path.to_path_buf(), name));
         }
     }
 
+    auto_deps_from_needed(&needed, dep_pkgars, logger)
+}
+
+/// Resolve `DT_NEEDED` entries to the dependency packages providing them
+fn auto_deps_from_needed(
+    needed: &[(PathBuf, String)],
+    dep_pkgars: &BTreeSet<(PackageName, PathBuf)>,
+    logger: &PtyOut,
+) -> BTreeSet<PackageName> {
+    for (path, name) in needed {
+        log_debug!(logger, "{} needs {}", path.display(), name);
+    }
+    let needed = stage::needed_names(needed);
+
     let mut missing = needed.clone();
     // relibc and friends will always be installed
     for preinstalled in &["libc.so.6", "libgcc_s.so.1", "libstdc++.so.6"] {
@@ -113,14 +105,11 @@ fn auto_deps_from_dynamic_linking(
     let mut deps = BTreeSet::new();
     if let Ok(key_file) = pkgar_keys::PublicKeyFile::open("build/id_ed25519.pub.toml") {
         for (dep, archive_path) in dep_pkgars.iter() {
-            let Ok(mut package) = pkgar::PackageFile::new(archive_path, &key_file.pkey) else {
+            let Ok(info) = pkgar_cache::get(archive_path, &key_file.pkey) else {
                 continue;
             };
-            let Ok(entries) = pkgar_core::PackageSrc::read_entries(&mut package) else {
-                continue;
-            };
-            for entry in entries {
-                let Ok(entry_path) = pkgar::ext::EntryExt::check_path(&entry) else {
+            for entry in &info.entries {
+                let Ok(entry_path) = pkgar::ext::EntryExt::check_path(entry) else {
                     continue;
                 };
                 for prefix in &["lib", "usr/lib"] {
@@ -131,9 +120,7 @@ fn auto_deps_from_dynamic_linking(
                         continue;
                     };
                     if needed.contains(child_name) {
-                        if verbose {
-                            log_to_pty!(logger, "DEBUG: {} provides {}", dep, child_name);
-                        }
+                        log_debug!(logger, "{} provides {}", dep, child_name);
                         deps.insert(dep.with_prefix(pkg::PackagePrefix::Any));
                         missing.remove(child_name);
                     }
@@ -142,10 +129,8 @@ fn auto_deps_from_dynamic_linking(
         }
     }
 
-    if verbose {
-        for name in missing {
-            log_to_pty!(logger, "INFO: {} missing", name);
-        }
+    for name in missing {
+        log_debug!(logger, "{} missing", name);
     }
 
     deps
@@ -169,6 +154,8 @@ pub struct BuildResult {
     pub stage_dirs: Vec<PathBuf>,
     pub auto_deps: BTreeSet<PackageName>,
     pub cached: bool,
+    /// Scan of the stage dirs, if they were produced by this build
+    pub scan: Option<StageScan>,
 }
 
 impl BuildResult {
@@ -177,6 +164,7 @@ impl BuildResult {
             stage_dirs,
             auto_deps,
             cached: false,
+            scan: None,
         }
     }
 
@@ -185,6 +173,7 @@ impl BuildResult {
             stage_dirs,
             auto_deps,
             cached: true,
+            scan: None,
         }
     }
 }
@@ -214,33 +203,19 @@ pub fn build(
         return Ok(BuildResult::new(stage_dirs, BTreeSet::new()));
     }
 
-    let mut dep_pkgars = BTreeSet::new();
-    let mut dep_host_pkgars = BTreeSet::new();
-    let build_deps = CookRecipe::get_build_deps_recursive(
-        &[
-            &recipe.build.dependencies[..],
-            &recipe.build.dev_dependencies[..],
-        ]
-        .concat(),
-        false,
-    )?;
-    for dependency in build_deps.iter() {
-        let (_, pkgar, _) = dependency.stage_paths();
-        if dependency.name.is_host() {
-            dep_host_pkgars.insert((dependency.name.clone(), pkgar));
-        } else {
-            dep_pkgars.insert((dependency.name.clone(), pkgar));
-        }
-    }
+    let (dep_pkgars, dep_host_pkgars) = build_dep_pkgars(cook_recipe)?;
 
     macro_rules! make_auto_deps {
         ($cached:expr) => {
+            make_auto_deps!($cached, None)
+        };
+        ($cached:expr, $needed:expr) => {
             build_auto_deps(
                 recipe,
                 &auto_deps_file,
                 &stage_dirs,
                 $cached,
-                cook_config,
+                $needed,
                 dep_pkgars,
                 logger,
             )
@@ -251,7 +226,7 @@ pub fn build(
         // TODO: when stage_dirs does not exist due to clean_target was true, extract from stage.pkgar?
         let stage_present = stage_pkgars.iter().all(|file| file.is_file());
         if stage_present && auto_deps_file.is_file() {
-            log_to_pty!(logger, "DEBUG: using cached build, not checking source");
+            log_debug!(logger, "using cached build, not checking source");
             let auto_deps = make_auto_deps!(true)?;
             return Ok(BuildResult::cached(stage_dirs, auto_deps));
         }
@@ -304,7 +279,7 @@ pub fn build(
             }
         }
     } else {
-        log_to_pty!(logger, "DEBUG: using cached build");
+        log_debug!(logger, "using cached build");
         // stop early otherwise we'll end up rebuilding
         let auto_deps = make_auto_deps!(true)?;
         return Ok(BuildResult::cached(stage_dirs, auto_deps));
@@ -315,15 +290,38 @@ pub fn build(
         .expect("Should have atleast one stage dir");
 
     let build_dir = get_sub_target_dir(target_dir, "build");
+    let mut scan = None;
     if !stage_dir.is_dir() {
         // Create stage.tmp
         let stage_dir_tmp = target_dir.join("stage.tmp");
         fs::create_dir_clean(&stage_dir_tmp)?;
 
-        // Create build dir, if it does not exist
-        if cook_config.clean_build || !build_dir.is_dir() {
+        // Build dir and stage in RAM when they fit, otherwise create the
+        // build dir, if it does not exist
+        let build_dir_cold = !build_dir.is_dir();
+        let lease = scratch::lease(
+            cook_recipe,
+            &build_dir,
+            cook_config.clean_build,
+            cook_config,
+            logger,
+        )?;
+        if lease.is_none() && (cook_config.clean_build || !build_dir.is_dir()) {
             fs::create_dir_clean(&build_dir)?;
         }
+        if build_dir_cold && !cook_config.clean_build {
+            build_snapshot::restore(
+                cook_recipe,
+                &build_dir,
+                &[&sysroot_dir, &toolchain_dir],
+                cook_config,
+                logger,
+            )?;
+        }
+        let script_stage_dir = match &lease {
+            Some(lease) => lease.stage_dir(),
+            None => stage_dir_tmp.clone(),
+        };
 
         let flags_fn = |name, flags: &Vec<String>| {
             format!(
@@ -399,7 +397,7 @@ pub fn build(
             let cookbook_build = build_dir.canonicalize().unwrap();
             let cookbook_recipe = recipe_dir.canonicalize().unwrap();
             let cookbook_root = Path::new(".").canonicalize().unwrap();
-            let cookbook_stage = stage_dir_tmp.canonicalize().unwrap();
+            let cookbook_stage = script_stage_dir.canonicalize().unwrap();
             let cookbook_source = source_dir.canonicalize().unwrap();
             let cookbook_sysroot = sysroot_dir.canonicalize().unwrap();
             let cookbook_toolchain = toolchain_dir.canonicalize().ok();
@@ -419,7 +417,7 @@ pub fn build(
             };
             command.arg("env").arg("bash").arg(bash_args);
             command.current_dir(&cookbook_build);
-            command.env("TARGET", package_target(name));
+            command.env("TARGET", cook_recipe.target);
             command.env("COOKBOOK_BUILD", &cookbook_build);
             command.env("COOKBOOK_NAME", name.name());
             command.env("COOKBOOK_HOST_TARGET", redoxer::host_target());
@@ -433,7 +431,8 @@ pub fn build(
             } else if name.is_host() {
                 command.env("COOKBOOK_TOOLCHAIN", &cookbook_sysroot);
             }
-            command.env("COOKBOOK_MAKE_JOBS", cli_jobs.to_string());
+            let make_jobs = memory::jobs_under_pressure(cli_jobs, logger);
+            command.env("COOKBOOK_MAKE_JOBS", make_jobs.to_string());
             if cook_config.verbose_cmd {
                 command.env("COOKBOOK_VERBOSE", "1");
             }
@@ -453,37 +452,37 @@ pub fn build(
             "{}\n{}\n{}\n{}",
             BUILD_PRESCRIPT, SHARED_PRESCRIPT, script, BUILD_POSTSCRIPT
         );
-        fs::run_command_stdin(command, full_script.as_bytes(), logger)?;
+        let peak = fs::run_command_stdin_peak(command, full_script.as_bytes(), logger)?;
+        memory::record_peak(cook_recipe, peak);
+        scratch::record_size(cook_recipe, &[&build_dir, &script_stage_dir], cook_config);
+        if let Some(lease) = lease {
+            lease.finish(&stage_dir_tmp)?;
+        }
 
-        // Move to each features dir
-        let mut globs = Vec::new();
-        for (i, feat) in recipe.optional_packages.iter().enumerate() {
-            let stage_dir = &stage_dirs[i];
+        // Move to each features dir, collecting manifests and DT_NEEDED on the way
+        for stage_dir in &stage_dirs[..recipe.optional_packages.len()] {
             fs::create_dir_clean(&stage_dir)?;
-            for path in &feat.files {
-                let glob = globset::Glob::new(&path).map_err(|e| format!("{}", e))?;
-                globs.push((glob.compile_matcher(), stage_dir.clone()));
-            }
         }
-        fs::move_dir_all_fn(
+        scan = Some(stage::split_and_scan(
             &stage_dir_tmp,
-            &Box::new(|path: PathBuf| {
-                for (glob, dst) in &globs {
-                    if glob.is_match(&path) {
-                        return Some(dst.as_path());
-                    }
-                }
-                None
-            }),
-        )
-        .map_err(wrap_io_err!("Moving to stages dir"))?;
+            &stage_dirs,
+            &recipe.optional_packages,
+            cli_jobs,
+        )?);
 
         // Move stage.tmp to stage atomically
         fs::rename(&stage_dir_tmp, &stage_dir)?;
     }
 
     if cook_config.clean_target {
-        fs::remove_all(&build_dir)?;
+        build_snapshot::save(
+            cook_recipe,
+            &build_dir,
+            &[&sysroot_dir, &toolchain_dir],
+            cook_config,
+            logger,
+        );
+        scratch::remove_build_dir(&build_dir)?;
         clean_deps_dir(&sysroot_dir)?;
         if toolchain_dir.is_dir() {
             clean_deps_dir(&toolchain_dir)?;
@@ -491,8 +490,41 @@ pub fn build(
         // don't remove stage dir yet
     }
 
-    let auto_deps = make_auto_deps!(false)?;
-    Ok(BuildResult::new(stage_dirs, auto_deps))
+    let needed = scan.as_ref().map(|scan| &scan.needed[..]);
+    let auto_deps = make_auto_deps!(false, needed)?;
+    let mut result = BuildResult::new(stage_dirs, auto_deps);
+    result.scan = scan;
+    Ok(result)
+}
+
+/// Collect (target, host) stage pkgars of all recursive build dependencies
+pub(crate) fn build_dep_pkgars(
+    cook_recipe: &CookRecipe,
+) -> Result<(
+    BTreeSet<(PackageName, PathBuf)>,
+    BTreeSet<(PackageName, PathBuf)>,
+)> {
+    let recipe = &cook_recipe.recipe;
+    let mut dep_pkgars = BTreeSet::new();
+    let mut dep_host_pkgars = BTreeSet::new();
+    let build_deps = CookRecipe::get_build_deps_recursive(
+        &[
+            &recipe.build.dependencies[..],
+            &recipe.build.dev_dependencies[..],
+        ]
+        .concat(),
+        false,
+    )?;
+    for dependency in build_deps.iter() {
+        // dependencies are built for the same target as this recipe
+        let (_, pkgar, _) = dependency.with_target(cook_recipe.target).stage_paths();
+        if dependency.name.is_host() {
+            dep_host_pkgars.insert((dependency.name.clone(), pkgar));
+        } else {
+            dep_pkgars.insert((dependency.name.clone(), pkgar));
+        }
+    }
+    Ok((dep_pkgars, dep_host_pkgars))
 }
 
 fn build_is_source_newer(
@@ -502,14 +534,31 @@ fn build_is_source_newer(
     auto_deps_file: &Path,
     stage_pkgars: Vec<PathBuf>,
 ) -> bool {
+    match build_source_newer_reason(recipe_dir, source_dir, auto_deps_file, &stage_pkgars) {
+        Some(PlanReason::Missing) => true,
+        Some(reason) => {
+            log_debug!(logger, "updating build: {} is newer", reason);
+            true
+        }
+        None => false,
+    }
+}
+
+/// Same check as build_is_source_newer, but tells which one is newer
+pub(crate) fn build_source_newer_reason(
+    recipe_dir: &Path,
+    source_dir: &Path,
+    auto_deps_file: &Path,
+    stage_pkgars: &Vec<PathBuf>,
+) -> Option<PlanReason> {
     if !auto_deps_file.is_file() {
-        return true;
+        return Some(PlanReason::Missing);
     }
-    let Ok(stage_modified) = fs::modified_all(&stage_pkgars, fs::modified) else {
-        return true;
+    let Ok(stage_modified) = fs::modified_all(stage_pkgars, fs::modified) else {
+        return Some(PlanReason::Missing);
     };
     let Ok(mut source_modified) = fs::modified_dir_ignore_git(source_dir) else {
-        return false;
+        return None;
     };
     let mut recipe_is_newest = false;
     if let Ok(recipe_modified) = fs::modified(&recipe_dir.join("recipe.toml")) {
@@ -518,15 +567,15 @@ fn build_is_source_newer(
             recipe_is_newest = true;
         }
     }
-    let newer = source_modified > stage_modified;
-    if newer {
-        log_to_pty!(
-            logger,
-            "DEBUG: updating build: {} is newer",
-            if recipe_is_newest { "recipe" } else { "source" }
-        );
+    if source_modified > stage_modified {
+        Some(if recipe_is_newest {
+            PlanReason::Recipe
+        } else {
+            PlanReason::Source
+        })
+    } else {
+        None
     }
-    newer
 }
 
 pub fn remove_stage_dir(stage_dir: &PathBuf) -> crate::Result<()> {
@@ -572,7 +621,7 @@ pub fn get_sub_target_dir(target_dir: &Path, sub_path: &str) -> PathBuf {
     target_dir.join(sub_path)
 }
 
-fn build_deps_dir(
+pub fn build_deps_dir(
     logger: &PtyOut,
     deps_dir: &PathBuf,
     dep_pkgars: &BTreeSet<(PackageName, PathBuf)>,
@@ -591,41 +640,18 @@ fn build_deps_dir(
     };
     let tags_dir = deps_dir.join(".tags");
     if tags_dir.is_dir() {
-        // check all files present and exact
-        let mut cached = fs::check_files_present(
-            &tags_dir,
-            &dep_pkgars
-                .iter()
-                .map(|(name, _)| name.without_prefix())
-                .collect(),
-        )?;
-        if cached {
-            for (name, pkgar_path) in dep_pkgars {
-                let tag_file = tags_dir.join(name.without_prefix());
-                let Ok(tag_hash) = blake3::Hash::from_hex(fs::read_to_string(&tag_file)?) else {
-                    log_to_pty!(
-                        logger,
-                        "DEBUG: updating {:?}: {:?} is absent",
-                        deps_dir.file_name().unwrap().display(),
-                        name.as_str(),
-                    );
-                    cached = false;
-                    continue;
-                };
-                let pkgar_hash = PackageFile::new(pkgar_path, &pkey_file)?.header().blake3;
-                if *tag_hash.as_bytes() != pkgar_hash {
-                    log_to_pty!(
-                        logger,
-                        "DEBUG: updating {:?}: {:?} is updated",
-                        deps_dir.file_name().unwrap().display(),
-                        name.as_str(),
-                    );
-                    cached = false;
-                }
+        match deps_dir_outdated(deps_dir, dep_pkgars, &pkey_file)? {
+            None => {
+                metrics::add(Counter::SysrootHits, 1);
+                return Ok(true);
             }
-        }
-        if cached {
-            return Ok(true);
+            Some(Some(name)) => log_debug!(
+                logger,
+                "updating {:?}: {:?} is updated",
+                deps_dir.file_name().unwrap().display(),
+                name.as_str(),
+            ),
+            Some(None) => {}
         }
         fs::remove_all(deps_dir)?;
     }
@@ -656,10 +682,46 @@ fn build_deps_dir(
 
     // Move sysroot.tmp to sysroot atomically
     fs::rename(&deps_dir_tmp, deps_dir)?;
+    metrics::add(Counter::SysrootMisses, 1);
 
     Ok(false)
 }
 
+/// Check sysroot tags against dependency pkgars without touching the sysroot.
+/// Returns None if cached, or Some with the first dependency that is absent or updated.
+pub(crate) fn deps_dir_outdated(
+    deps_dir: &PathBuf,
+    dep_pkgars: &BTreeSet<(PackageName, PathBuf)>,
+    pkey_file: &pkgar_core::PublicKey,
+) -> Result<Option<Option<PackageName>>> {
+    let tags_dir = deps_dir.join(".tags");
+    if !tags_dir.is_dir() {
+        return Ok(Some(None));
+    }
+    // check all files present and exact
+    let present = fs::check_files_present(
+        &tags_dir,
+        &dep_pkgars
+            .iter()
+            .map(|(name, _)| name.without_prefix())
+            .collect(),
+    )?;
+    if !present {
+        return Ok(Some(None));
+    }
+    for (name, pkgar_path) in dep_pkgars {
+        let tag_file = tags_dir.join(name.without_prefix());
+        let Ok(tag_hash) = blake3::Hash::from_hex(fs::read_to_string(&tag_file)?) else {
+            return Ok(Some(Some(name.clone())));
+        };
+        let pkgar_hash = pkgar_cache::header_blake3(pkgar_path, pkey_file)?;
+        if *tag_hash.as_bytes() != pkgar_hash {
+            return Ok(Some(Some(name.clone())));
+        }
+    }
+    Ok(None)
+}
+
 fn clean_deps_dir(deps_dir: &PathBuf) -> Result<bool> {
     // this retain tags for future check
     let tags_dir = deps_dir.join(".tags");
@@ -677,14 +739,12 @@ fn build_auto_deps(
     auto_deps_path: &Path,
     stage_dirs: &Vec<PathBuf>,
     cached: bool,
-    cook_config: &CookConfig,
+    needed: Option<&[(PathBuf, String)]>,
     mut dep_pkgars: BTreeSet<(PackageName, PathBuf)>,
     logger: &PtyOut,
 ) -> Result<BTreeSet<PackageName>> {
     if auto_deps_path.is_file() && !cached {
-        if cook_config.verbose {
-            log_to_pty!(logger, "DEBUG: updating {}", auto_deps_path.display());
-        }
+        log_debug!(logger, "updating {}", auto_deps_path.display());
         fs::remove_all(&auto_deps_path)?;
     }
 
@@ -692,7 +752,10 @@ fn build_auto_deps(
         let wrapper: AutoDeps = fs::read_toml(&auto_deps_path)?;
         wrapper.packages
     } else {
-        let mut dynamic_deps = auto_deps_from_dynamic_linking(stage_dirs, &dep_pkgars, logger);
+        let mut dynamic_deps = match needed {
+            Some(needed) => auto_deps_from_needed(needed, &dep_pkgars, logger),
+            None => auto_deps_from_dynamic_linking(stage_dirs, &dep_pkgars, logger),
+        };
         dep_pkgars.retain(|x| recipe.build.dependencies.contains(&x.0));
         let package_deps =
             auto_deps_from_static_package_deps(&dep_pkgars, &dynamic_deps).unwrap_or_default();
@@ -736,7 +799,7 @@ pub fn build_remote(
     }
 
     if cached {
-        log_to_pty!(logger, "DEBUG: using cached build");
+        log_debug!(logger, "using cached build");
         let wrapper: AutoDeps = fs::read_toml(&auto_deps_path)?;
         return Ok(BuildResult::cached(stage_dirs, wrapper.packages));
     }
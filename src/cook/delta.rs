@@ -0,0 +1,204 @@
+use std::{
+    collections::BTreeMap,
+    ffi::OsStr,
+    io::{self, Read, Write},
+    os::unix::{ffi::OsStrExt, fs::PermissionsExt},
+    path::{Path, PathBuf},
+};
+
+use pkgar::{PackageFile, ext::EntryExt, ext::PackageSrcExt};
+use pkgar_core::{Entry, Mode, PackageSrc};
+use serde::{Deserialize, Serialize};
+
+use crate::{Error, Result, cook::fs::*, cook::pkgar_cache, wrap_io_err};
+
+/// File-level difference between two pkgar archives of the same package,
+/// derived from the per-entry blake3 stored in pkgar headers.
+#[derive(Debug, Default, Clone, PartialEq, Serialize, Deserialize)]
+pub struct PkgarDelta {
+    /// header blake3 of the old archive
+    pub from: String,
+    /// header blake3 of the new archive
+    pub to: String,
+    /// entries that are new or have different content or mode
+    pub changed: Vec<String>,
+    /// entries that no longer exist in the new archive
+    pub removed: Vec<String>,
+    /// bytes of entries in "changed"
+    pub changed_size: u64,
+    /// number of entries that can be kept as is
+    pub unchanged: usize,
+}
+
+type EntryMap = BTreeMap<PathBuf, ([u8; 32], u32)>;
+
+fn core_err(e: pkgar_core::Error) -> Error {
+    Error::Pkgar(pkgar::Error::Core(e))
+}
+
+/// Entry content hash and mode for each path
+fn entry_map(entries: &[Entry]) -> Result<EntryMap> {
+    let mut map = BTreeMap::new();
+    for entry in entries.iter() {
+        let path = EntryExt::check_path(entry)?.to_path_buf();
+        let mode = entry.mode().map_err(core_err)?.bits();
+        map.insert(path, (entry.blake3(), mode));
+    }
+    Ok(map)
+}
+
+/// Read entry content hash and mode for each path in an archive (or an archive head)
+fn read_entry_map(package: &mut PackageFile) -> Result<(EntryMap, Vec<Entry>)> {
+    let entries = package.read_entries()?;
+    Ok((entry_map(&entries)?, entries))
+}
+
+/// Compute the delta between two archives signed by the same key
+pub fn pkgar_delta(
+    old_path: &Path,
+    new_path: &Path,
+    pkey: &pkgar_core::PublicKey,
+) -> Result<PkgarDelta> {
+    let old = pkgar_cache::get(old_path, pkey)?;
+    let new = pkgar_cache::get(new_path, pkey)?;
+    let old_map = entry_map(&old.entries)?;
+    let new_map = entry_map(&new.entries)?;
+    let new_entries = &new.entries;
+
+    let mut delta = PkgarDelta {
+        from: old.blake3_hex(),
+        to: new.blake3_hex(),
+        ..Default::default()
+    };
+    for entry in new_entries.iter() {
+        let path = EntryExt::check_path(entry)?;
+        if old_map.get(path) == new_map.get(path) {
+            delta.unchanged += 1;
+        } else {
+            delta.changed.push(path.to_string_lossy().to_string());
+            delta.changed_size += entry.size();
+        }
+    }
+    for path in old_map.keys() {
+        if !new_map.contains_key(path) {
+            delta.removed.push(path.to_string_lossy().to_string());
+        }
+    }
+    Ok(delta)
+}
+
+fn write_entry(package: &mut PackageFile, entry: &Entry, target: &Path) -> Result<()> {
+    let mode = entry.mode().map_err(core_err)?;
+    if let Some(parent) = target.parent() {
+        create_dir(parent)?;
+    }
+    let tmp = target.with_added_extension("pkgar_tmp");
+    let mut reader = package.data_reader(entry)?;
+    let mut hasher = blake3::Hasher::new();
+    let kind = mode.kind();
+    if kind == Mode::SYMLINK {
+        let mut data = Vec::new();
+        reader
+            .read_to_end(&mut data)
+            .map_err(wrap_io_err!(tmp, "Reading entry"))?;
+        hasher.update(&data);
+        symlink(OsStr::from_bytes(&data), &tmp)?;
+    } else if kind == Mode::FILE {
+        let mut file = std::fs::File::create(&tmp).map_err(wrap_io_err!(tmp, "Creating file"))?;
+        let mut buf = vec![0; 64 * 1024];
+        loop {
+            let n = reader
+                .read(&mut buf)
+                .map_err(wrap_io_err!(tmp, "Reading entry"))?;
+            if n == 0 {
+                break;
+            }
+            hasher.update(&buf[..n]);
+            file.write_all(&buf[..n])
+                .map_err(wrap_io_err!(tmp, "Writing entry"))?;
+        }
+        file.set_permissions(std::fs::Permissions::from_mode(mode.perm().bits()))
+            .map_err(wrap_io_err!(tmp, "Setting permissions"))?;
+    } else {
+        return Err(Error::Other(format!(
+            "Unsupported entry mode {:o} at {:?}",
+            mode.bits(),
+            target.display()
+        )));
+    }
+    package.restore_reader(reader.into_inner())?;
+    // like Transaction::install, never put unverified data in place
+    if hasher.finalize().as_bytes() != &entry.blake3() {
+        let _ = std::fs::remove_file(&tmp);
+        return Err(Error::Other(format!(
+            "Entry blake3 mismatch at {:?}",
+            target.display()
+        )));
+    }
+    std::fs::rename(&tmp, target).map_err(wrap_io_err!(tmp, target, "Renaming entry"))
+}
+
+/// Install a new archive over an older installed version of the same package,
+/// writing only entries that differ from the installed pkgar head
+/// and removing entries that are gone. Returns number of entries written.
+pub fn install_delta(
+    package: &mut PackageFile,
+    old_head: &Path,
+    sysroot_dir: &Path,
+    pkey: &pkgar_core::PublicKey,
+) -> Result<usize> {
+    let mut old = PackageFile::new(old_head, pkey)?;
+    let (old_map, _) = read_entry_map(&mut old)?;
+    let (new_map, new_entries) = read_entry_map(package)?;
+
+    let mut written = 0;
+    for entry in new_entries.iter() {
+        let path = EntryExt::check_path(entry)?;
+        let target = sysroot_dir.join(path);
+        // also rewrite if user has deleted the file
+        if old_map.get(path) == new_map.get(path) && target.symlink_metadata().is_ok() {
+            continue;
+        }
+        write_entry(package, entry, &target)?;
+        written += 1;
+    }
+    for path in old_map.keys() {
+        if new_map.contains_key(path) {
+            continue;
+        }
+        let target = sysroot_dir.join(path);
+        match std::fs::remove_file(&target) {
+            Err(e) if e.kind() != io::ErrorKind::NotFound => {
+                return Err(wrap_io_err!(target, "Removing file")(e));
+            }
+            _ => {}
+        }
+    }
+    Ok(written)
+}
+
+/// Entries of `package` that differ from the installed `old_head`, and the
+/// paths that are only in `old_head`. For targets that can't be checked file
+/// by file, like an unmounted image.
+pub fn changed_entries(
+    package: &mut PackageFile,
+    old_head: &Path,
+    pkey: &pkgar_core::PublicKey,
+) -> Result<(Vec<Entry>, Vec<PathBuf>)> {
+    let mut old = PackageFile::new(old_head, pkey)?;
+    let (old_map, _) = read_entry_map(&mut old)?;
+    let (new_map, new_entries) = read_entry_map(package)?;
+
+    let mut changed = Vec::new();
+    for entry in new_entries {
+        let path = EntryExt::check_path(&entry)?;
+        if old_map.get(path) != new_map.get(path) {
+            changed.push(entry);
+        }
+    }
+    let removed = old_map
+        .into_keys()
+        .filter(|path| !new_map.contains_key(path))
+        .collect();
+    Ok((changed, removed))
+}
@@ -1,15 +1,18 @@
 use crate::cook::{
     cook_build,
     fetch_repo::{self, PlainPtyCallback},
+    freshness,
     fs::*,
+    metrics::{self, Counter},
     package::{get_package_name, package_source_paths},
     pty::PtyOut,
     script::*,
+    tar_store::TarStore,
 };
 use crate::{
     Error, Result, bail_other_err,
     config::translate_mirror,
-    is_redox, log_to_pty,
+    is_redox, log_debug, log_warn,
     recipe::{BuildKind, CookRecipe, SourceRecipe},
     wrap_io_err, wrap_other_err,
 };
@@ -104,6 +107,11 @@ pub fn fetch_offline(recipe: &CookRecipe, logger: &PtyOut) -> Result<FetchResult
             let cached = source_dir.is_dir();
             if !cached {
                 let source_tar = recipe_dir.join("source.tar");
+                if !source_tar.is_file()
+                    && let Some(blake3) = blake3
+                {
+                    fetch_tar_from_store(blake3, &source_tar)?;
+                }
                 let source_tar_blake3 = get_blake3(&source_tar)?;
                 if source_tar.exists() {
                     if let Some(blake3) = blake3 {
@@ -112,9 +120,18 @@ pub fn fetch_offline(recipe: &CookRecipe, logger: &PtyOut) -> Result<FetchResult
                                 "The downloaded tar blake3 {source_tar_blake3:?} is not equal to blake3 in recipe.toml"
                             );
                         }
-                        create_dir(&source_dir)?;
-                        fetch_extract_tar(source_tar, &source_dir, logger)?;
-                        fetch_apply_patches(recipe_dir, patches, script, &source_dir, logger)?;
+                        let source_dir_tmp = recipe_dir.join("source.tmp");
+                        fetch_tar_source(
+                            recipe_dir,
+                            &source_tar,
+                            &source_tar_blake3,
+                            patches,
+                            script,
+                            &source_dir_tmp,
+                            logger,
+                        )?;
+                        rename(&source_dir_tmp, &source_dir)?;
+                        fetch_record_extracted(recipe_dir, &source_tar_blake3)?;
                     } else {
                         // need to trust this tar file
                         bail_other_err!(
@@ -161,9 +178,9 @@ pub fn fetch(recipe: &CookRecipe, check_source: bool, logger: &PtyOut) -> Result
             let path = Path::new(&path);
             let cached = source_dir.is_dir() && modified_dir(path)? <= modified_dir(&source_dir)?;
             if !cached {
-                log_to_pty!(
+                log_debug!(
                     logger,
-                    "[DEBUG]: {:?} is newer than {:?}",
+                    "{:?} is newer than {:?}",
                     path.display(),
                     source_dir.display()
                 );
@@ -262,13 +279,17 @@ pub fn fetch(recipe: &CookRecipe, check_source: bool, logger: &PtyOut) -> Result
                             false
                         } else if remote_name != "origin" || &remote_url != chop_dot_git(git) {
                             false
+                        } else if let Some(remote_rev) = freshness::remote_head(git, &remote_branch)
+                        {
+                            // already asked the remote, only fetch if the branch moved
+                            remote_rev == head_rev
                         } else {
                             git_run_fetch(logger, &source_dir, git)?;
                             fetch_is_ran = true;
                             match get_git_fetch_rev(&source_dir, &remote_url, &remote_branch) {
                                 Ok(fetch_rev) => fetch_rev == head_rev,
                                 Err(e) => {
-                                    log_to_pty!(logger, "{}", e);
+                                    log_warn!(logger, "{}", e);
                                     false
                                 }
                             }
@@ -363,48 +384,68 @@ pub fn fetch(recipe: &CookRecipe, check_source: bool, logger: &PtyOut) -> Result
         }) => {
             let source_tar = recipe_dir.join("source.tar");
             let ident = blake3.clone().unwrap_or("no_tar_blake3_hash_info".into());
-            let mut tar_updated = false;
+            let mut fetched = false;
+            let mut source_tar_blake3 = None;
             loop {
                 if !source_tar.is_file() {
-                    tar_updated = true;
-                    download_wget(&tar, &source_tar, logger)?;
+                    fetched = true;
+                    let stored = match blake3 {
+                        Some(blake3) => fetch_tar_from_store(blake3, &source_tar)?,
+                        None => false,
+                    };
+                    if stored {
+                        log_debug!(logger, "using {:?} from tar store", source_tar.display());
+                    } else {
+                        download_wget(&tar, &source_tar, logger)?;
+                    }
                 }
                 if !check_source {
                     break;
                 }
-                let source_tar_blake3 = get_blake3(&source_tar)?;
+                let tar_blake3 = get_blake3(&source_tar)?;
                 if let Some(blake3) = blake3 {
-                    if source_tar_blake3 == *blake3 {
+                    if tar_blake3 == *blake3 {
+                        if let Some(store) = TarStore::from_config()? {
+                            store.adopt(&source_tar, blake3)?;
+                        }
+                        source_tar_blake3 = Some(tar_blake3);
                         break;
                     }
-                    if tar_updated {
+                    if fetched {
                         bail_other_err!(
-                            "The downloaded tar blake3 {source_tar_blake3:?} is not equal to blake3 in recipe.toml"
+                            "The downloaded tar blake3 {tar_blake3:?} is not equal to blake3 in recipe.toml"
                         )
                     } else {
-                        log_to_pty!(
-                            logger,
-                            "DEBUG: source tar blake3 is different and need redownload"
-                        );
+                        log_debug!(logger, "source tar blake3 is different and need redownload");
                         remove_all(&source_tar)?;
                     }
                 } else {
                     //TODO: set blake3 hash on the recipe with something like "cook fix"
-                    log_to_pty!(
+                    log_warn!(
                         logger,
-                        "WARNING: set blake3 for '{}' to '{}'",
+                        "set blake3 for '{}' to '{}'",
                         source_tar.display(),
-                        source_tar_blake3
+                        tar_blake3
                     );
+                    source_tar_blake3 = Some(tar_blake3);
                     break;
                 }
             }
+            let source_tar_blake3 = match source_tar_blake3 {
+                Some(tar_blake3) => tar_blake3,
+                None => get_blake3(&source_tar)?,
+            };
             let mut cached = true;
             if source_dir.is_dir() {
-                if tar_updated || fetch_is_patches_newer(recipe_dir, patches, &source_dir)? {
-                    log_to_pty!(
+                let tar_changed = match fetch_extracted_blake3(recipe_dir) {
+                    Some(extracted) => extracted != source_tar_blake3,
+                    // extracted before this was recorded
+                    None => fetched,
+                };
+                if tar_changed || fetch_is_patches_newer(recipe_dir, patches, &source_dir)? {
+                    log_debug!(
                         logger,
-                        "DEBUG: source tar or patches is newer than the source directory"
+                        "source tar or patches is newer than the source directory"
                     );
                     remove_all(&source_dir)?
                 }
@@ -412,12 +453,19 @@ pub fn fetch(recipe: &CookRecipe, check_source: bool, logger: &PtyOut) -> Result
             if !source_dir.is_dir() {
                 // Create source.tmp
                 let source_dir_tmp = recipe_dir.join("source.tmp");
-                create_dir_clean(&source_dir_tmp)?;
-                fetch_extract_tar(source_tar, &source_dir_tmp, logger)?;
-                fetch_apply_patches(recipe_dir, patches, script, &source_dir_tmp, logger)?;
+                fetch_tar_source(
+                    recipe_dir,
+                    &source_tar,
+                    &source_tar_blake3,
+                    patches,
+                    script,
+                    &source_dir_tmp,
+                    logger,
+                )?;
 
                 // Move source.tmp to source atomically
                 rename(&source_dir_tmp, &source_dir)?;
+                fetch_record_extracted(recipe_dir, &source_tar_blake3)?;
                 cached = false;
             }
             FetchResult::new(source_dir, ident, cached)
@@ -425,9 +473,9 @@ pub fn fetch(recipe: &CookRecipe, check_source: bool, logger: &PtyOut) -> Result
         // Local Sources
         None => {
             if !source_dir.is_dir() {
-                log_to_pty!(
+                log_warn!(
                     logger,
-                    "WARNING: Recipe without source section expected source dir at '{}'",
+                    "Recipe without source section expected source dir at '{}'",
                     source_dir.display(),
                 );
                 create_dir(&source_dir)?;
@@ -470,7 +518,7 @@ fn manual_git_recursive_submodule(
     source_dir: &PathBuf,
     cmd: Vec<&str>,
 ) -> Result<()> {
-    log_to_pty!(
+    log_warn!(
         logger,
         "Git submodule {} failed, might be caused by race condition in RedoxFS, retrying without --recursive.",
         cmd[0]
@@ -612,6 +660,133 @@ pub(crate) fn fetch_resolve_canon(
     Ok(recipe)
 }
 
+/// Link `source_tar` to the stored tarball with this hash, if the tar store
+/// has it. Anything left at `source_tar`, like a dangling link, is replaced.
+pub(crate) fn fetch_tar_from_store(blake3: &str, source_tar: &Path) -> Result<bool> {
+    match TarStore::from_config()? {
+        Some(store) => store.link(blake3, source_tar),
+        None => Ok(false),
+    }
+}
+
+/// Patched source trees kept per recipe, besides the pristine one.
+const PATCHED_SNAPSHOTS: usize = 2;
+
+/// Create `source_dir_tmp` as the tarball extracted with patches and script
+/// applied.
+///
+/// Under `source.cache`, the tarball is kept extracted as `pristine-<tar hash>`
+/// and each patched result as `patched-<hash of tar, patches and script>`, so
+/// changing or reverting a patch only copies a tree, cloning file data where
+/// the filesystem supports it. Hardlinks are not used since builds may write
+/// into the source dir.
+pub(crate) fn fetch_tar_source(
+    recipe_dir: &Path,
+    source_tar: &PathBuf,
+    tar_blake3: &str,
+    patches: &Vec<String>,
+    script: &Option<String>,
+    source_dir_tmp: &PathBuf,
+    logger: &PtyOut,
+) -> Result<()> {
+    let cache_dir = recipe_dir.join("source.cache");
+    create_dir(&cache_dir)?;
+    if source_dir_tmp.exists() {
+        remove_all(source_dir_tmp)?;
+    }
+
+    let mut hasher = blake3::Hasher::new();
+    hasher.update(tar_blake3.as_bytes());
+    for patch_name in patches {
+        let patch_file = recipe_dir.join(patch_name);
+        let patch = fs::read(&patch_file).map_err(wrap_io_err!(patch_file, "Reading patch"))?;
+        hasher.update(blake3::hash(&patch).as_bytes());
+    }
+    if let Some(script) = script {
+        hasher.update(b"script");
+        hasher.update(script.as_bytes());
+    }
+    let patched_dir = cache_dir.join(format!("patched-{}", &hasher.finalize().to_hex()[..16]));
+    let is_patched = !patches.is_empty() || script.is_some();
+
+    if is_patched && patched_dir.is_dir() {
+        log_debug!(logger, "using patched source {:?}", patched_dir.display());
+        fetch_touch_snapshot(&patched_dir);
+        return copy_tree(&patched_dir, source_dir_tmp).map_err(wrap_io_err!(
+            patched_dir,
+            source_dir_tmp,
+            "Copying patched source"
+        ));
+    }
+
+    let pristine_dir = cache_dir.join(format!("pristine-{}", &tar_blake3[..16]));
+    if !pristine_dir.is_dir() {
+        // a new tarball makes every older snapshot useless
+        fetch_prune_snapshots(&cache_dir, "", 0)?;
+        let pristine_tmp = pristine_dir.with_added_extension("tmp");
+        create_dir_clean(&pristine_tmp)?;
+        fetch_extract_tar(source_tar.clone(), &pristine_tmp, logger)?;
+        rename(&pristine_tmp, &pristine_dir)?;
+    }
+    copy_tree(&pristine_dir, source_dir_tmp).map_err(wrap_io_err!(
+        pristine_dir,
+        source_dir_tmp,
+        "Copying pristine source"
+    ))?;
+    if !is_patched {
+        return Ok(());
+    }
+
+    fetch_apply_patches(recipe_dir, patches, script, source_dir_tmp, logger)?;
+    fetch_prune_snapshots(&cache_dir, "patched-", PATCHED_SNAPSHOTS - 1)?;
+    let patched_tmp = patched_dir.with_added_extension("tmp");
+    if patched_tmp.exists() {
+        remove_all(&patched_tmp)?;
+    }
+    copy_tree(source_dir_tmp, &patched_tmp).map_err(wrap_io_err!(
+        source_dir_tmp,
+        patched_tmp,
+        "Saving patched source"
+    ))?;
+    rename(&patched_tmp, &patched_dir)
+}
+
+/// Blake3 of the tar that the source dir was extracted from, if recorded.
+fn fetch_extracted_blake3(recipe_dir: &Path) -> Option<String> {
+    let extracted = fs::read_to_string(recipe_dir.join("source.blake3")).ok()?;
+    Some(extracted.trim().to_string())
+}
+
+fn fetch_record_extracted(recipe_dir: &Path, tar_blake3: &str) -> Result<()> {
+    let path = recipe_dir.join("source.blake3");
+    fs::write(&path, tar_blake3).map_err(wrap_io_err!(path, "Writing extracted tar blake3"))
+}
+
+/// Mark a snapshot as recently used.
+fn fetch_touch_snapshot(dir: &Path) {
+    if let Ok(file) = File::open(dir) {
+        let _ = file.set_modified(std::time::SystemTime::now());
+    }
+}
+
+/// Remove all but the `keep` most recently used snapshots starting with `prefix`.
+fn fetch_prune_snapshots(cache_dir: &Path, prefix: &str, keep: usize) -> Result<()> {
+    let mut snapshots = Vec::new();
+    for entry in fs::read_dir(cache_dir).map_err(wrap_io_err!(cache_dir, "Reading dir"))? {
+        let entry = entry.map_err(wrap_io_err!(cache_dir, "Reading dir"))?;
+        if entry.file_name().to_string_lossy().starts_with(prefix) {
+            let path = entry.path();
+            snapshots.push((modified(&path)?, path));
+        }
+    }
+    snapshots.sort();
+    let remove = snapshots.len().saturating_sub(keep);
+    for (_, path) in snapshots.into_iter().take(remove) {
+        remove_all(&path)?;
+    }
+    Ok(())
+}
+
 pub(crate) fn fetch_extract_tar(
     source_tar: PathBuf,
     source_dir_tmp: &PathBuf,
@@ -633,6 +808,9 @@ pub(crate) fn fetch_extract_tar(
     command.arg("--directory").arg(source_dir_tmp);
     command.arg("--strip-components").arg("1");
     run_command(command, logger)?;
+    if let Ok(mt) = fs::metadata(&source_tar) {
+        metrics::add(Counter::BytesExtracted, mt.len());
+    }
     Ok(())
 }
 
@@ -671,8 +849,8 @@ pub fn fetch_remote(
 ) -> Result<FetchResult> {
     let (mut manager, repository) = fetch_repo::get_binary_repo();
     let target_dir = create_target_dir(recipe_dir, recipe.target)?;
-    if logger.is_some() {
-        let writer = logger.as_ref().unwrap().1.try_clone().unwrap();
+    if let Some((pty, _)) = logger {
+        let writer = pty.try_clone_writer()?;
         manager.set_callback(Rc::new(RefCell::new(PlainPtyCallback::new(writer))));
     }
     let packages = recipe.recipe.get_packages_list();
@@ -701,7 +879,7 @@ pub fn fetch_remote(
             if source_toml.is_file() {
                 let pkg_toml = read_source_toml(&source_toml)?;
                 if &pkg_toml.blake3 != repo_blake3 {
-                    log_to_pty!(logger, "DEBUG: Updating source binaries");
+                    log_debug!(logger, "Updating source binaries");
                     remove_all(&source_toml)?;
                     if source_pkgar.is_file() {
                         remove_all(&source_pkgar)?;
@@ -1,6 +1,7 @@
 use std::{
     cell::RefCell,
-    io::{PipeWriter, Write},
+    fs::File,
+    io::Write,
     path::{Path, PathBuf},
     rc::Rc,
     time::Duration,
@@ -90,11 +91,11 @@ pub struct PlainPtyCallback {
     fetch_total: usize,
     interactive: bool,
     download_file: Option<String>,
-    pty: PipeWriter,
+    pty: File,
 }
 
 impl PlainPtyCallback {
-    pub fn new(pty: PipeWriter) -> Self {
+    pub fn new(pty: File) -> Self {
         Self {
             size: 0,
             unknown_size: false,
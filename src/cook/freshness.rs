@@ -0,0 +1,227 @@
+//! Batched upstream freshness check for git sources.
+//!
+//! Deciding whether a git recipe without a pinned `rev` is up to date used to
+//! take a `git fetch` per recipe. [`prefetch_remote_heads`] instead asks every
+//! remote once with `git ls-remote` for all branches the recipes track, so
+//! `fetch` only fetches sources whose branch head actually moved.
+
+use std::collections::{BTreeMap, BTreeSet, HashMap};
+use std::path::PathBuf;
+use std::process::{Command, Stdio};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{LazyLock, Mutex};
+use std::thread;
+
+use crate::config::translate_mirror;
+use crate::cook::fs::{chop_dot_git, get_git_head_rev, get_git_remote_tracking};
+use crate::cook::log::{Level, log_stderr};
+use crate::recipe::{CookRecipe, SourceRecipe};
+use crate::{Error, Result, wrap_io_err};
+
+/// Remote branch heads by (recipe git URL, branch)
+static REMOTE_HEADS: LazyLock<Mutex<HashMap<(String, String), String>>> =
+    LazyLock::new(|| Mutex::new(HashMap::new()));
+
+/// Head of `branch` at `git` as seen by [`prefetch_remote_heads`], if it was queried.
+pub fn remote_head(git: &str, branch: &str) -> Option<String> {
+    REMOTE_HEADS
+        .lock()
+        .unwrap()
+        .get(&(git.to_string(), branch.to_string()))
+        .cloned()
+}
+
+/// Branch heads of the remote at `url`, by branch name.
+pub fn ls_remote<'a>(
+    url: &str,
+    branches: impl IntoIterator<Item = &'a str>,
+) -> Result<BTreeMap<String, String>> {
+    let mut command = Command::new("git");
+    command.arg("ls-remote").arg("--heads").arg(url);
+    for branch in branches {
+        command.arg(format!("refs/heads/{branch}"));
+    }
+    // never wait on a credential prompt
+    command.env("GIT_TERMINAL_PROMPT", "0");
+    command.stdin(Stdio::null()).stderr(Stdio::null());
+    let output = command
+        .output()
+        .map_err(wrap_io_err!("Executing git ls-remote"))?;
+    if !output.status.success() {
+        return Err(Error::Command(command, output.status));
+    }
+
+    let mut heads = BTreeMap::new();
+    for line in String::from_utf8_lossy(&output.stdout).lines() {
+        let mut parts = line.split_whitespace();
+        if let (Some(sha), Some(name)) = (parts.next(), parts.next())
+            && let Some(branch) = name.strip_prefix("refs/heads/")
+        {
+            heads.insert(branch.to_string(), sha.to_string());
+        }
+    }
+    Ok(heads)
+}
+
+/// The (git URL, remote branch) that `fetch` would check for this recipe,
+/// under the same conditions it uses to decide that a fetch can tell.
+fn tracked_branch(recipe: &CookRecipe) -> Option<(String, String)> {
+    let Some(SourceRecipe::Git {
+        git,
+        branch,
+        rev: None,
+        ..
+    }) = &recipe.recipe.source
+    else {
+        return None;
+    };
+    let source_dir: PathBuf = recipe.dir.join("source");
+    if !source_dir.join(".git").is_dir() {
+        return None;
+    }
+    let (_, detached) = get_git_head_rev(&source_dir).ok()?;
+    if detached {
+        return None;
+    }
+    let (_, remote_branch, remote_name, remote_url) = get_git_remote_tracking(&source_dir).ok()?;
+    if branch.as_ref().is_some_and(|b| b != &remote_branch)
+        || remote_name != "origin"
+        || remote_url != chop_dot_git(git)
+    {
+        return None;
+    }
+    Some((git.clone(), remote_branch))
+}
+
+/// Host part of a git URL, for both `scheme://host/path` and `user@host:path`.
+fn remote_host(url: &str) -> &str {
+    if let Some((_, rest)) = url.split_once("://") {
+        let host = rest.split('/').next().unwrap_or(rest);
+        return host.rsplit('@').next().unwrap_or(host);
+    }
+    match url.split_once(':') {
+        Some((host, _)) => host.rsplit('@').next().unwrap_or(host),
+        None => "",
+    }
+}
+
+/// Query the branch heads of all git recipes that would check their remote on
+/// fetch, with one `git ls-remote` per remote URL. Remotes on the same host are
+/// queried one after another, different hosts in parallel by up to `jobs`
+/// threads. Returns the number of branch heads learned; remotes that fail are
+/// left to the regular fetch.
+pub fn prefetch_remote_heads(recipes: &[CookRecipe], jobs: usize) -> usize {
+    let mut hosts: BTreeMap<String, BTreeMap<String, BTreeSet<String>>> = BTreeMap::new();
+    for recipe in recipes {
+        if recipe.is_deps {
+            continue;
+        }
+        if let Some((git, branch)) = tracked_branch(recipe) {
+            hosts
+                .entry(remote_host(&git).to_string())
+                .or_default()
+                .entry(git)
+                .or_default()
+                .insert(branch);
+        }
+    }
+    let work: Vec<_> = hosts.into_values().collect();
+
+    let next = AtomicUsize::new(0);
+    let learned = AtomicUsize::new(0);
+    thread::scope(|s| {
+        for _ in 0..jobs.clamp(1, work.len().max(1)) {
+            s.spawn(|| {
+                loop {
+                    let i = next.fetch_add(1, Ordering::SeqCst);
+                    let Some(remotes) = work.get(i) else {
+                        break;
+                    };
+                    for (git, branches) in remotes {
+                        let url = translate_mirror(git);
+                        let heads = match ls_remote(&url, branches.iter().map(|b| b.as_str())) {
+                            Ok(heads) => heads,
+                            Err(e) => {
+                                log_stderr(Level::Warning, format_args!("{url}: {e}"));
+                                continue;
+                            }
+                        };
+                        let mut remote_heads = REMOTE_HEADS.lock().unwrap();
+                        for (branch, sha) in heads {
+                            if branches.contains(&branch) {
+                                remote_heads.insert((git.clone(), branch), sha);
+                                learned.fetch_add(1, Ordering::SeqCst);
+                            }
+                        }
+                    }
+                }
+            });
+        }
+    });
+    learned.into_inner()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::path::Path;
+
+    fn git(dir: &Path, args: &[&str]) {
+        let status = Command::new("git")
+            .args(["-c", "user.name=cook", "-c", "user.email=cook@localhost"])
+            .args(args)
+            .current_dir(dir)
+            .stdout(Stdio::null())
+            .stderr(Stdio::null())
+            .status()
+            .unwrap();
+        assert!(status.success(), "git {args:?}");
+    }
+
+    #[test]
+    fn ls_remote_matches_clone_head() {
+        let root = std::env::temp_dir().join(format!("cook-freshness-{}", std::process::id()));
+        let _ = std::fs::remove_dir_all(&root);
+        std::fs::create_dir_all(&root).unwrap();
+        let remote = root.join("remote.git");
+        let clone = root.join("clone");
+        git(
+            &root,
+            &["init", "--bare", "-b", "main", remote.to_str().unwrap()],
+        );
+        git(
+            &root,
+            &["clone", remote.to_str().unwrap(), clone.to_str().unwrap()],
+        );
+        git(&clone, &["checkout", "-b", "main"]);
+        git(&clone, &["commit", "--allow-empty", "-m", "one"]);
+        git(&clone, &["push", "origin", "main"]);
+
+        let url = remote.to_str().unwrap();
+        let heads = ls_remote(url, ["main", "missing"]).unwrap();
+        let (head, detached) = get_git_head_rev(&clone).unwrap();
+        assert!(!detached);
+        assert_eq!(heads.get("main"), Some(&head));
+        assert_eq!(heads.len(), 1);
+
+        // a moved remote head no longer matches the clone
+        let other = root.join("other");
+        git(&root, &["clone", url, other.to_str().unwrap()]);
+        git(&other, &["commit", "--allow-empty", "-m", "two"]);
+        git(&other, &["push", "origin", "main"]);
+        let heads = ls_remote(url, ["main"]).unwrap();
+        assert_ne!(heads.get("main"), Some(&head));
+
+        std::fs::remove_dir_all(&root).unwrap();
+    }
+
+    #[test]
+    fn host_of_url() {
+        assert_eq!(
+            remote_host("https://gitlab.redox-os.org/redox-os/relibc.git"),
+            "gitlab.redox-os.org"
+        );
+        assert_eq!(remote_host("git@github.com:foo/bar"), "github.com");
+        assert_eq!(remote_host("/srv/git/bar.git"), "");
+    }
+}
@@ -12,19 +12,22 @@ use walkdir::{DirEntry, WalkDir};
 use crate::{
     Error, Result, bail_other_err,
     config::translate_mirror,
+    cook::memory::PeakWatch,
+    cook::metrics::{self, Counter},
     cook::pty::{PtyOut, spawn_to_pipe},
+    cook::trash,
     wrap_io_err, wrap_other_err,
 };
 
 //TODO: pub(crate) for all of these functions
 
+/// Remove a file, or a directory in the background, see [`trash::discard`].
 pub fn remove_all(path: &Path) -> Result<()> {
     if path.is_dir() {
-        fs::remove_dir_all(path)
+        trash::discard(path)
     } else {
-        fs::remove_file(path)
+        fs::remove_file(path).map_err(wrap_io_err!(path, "Removing all"))
     }
-    .map_err(wrap_io_err!(path, "Removing all"))
 }
 
 pub fn create_dir(dir: &Path) -> Result<()> {
@@ -60,6 +63,28 @@ pub fn copy_dir_all(src: impl AsRef<Path>, dst: impl AsRef<Path>) -> io::Result<
     Ok(())
 }
 
+/// Copy a directory tree, keeping symlinks, permissions and modification
+/// times. `fs::copy` clones file data instead where the filesystem supports it.
+pub fn copy_tree(src: &Path, dst: &Path) -> io::Result<()> {
+    fs::create_dir(dst)?;
+    for entry in fs::read_dir(src)? {
+        let entry = entry?;
+        let ty = entry.file_type()?;
+        let src = entry.path();
+        let dst = dst.join(entry.file_name());
+        if ty.is_dir() {
+            copy_tree(&src, &dst)?;
+        } else if ty.is_symlink() {
+            std::os::unix::fs::symlink(fs::read_link(&src)?, &dst)?;
+        } else {
+            fs::copy(&src, &dst)?;
+            // build systems compare these, e.g. configure against configure.ac
+            fs::File::open(&dst)?.set_modified(entry.metadata()?.modified()?)?;
+        }
+    }
+    fs::set_permissions(dst, fs::metadata(src)?.permissions())
+}
+
 pub fn move_dir_all_fn<'a>(
     src: impl AsRef<Path>,
     mv: &'a Box<impl Fn(PathBuf) -> Option<&'a Path>>,
@@ -224,12 +249,47 @@ pub fn run_command(mut command: process::Command, stdout_pipe: &PtyOut) -> Resul
 }
 
 pub fn run_command_stdin(
-    mut command: process::Command,
+    command: process::Command,
     stdin_data: &[u8],
     stdout_pipe: &PtyOut,
 ) -> Result<()> {
+    run_command_stdin_inner(command, stdin_data, stdout_pipe, false).map(|_| ())
+}
+
+/// Like [`run_command_stdin`], returning the peak memory in bytes used by the
+/// command and everything it spawned, or 0 where that can't be measured.
+pub fn run_command_stdin_peak(
+    command: process::Command,
+    stdin_data: &[u8],
+    stdout_pipe: &PtyOut,
+) -> Result<u64> {
+    run_command_stdin_inner(command, stdin_data, stdout_pipe, true)
+}
+
+/// `<TARGET>/<COOKBOOK_NAME>` of a build script command, or its program name.
+fn command_label(command: &process::Command) -> String {
+    let env = |key: &str| {
+        command
+            .get_envs()
+            .find(|(k, _)| *k == key)
+            .and_then(|(_, v)| v)
+            .map(|v| v.to_string_lossy().into_owned())
+    };
+    match (env("TARGET"), env("COOKBOOK_NAME")) {
+        (Some(target), Some(name)) => format!("{target}/{name}"),
+        _ => command.get_program().to_string_lossy().into_owned(),
+    }
+}
+
+fn run_command_stdin_inner(
+    mut command: process::Command,
+    stdin_data: &[u8],
+    stdout_pipe: &PtyOut,
+    watch_peak: bool,
+) -> Result<u64> {
     command.stdin(Stdio::piped());
     let mut child = spawn_to_pipe(&mut command, stdout_pipe)?;
+    let watch = watch_peak.then(|| PeakWatch::start(child.id(), command_label(&command)));
 
     if let Some(ref mut stdin) = child.stdin {
         stdin
@@ -240,12 +300,13 @@ pub fn run_command_stdin(
     }
 
     let status = child.wait().map_err(wrap_io_err!("Spawning"))?;
+    let peak = watch.map_or(0, PeakWatch::finish);
 
     if !status.success() {
         return Err(Error::Command(command, status));
     }
 
-    Ok(())
+    Ok(peak)
 }
 
 pub fn serialize_and_write<T: Serialize>(file_path: &Path, content: &T) -> Result<()> {
@@ -285,6 +346,9 @@ pub fn download_wget(url: &str, dest: &PathBuf, logger: &PtyOut) -> Result<()> {
         command.arg("--continue").arg("-O").arg(&dest_tmp);
         run_command(command, logger)?;
         rename(&dest_tmp, &dest)?;
+        if let Ok(mt) = fs::metadata(dest) {
+            metrics::add(Counter::BytesFetched, mt.len());
+        }
     }
     Ok(())
 }
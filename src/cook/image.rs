@@ -0,0 +1,485 @@
+//! Push packages straight into a RedoxFS image.
+//!
+//! With `repo push --image=<path>`, packages are written into a disk image
+//! through the redoxfs library instead of a FUSE mount of it. Push workers
+//! read, decompress and verify the pkgar entries of several packages at once
+//! and hand them over in batches to one writer thread, which owns the
+//! filesystem and commits everything queued so far in a single transaction,
+//! so blocks are allocated and the tree is synced once per batch instead of
+//! once per write.
+//!
+//! The package state and the `.pkgar_head` of each package, in [`META_DIRS`],
+//! are copied out of the image into a local dir before the push and written
+//! back after it, so state handling and delta installs work the same as with
+//! a sysroot.
+
+use std::ffi::OsString;
+use std::fs;
+use std::io::Read;
+use std::os::unix::ffi::OsStringExt;
+use std::os::unix::fs::PermissionsExt;
+use std::path::{Component, Path, PathBuf};
+use std::sync::mpsc::{self, Receiver, Sender, SyncSender};
+use std::thread::{self, JoinHandle};
+use std::time::SystemTime;
+
+use pkgar::PackageFile;
+use pkgar::ext::{EntryExt, PackageSrcExt};
+use pkgar_core::{Entry, Mode, PackageSrc};
+use redox_installer::DiskWrapper;
+use redoxfs::{Disk, FileSystem, Node, Transaction, TreeData, TreePtr};
+use syscall::error::{EIO, EISDIR, ELOOP, ENOENT, ENOSPC, ENOTDIR};
+use walkdir::WalkDir;
+
+use crate::{Error, Result, wrap_io_err};
+
+/// Dirs with the package state and heads, relative to the image root
+pub const META_DIRS: [&str; 2] = ["etc/pkg", "var/lib/packages"];
+
+/// Entry data sent to the writer at once by one push worker
+const BATCH_BYTES: usize = 8 * 1024 * 1024;
+
+/// Queued data the writer commits in one transaction
+const TX_BYTES: usize = 64 * 1024 * 1024;
+
+/// Symlinks followed when resolving a dir, like the kernel's limit
+const MAX_LINKS: usize = 40;
+
+pub enum ImageOp {
+    File {
+        path: PathBuf,
+        perm: u16,
+        data: Vec<u8>,
+    },
+    Symlink {
+        path: PathBuf,
+        target: Vec<u8>,
+    },
+    Remove {
+        path: PathBuf,
+    },
+}
+
+impl ImageOp {
+    fn size(&self) -> usize {
+        match self {
+            ImageOp::File { data, .. } => data.len(),
+            ImageOp::Symlink { target, .. } => target.len(),
+            ImageOp::Remove { .. } => 0,
+        }
+    }
+}
+
+type Batch = (Vec<ImageOp>, Sender<Result<()>>);
+
+/// A RedoxFS image opened for pushing, written by a thread of its own.
+pub struct ImageWriter {
+    path: PathBuf,
+    queue: Option<SyncSender<Batch>>,
+    writer: Option<JoinHandle<()>>,
+}
+
+fn fs_err(path: &Path, context: &str, e: syscall::Error) -> Error {
+    Error::Other(format!("{context} {:?} in image: {e}", path.display()))
+}
+
+fn now() -> (u64, u32) {
+    let time = SystemTime::now()
+        .duration_since(SystemTime::UNIX_EPOCH)
+        .unwrap_or_default();
+    (time.as_secs(), time.subsec_nanos())
+}
+
+impl ImageWriter {
+    /// Open the RedoxFS in `image`, a whole disk image or a bare filesystem,
+    /// and copy its [`META_DIRS`] into `meta_dir`. Up to `jobs` batches can
+    /// be queued for the writer.
+    pub fn open(image: &Path, meta_dir: &Path, jobs: usize) -> Result<Self> {
+        let disk = DiskWrapper::open(image).map_err(wrap_io_err!(image, "Opening image"))?;
+        let mut fs = FileSystem::open(disk, None, None, true)
+            .map_err(|e| fs_err(image, "Opening RedoxFS", e))?;
+        fs.tx(|tx| {
+            for dir in META_DIRS {
+                if let Some(node) = resolve(tx, Path::new(dir), false, 0)? {
+                    copy_out(tx, node, &meta_dir.join(dir))?;
+                }
+            }
+            Ok(())
+        })
+        .map_err(|e| fs_err(image, "Reading package state", e))?;
+
+        let (queue, batches) = mpsc::sync_channel(jobs.max(1) * 2);
+        let writer = thread::spawn(move || write_batches(&mut fs, batches));
+        Ok(Self {
+            path: image.to_path_buf(),
+            queue: Some(queue),
+            writer: Some(writer),
+        })
+    }
+
+    /// Write `ops` into the image, in order. Returns once they are committed.
+    pub fn apply(&self, ops: Vec<ImageOp>) -> Result<()> {
+        if ops.is_empty() {
+            return Ok(());
+        }
+        let (reply, result) = mpsc::channel();
+        let writer_gone = || Error::Other(format!("Writer of {:?} stopped", self.path.display()));
+        self.queue
+            .as_ref()
+            .unwrap()
+            .send((ops, reply))
+            .map_err(|_| writer_gone())?;
+        result.recv().map_err(|_| writer_gone())?
+    }
+
+    /// Write the `entries` of `package`, reading and verifying them on the
+    /// calling thread, and remove the `removed` paths.
+    pub fn push_entries(
+        &self,
+        package: &mut PackageFile,
+        entries: &[Entry],
+        removed: Vec<PathBuf>,
+    ) -> Result<()> {
+        let mut batch: Vec<ImageOp> = removed
+            .into_iter()
+            .map(|path| ImageOp::Remove { path })
+            .collect();
+        let mut size = 0;
+        for entry in entries {
+            let op = read_entry(package, entry)?;
+            size += op.size();
+            batch.push(op);
+            if size >= BATCH_BYTES {
+                self.apply(std::mem::take(&mut batch))?;
+                size = 0;
+            }
+        }
+        self.apply(batch)
+    }
+
+    /// Write the files in `meta_dir` back and close the image.
+    pub fn finish(mut self, meta_dir: &Path) -> Result<()> {
+        let mut ops = Vec::new();
+        for entry in WalkDir::new(meta_dir) {
+            let entry =
+                entry.map_err(|e| wrap_io_err!(meta_dir, "Reading package state")(e.into()))?;
+            if !entry.file_type().is_file() {
+                continue;
+            }
+            let path = entry.path();
+            let data = fs::read(path).map_err(wrap_io_err!(path, "Reading package state"))?;
+            let perm = entry
+                .metadata()
+                .map_or(0o644, |meta| meta.permissions().mode() & 0o7777);
+            ops.push(ImageOp::File {
+                path: path.strip_prefix(meta_dir).unwrap().to_path_buf(),
+                perm: perm as u16,
+                data,
+            });
+        }
+        self.apply(ops)?;
+        self.close();
+        Ok(())
+    }
+
+    fn close(&mut self) {
+        // the writer stops once the queue is closed
+        self.queue.take();
+        if let Some(writer) = self.writer.take() {
+            let _ = writer.join();
+        }
+    }
+}
+
+impl Drop for ImageWriter {
+    fn drop(&mut self) {
+        self.close();
+    }
+}
+
+/// Read one entry with its data, which must match the blake3 in the header
+/// like with `Transaction::install`.
+fn read_entry(package: &mut PackageFile, entry: &Entry) -> Result<ImageOp> {
+    let path = EntryExt::check_path(entry)?.to_path_buf();
+    let mode = entry
+        .mode()
+        .map_err(|e| Error::Pkgar(pkgar::Error::Core(e)))?;
+    let mut data = Vec::with_capacity(entry.size() as usize);
+    let mut reader = package.data_reader(entry)?;
+    reader
+        .read_to_end(&mut data)
+        .map_err(wrap_io_err!(path, "Reading entry"))?;
+    package.restore_reader(reader.into_inner())?;
+    if blake3::hash(&data).as_bytes() != &entry.blake3() {
+        return Err(Error::Other(format!(
+            "Entry blake3 mismatch at {:?}",
+            path.display()
+        )));
+    }
+    match mode.kind() {
+        Mode::FILE => Ok(ImageOp::File {
+            path,
+            perm: mode.perm().bits() as u16,
+            data,
+        }),
+        Mode::SYMLINK => Ok(ImageOp::Symlink { path, target: data }),
+        _ => Err(Error::Other(format!(
+            "Unsupported entry mode {:o} at {:?}",
+            mode.bits(),
+            path.display()
+        ))),
+    }
+}
+
+fn write_batches<D: Disk>(fs: &mut FileSystem<D>, batches: Receiver<Batch>) {
+    while let Ok(first) = batches.recv() {
+        let mut size: usize = first.0.iter().map(ImageOp::size).sum();
+        let mut pending = vec![first];
+        while size < TX_BYTES
+            && let Ok(next) = batches.try_recv()
+        {
+            size += next.0.iter().map(ImageOp::size).sum::<usize>();
+            pending.push(next);
+        }
+
+        let result = fs.tx(|tx| {
+            for (ops, _) in &pending {
+                apply_ops(tx, ops)?;
+            }
+            Ok(())
+        });
+        if result.is_ok() || pending.len() == 1 {
+            for (ops, reply) in pending {
+                let result = result
+                    .as_ref()
+                    .map_err(|e| fs_err(op_path(&ops), "Writing", syscall::Error::new(e.errno)));
+                let _ = reply.send(result.copied());
+            }
+            continue;
+        }
+        // nothing was committed, so find the batch that failed
+        for (ops, reply) in pending {
+            let result = fs.tx(|tx| apply_ops(tx, &ops));
+            let _ = reply.send(result.map_err(|e| fs_err(op_path(&ops), "Writing", e)));
+        }
+    }
+}
+
+fn op_path(ops: &[ImageOp]) -> &Path {
+    match ops.first() {
+        Some(
+            ImageOp::File { path, .. } | ImageOp::Symlink { path, .. } | ImageOp::Remove { path },
+        ) => path,
+        None => Path::new(""),
+    }
+}
+
+fn apply_ops<D: Disk>(tx: &mut Transaction<D>, ops: &[ImageOp]) -> syscall::Result<()> {
+    let (time, time_nsec) = now();
+    for op in ops {
+        match op {
+            ImageOp::File { path, perm, data } => {
+                write_node(tx, path, Node::MODE_FILE | perm, data, time, time_nsec)?
+            }
+            ImageOp::Symlink { path, target } => write_node(
+                tx,
+                path,
+                Node::MODE_SYMLINK | 0o777,
+                target,
+                time,
+                time_nsec,
+            )?,
+            ImageOp::Remove { path } => {
+                let Some(parent) = path.parent() else {
+                    continue;
+                };
+                let Some(dir) = resolve(tx, parent, false, 0)? else {
+                    continue;
+                };
+                let name = file_name(path)?;
+                if let Some(node) = find(tx, dir.ptr(), name)?
+                    && !node.data().is_dir()
+                {
+                    tx.remove_node(dir.ptr(), name, node.data().mode() & Node::MODE_TYPE)?;
+                }
+            }
+        }
+    }
+    Ok(())
+}
+
+/// Replace whatever is at `path` with a new node holding `data`.
+fn write_node<D: Disk>(
+    tx: &mut Transaction<D>,
+    path: &Path,
+    mode: u16,
+    data: &[u8],
+    time: u64,
+    time_nsec: u32,
+) -> syscall::Result<()> {
+    let parent = path.parent().unwrap_or(Path::new(""));
+    let dir = resolve(tx, parent, true, 0)?.ok_or(syscall::Error::new(ENOENT))?;
+    let name = file_name(path)?;
+    if let Some(node) = find(tx, dir.ptr(), name)? {
+        if node.data().is_dir() {
+            return Err(syscall::Error::new(EISDIR));
+        }
+        tx.remove_node(dir.ptr(), name, node.data().mode() & Node::MODE_TYPE)?;
+    }
+    let node = tx.create_node(dir.ptr(), name, mode, time, time_nsec)?;
+    let mut offset = 0;
+    while offset < data.len() {
+        let written = tx.write_node(node.ptr(), offset as u64, &data[offset..], time, time_nsec)?;
+        if written == 0 {
+            return Err(syscall::Error::new(ENOSPC));
+        }
+        offset += written;
+    }
+    Ok(())
+}
+
+fn file_name(path: &Path) -> syscall::Result<&str> {
+    path.file_name()
+        .and_then(|name| name.to_str())
+        .ok_or(syscall::Error::new(ENOENT))
+}
+
+fn find<D: Disk>(
+    tx: &mut Transaction<D>,
+    parent: TreePtr<Node>,
+    name: &str,
+) -> syscall::Result<Option<TreeData<Node>>> {
+    match tx.find_node(parent, name) {
+        Ok(node) => Ok(Some(node)),
+        Err(e) if e.errno == ENOENT => Ok(None),
+        Err(e) => Err(e),
+    }
+}
+
+fn read_data<D: Disk>(tx: &mut Transaction<D>, node: &TreeData<Node>) -> syscall::Result<Vec<u8>> {
+    let (time, time_nsec) = now();
+    let mut data = vec![0; node.data().size() as usize];
+    let mut offset = 0;
+    while offset < data.len() {
+        let read = tx.read_node(
+            node.ptr(),
+            offset as u64,
+            &mut data[offset..],
+            time,
+            time_nsec,
+        )?;
+        if read == 0 {
+            data.truncate(offset);
+            break;
+        }
+        offset += read;
+    }
+    Ok(data)
+}
+
+/// Find the dir at `path` from the image root, following symlinks such as
+/// `lib -> usr/lib`, and creating missing dirs if `create` is set.
+fn resolve<D: Disk>(
+    tx: &mut Transaction<D>,
+    path: &Path,
+    create: bool,
+    links: usize,
+) -> syscall::Result<Option<TreeData<Node>>> {
+    let (time, time_nsec) = now();
+    let mut node = tx.read_tree(TreePtr::root())?;
+    let mut walked = PathBuf::new();
+    for component in path.components() {
+        let Component::Normal(name) = component else {
+            continue;
+        };
+        let name = name.to_str().ok_or(syscall::Error::new(ENOENT))?;
+        node = match find(tx, node.ptr(), name)? {
+            Some(child) if child.data().is_dir() => child,
+            Some(child) if child.data().is_symlink() => {
+                if links >= MAX_LINKS {
+                    return Err(syscall::Error::new(ELOOP));
+                }
+                let target = PathBuf::from(OsString::from_vec(read_data(tx, &child)?));
+                let target = normalize(&walked.join(target));
+                let Some(dir) = resolve(tx, &target, create, links + 1)? else {
+                    return Ok(None);
+                };
+                node = dir;
+                walked = target;
+                continue;
+            }
+            Some(_) => return Err(syscall::Error::new(ENOTDIR)),
+            None if create => {
+                tx.create_node(node.ptr(), name, Node::MODE_DIR | 0o755, time, time_nsec)?
+            }
+            None => return Ok(None),
+        };
+        walked.push(name);
+    }
+    Ok(Some(node))
+}
+
+/// Resolve `.` and `..` without touching the image, an absolute path is
+/// taken from the image root.
+fn normalize(path: &Path) -> PathBuf {
+    let mut normal = PathBuf::new();
+    for component in path.components() {
+        match component {
+            Component::Normal(name) => normal.push(name),
+            Component::ParentDir => {
+                normal.pop();
+            }
+            Component::RootDir => normal = PathBuf::new(),
+            Component::CurDir | Component::Prefix(_) => {}
+        }
+    }
+    normal
+}
+
+/// Copy the files below `dir` in the image into `local`.
+fn copy_out<D: Disk>(
+    tx: &mut Transaction<D>,
+    dir: TreeData<Node>,
+    local: &Path,
+) -> syscall::Result<()> {
+    let to_syscall = |e: std::io::Error| syscall::Error::new(e.raw_os_error().unwrap_or(EIO));
+    fs::create_dir_all(local).map_err(to_syscall)?;
+    let mut children = Vec::new();
+    tx.child_nodes(dir.ptr(), &mut children)?;
+    for child in children {
+        let Some(name) = child.name().map(str::to_string) else {
+            continue;
+        };
+        let node = tx.read_tree(child.node_ptr())?;
+        if node.data().is_dir() {
+            copy_out(tx, node, &local.join(&name))?;
+        } else if node.data().is_file() {
+            let data = read_data(tx, &node)?;
+            fs::write(local.join(&name), data).map_err(to_syscall)?;
+        }
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn normalize_link_targets() {
+        assert_eq!(normalize(Path::new("usr/lib")), PathBuf::from("usr/lib"));
+        assert_eq!(
+            normalize(Path::new("bin/../usr/./bin")),
+            PathBuf::from("usr/bin")
+        );
+        assert_eq!(normalize(Path::new("etc/../../x")), PathBuf::from("x"));
+        assert_eq!(
+            normalize(Path::new("usr/lib//usr/bin")),
+            PathBuf::from("usr/lib/usr/bin")
+        );
+        assert_eq!(
+            normalize(&Path::new("usr").join("/lib")),
+            PathBuf::from("lib")
+        );
+    }
+}
@@ -0,0 +1,239 @@
+//! Leveled, buffered logging for fetch and cook.
+//!
+//! Each cook thread owns a [`Logger`] for the recipe it works on. Messages are
+//! formatted straight into the logger's buffer and handed to its sink in large
+//! chunks, so logging costs no syscall per line. Without a logger, lines go to
+//! stderr with one write each.
+
+use std::cell::RefCell;
+use std::fmt;
+use std::io::Write;
+use std::sync::atomic::{AtomicU8, Ordering};
+use std::sync::{Arc, Mutex};
+
+use crate::cook::pty::{PtyOut, PtyReader};
+
+/// Buffered bytes that trigger a write to the sink.
+const FLUSH_THRESHOLD: usize = 16 * 1024;
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord)]
+pub enum Level {
+    Error,
+    Warning,
+    Info,
+    Debug,
+}
+
+impl Level {
+    /// Most detailed level shown, debug messages only with `verbose`.
+    pub fn max_for(verbose: bool) -> Self {
+        if verbose { Level::Debug } else { Level::Info }
+    }
+}
+
+impl fmt::Display for Level {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.write_str(match self {
+            Level::Error => "ERROR",
+            Level::Warning => "WARNING",
+            Level::Info => "INFO",
+            Level::Debug => "DEBUG",
+        })
+    }
+}
+
+/// Receives whole log lines, in order.
+pub type LogSink = Box<dyn FnMut(&[u8]) + Send>;
+
+struct LoggerState {
+    buf: Vec<u8>,
+    phase: &'static str,
+    sink: LogSink,
+}
+
+impl LoggerState {
+    fn flush(&mut self) {
+        if !self.buf.is_empty() {
+            (self.sink)(&self.buf);
+            self.buf.clear();
+        }
+    }
+}
+
+/// Log of one recipe, written as `LEVEL recipe/phase: message` lines.
+pub struct Logger {
+    recipe: String,
+    max_level: Level,
+    state: Mutex<LoggerState>,
+    pty: Option<Arc<PtyReader>>,
+}
+
+impl Logger {
+    pub fn new(recipe: impl Into<String>, sink: LogSink) -> Self {
+        Self {
+            recipe: recipe.into(),
+            max_level: Level::Debug,
+            state: Mutex::new(LoggerState {
+                buf: Vec::with_capacity(FLUSH_THRESHOLD),
+                phase: "",
+                sink,
+            }),
+            pty: None,
+        }
+    }
+
+    /// Drop messages less severe than `level`.
+    pub fn with_max_level(mut self, level: Level) -> Self {
+        self.max_level = level;
+        self
+    }
+
+    /// Also drain this pty into the sink on [`Logger::flush`], so command
+    /// output and log lines are both complete when the flush returns.
+    pub fn with_pty(mut self, pty: Arc<PtyReader>) -> Self {
+        self.pty = Some(pty);
+        self
+    }
+
+    pub fn set_phase(&self, phase: &'static str) {
+        self.state.lock().unwrap().phase = phase;
+    }
+
+    pub fn log(&self, level: Level, args: fmt::Arguments) {
+        if level > self.max_level {
+            return;
+        }
+        let mut state = self.state.lock().unwrap();
+        let state = &mut *state;
+        let _ = if state.phase.is_empty() {
+            write!(state.buf, "{level} {}: ", self.recipe)
+        } else {
+            write!(state.buf, "{level} {}/{}: ", self.recipe, state.phase)
+        };
+        let _ = state.buf.write_fmt(args);
+        state.buf.push(b'\n');
+        // problems should show up right away
+        if state.buf.len() >= FLUSH_THRESHOLD || level <= Level::Warning {
+            state.flush();
+        }
+    }
+
+    /// Hand everything logged so far, and any pending pty output, to the sink.
+    pub fn flush(&self) {
+        let mut state = self.state.lock().unwrap();
+        state.flush();
+        if let Some(pty) = &self.pty {
+            pty.drain(&mut |buf| (state.sink)(buf));
+        }
+    }
+}
+
+impl Drop for Logger {
+    fn drop(&mut self) {
+        if let Ok(state) = self.state.get_mut() {
+            state.flush();
+        }
+    }
+}
+
+static STDERR_MAX_LEVEL: AtomicU8 = AtomicU8::new(Level::Debug as u8);
+
+/// Drop stderr lines less severe than `level`.
+pub fn set_stderr_max_level(level: Level) {
+    STDERR_MAX_LEVEL.store(level as u8, Ordering::Relaxed);
+}
+
+thread_local! {
+    static STDERR_BUF: RefCell<Vec<u8>> = const { RefCell::new(Vec::new()) };
+}
+
+/// Write one line to stderr with a single write call.
+pub fn log_stderr(level: Level, args: fmt::Arguments) {
+    if level as u8 > STDERR_MAX_LEVEL.load(Ordering::Relaxed) {
+        return;
+    }
+    STDERR_BUF.with_borrow_mut(|buf| {
+        buf.clear();
+        let _ = write!(buf, "{level}: ");
+        let _ = buf.write_fmt(args);
+        buf.push(b'\n');
+        let _ = std::io::stderr().write_all(buf);
+    });
+}
+
+/// Log to the recipe logger if there is one, otherwise to stderr.
+pub fn log(logger: &PtyOut, level: Level, args: fmt::Arguments) {
+    match logger {
+        Some((_, logger)) => logger.log(level, args),
+        None => log_stderr(level, args),
+    }
+}
+
+pub fn set_phase(logger: &PtyOut, phase: &'static str) {
+    if let Some((_, logger)) = logger {
+        logger.set_phase(phase);
+    }
+}
+
+macro_rules! log_warn {
+    ($logger:expr, $($arg:tt)+) => {
+        $crate::cook::log::log($logger, $crate::cook::log::Level::Warning, format_args!($($arg)+))
+    };
+}
+
+macro_rules! log_info {
+    ($logger:expr, $($arg:tt)+) => {
+        $crate::cook::log::log($logger, $crate::cook::log::Level::Info, format_args!($($arg)+))
+    };
+}
+
+macro_rules! log_debug {
+    ($logger:expr, $($arg:tt)+) => {
+        $crate::cook::log::log($logger, $crate::cook::log::Level::Debug, format_args!($($arg)+))
+    };
+}
+
+pub(crate) use {log_debug, log_info, log_warn};
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn buffers_until_flush() {
+        let out = Arc::new(Mutex::new(Vec::new()));
+        let sink_out = out.clone();
+        let logger = Logger::new(
+            "gears",
+            Box::new(move |buf: &[u8]| sink_out.lock().unwrap().extend_from_slice(buf)),
+        );
+        logger.log(Level::Debug, format_args!("a {}", 1));
+        logger.set_phase("build");
+        logger.log(Level::Info, format_args!("b"));
+        assert!(out.lock().unwrap().is_empty());
+
+        logger.flush();
+        assert_eq!(
+            String::from_utf8(out.lock().unwrap().clone()).unwrap(),
+            "DEBUG gears: a 1\nINFO gears/build: b\n"
+        );
+
+        // warnings are not held back
+        logger.log(Level::Warning, format_args!("c"));
+        assert!(out.lock().unwrap().ends_with(b"WARNING gears/build: c\n"));
+    }
+
+    #[test]
+    fn filters_levels() {
+        let out = Arc::new(Mutex::new(Vec::new()));
+        let sink_out = out.clone();
+        let logger = Logger::new(
+            "gears",
+            Box::new(move |buf: &[u8]| sink_out.lock().unwrap().extend_from_slice(buf)),
+        )
+        .with_max_level(Level::Info);
+        logger.log(Level::Debug, format_args!("hidden"));
+        logger.flush();
+        assert!(out.lock().unwrap().is_empty());
+    }
+}
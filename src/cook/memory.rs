@@ -0,0 +1,301 @@
+//! Memory accounting for concurrent recipe builds.
+//!
+//! The peak memory of each build script, summed over its whole process tree,
+//! is recorded in `build/peak_memory.toml`. When several builds run at once,
+//! [`MemoryBudget`] holds a recipe back until its expected peak fits next to
+//! the ones already running, and a build started while the system is under
+//! memory pressure gets fewer make jobs instead of running into the OOM killer.
+//! Builds only run at once when cooking with `--targets`; the other drivers
+//! build one recipe at a time and don't use the budget.
+
+use std::collections::BTreeMap;
+use std::fs;
+use std::path::Path;
+use std::sync::Mutex;
+use std::sync::mpsc::{self, RecvTimeoutError, Sender};
+use std::thread::{self, JoinHandle};
+use std::time::Duration;
+
+use crate::cook::metrics;
+use crate::cook::pty::PtyOut;
+use crate::log_warn;
+use crate::recipe::CookRecipe;
+
+pub(crate) const MIB: u64 = 1024 * 1024;
+
+/// Expected peak of a recipe that has neither history nor a hint.
+const DEFAULT_PEAK: u64 = 512 * MIB;
+
+const HISTORY_PATH: &str = "build/peak_memory.toml";
+
+/// Serializes read-modify-write of history files between build threads.
+static HISTORY_LOCK: Mutex<()> = Mutex::new(());
+
+/// How often the process tree of a build script is sampled.
+const SAMPLE_INTERVAL: Duration = Duration::from_millis(500);
+
+fn history_key(recipe: &CookRecipe) -> String {
+    format!("{}/{}", recipe.target, recipe.name.name())
+}
+
+fn read_history(path: &Path) -> BTreeMap<String, u64> {
+    fs::read_to_string(path)
+        .ok()
+        .and_then(|s| toml::from_str(&s).ok())
+        .unwrap_or_default()
+}
+
+/// Last size in bytes recorded for `recipe` in the history file at `path`.
+pub(crate) fn recorded(path: &str, recipe: &CookRecipe) -> Option<u64> {
+    let mib = *read_history(Path::new(path)).get(&history_key(recipe))?;
+    Some(mib * MIB)
+}
+
+/// Record a size in bytes for `recipe` in the history file at `path`, rounded
+/// up to MiB. Failing to write a history only costs accuracy of the next
+/// estimate, so it is not an error.
+pub(crate) fn record(path: &str, recipe: &CookRecipe, bytes: u64) {
+    let _guard = HISTORY_LOCK.lock().unwrap();
+    let path = Path::new(path);
+    let mut history = read_history(path);
+    history.insert(history_key(recipe), bytes.div_ceil(MIB));
+    if let Ok(content) = toml::to_string(&history) {
+        let tmp = path.with_extension("toml.tmp");
+        if fs::write(&tmp, content).is_ok() {
+            let _ = fs::rename(&tmp, path);
+        }
+    }
+}
+
+/// Expected peak memory in bytes of building `recipe`: the last recorded peak,
+/// else the `peak-memory` hint (in MiB) from its recipe.toml.
+pub fn expected_peak(recipe: &CookRecipe) -> u64 {
+    if let Some(peak) = recorded(HISTORY_PATH, recipe) {
+        return peak;
+    }
+    match recipe.recipe.build.peak_memory {
+        Some(mib) => mib * MIB,
+        None => DEFAULT_PEAK,
+    }
+}
+
+/// Remember the measured peak of building `recipe`.
+pub fn record_peak(recipe: &CookRecipe, peak: u64) {
+    if peak > 0 {
+        record(HISTORY_PATH, recipe, peak);
+    }
+}
+
+/// Memory reserved by the builds that are running.
+pub struct MemoryBudget {
+    /// in bytes, 0 for no limit
+    limit: u64,
+    reserved: u64,
+    running: usize,
+}
+
+impl MemoryBudget {
+    pub fn new(limit: u64) -> Self {
+        Self {
+            limit,
+            reserved: 0,
+            running: 0,
+        }
+    }
+
+    /// Whether a build expected to peak at `need` may start now. A build that
+    /// doesn't fit the budget at all still runs once nothing else does.
+    pub fn admits(&self, need: u64) -> bool {
+        self.limit == 0 || self.running == 0 || self.reserved + need <= self.limit
+    }
+
+    pub fn reserve(&mut self, need: u64) {
+        self.reserved += need;
+        self.running += 1;
+    }
+
+    pub fn release(&mut self, need: u64) {
+        self.reserved -= need;
+        self.running -= 1;
+    }
+
+    /// Make jobs for a build expected to peak at `need`, scaled down if it
+    /// is larger than the whole budget.
+    pub fn jobs_for(&self, need: u64, jobs: usize) -> usize {
+        if self.limit == 0 || need <= self.limit {
+            return jobs;
+        }
+        ((jobs as u128 * self.limit as u128 / need as u128) as usize).max(1)
+    }
+}
+
+/// Total memory of the system in bytes, from `/proc/meminfo`.
+pub fn total_memory() -> Option<u64> {
+    let meminfo = fs::read_to_string("/proc/meminfo").ok()?;
+    let line = meminfo.lines().find(|l| l.starts_with("MemTotal:"))?;
+    let kib: u64 = line.split_whitespace().nth(1)?.parse().ok()?;
+    Some(kib * 1024)
+}
+
+/// The `some avg10` value of a PSI file: percentage of the last ten seconds
+/// in which at least one task was stalled on memory.
+fn parse_pressure(psi: &str) -> Option<f32> {
+    let line = psi.lines().find(|l| l.starts_with("some "))?;
+    let avg10 = line
+        .split_whitespace()
+        .find_map(|f| f.strip_prefix("avg10="))?;
+    avg10.parse().ok()
+}
+
+/// Memory pressure from `/proc/pressure/memory`, if the kernel provides it.
+pub fn pressure() -> Option<f32> {
+    parse_pressure(&fs::read_to_string("/proc/pressure/memory").ok()?)
+}
+
+fn jobs_at_pressure(jobs: usize, pressure: f32) -> usize {
+    if pressure >= 40.0 {
+        1
+    } else if pressure >= 10.0 {
+        (jobs / 2).max(1)
+    } else {
+        jobs
+    }
+}
+
+/// Make jobs to start a build with, halved while the system is stalling on
+/// memory and down to one when it is thrashing.
+pub fn jobs_under_pressure(jobs: usize, logger: &PtyOut) -> usize {
+    let Some(pressure) = pressure() else {
+        return jobs;
+    };
+    let reduced = jobs_at_pressure(jobs, pressure);
+    if reduced < jobs {
+        log_warn!(
+            logger,
+            "memory pressure at {pressure:.1}%, building with {reduced} jobs instead of {jobs}"
+        );
+    }
+    reduced
+}
+
+/// Resident memory in bytes and CPU time in seconds of `pid` and all of its
+/// descendants. CPU time includes descendants that already exited.
+#[cfg(target_os = "linux")]
+fn tree_usage(pid: u32) -> (u64, f64) {
+    let page_size = unsafe { libc::sysconf(libc::_SC_PAGESIZE) }.max(0) as u64;
+    let clock_ticks = unsafe { libc::sysconf(libc::_SC_CLK_TCK) }.max(1) as f64;
+    let Ok(entries) = fs::read_dir("/proc") else {
+        return (0, 0.0);
+    };
+    // (pid, ppid, rss pages, cpu ticks) of every process
+    let mut procs = Vec::new();
+    for entry in entries.flatten() {
+        let Some(pid) = entry
+            .file_name()
+            .to_str()
+            .and_then(|s| s.parse::<u32>().ok())
+        else {
+            continue;
+        };
+        let Ok(stat) = fs::read_to_string(entry.path().join("stat")) else {
+            continue;
+        };
+        // comm may contain spaces and parentheses, fields follow the last ')'
+        let Some((_, fields)) = stat.rsplit_once(')') else {
+            continue;
+        };
+        let fields: Vec<u64> = fields
+            .split_whitespace()
+            .skip(1)
+            .map(|f| f.parse().unwrap_or(0))
+            .collect();
+        if fields.len() > 20 {
+            // utime, stime, and both for waited-for children
+            let ticks = fields[10] + fields[11] + fields[12] + fields[13];
+            procs.push((pid, fields[0] as u32, fields[20], ticks));
+        }
+    }
+    let mut tree = vec![pid];
+    let (mut rss, mut ticks) = (0, 0);
+    let mut i = 0;
+    while let Some(&parent) = tree.get(i) {
+        for &(pid, ppid, pid_rss, pid_ticks) in &procs {
+            if pid == parent {
+                rss += pid_rss;
+                ticks += pid_ticks;
+            } else if ppid == parent {
+                tree.push(pid);
+            }
+        }
+        i += 1;
+    }
+    (rss * page_size, ticks as f64 / clock_ticks)
+}
+
+#[cfg(not(target_os = "linux"))]
+fn tree_usage(_pid: u32) -> (u64, f64) {
+    (0, 0.0)
+}
+
+/// Samples the memory of a process tree in the background, and publishes
+/// each sample as a running build in [`metrics`].
+pub struct PeakWatch {
+    stop: Sender<()>,
+    thread: JoinHandle<u64>,
+}
+
+impl PeakWatch {
+    pub fn start(pid: u32, label: String) -> Self {
+        let (stop, stopped) = mpsc::channel();
+        let thread = thread::spawn(move || {
+            let mut peak = 0;
+            loop {
+                let (rss, cpu_seconds) = tree_usage(pid);
+                peak = peak.max(rss);
+                metrics::update_build(pid, &label, rss, cpu_seconds);
+                match stopped.recv_timeout(SAMPLE_INTERVAL) {
+                    Err(RecvTimeoutError::Timeout) => continue,
+                    _ => break,
+                }
+            }
+            metrics::end_build(pid);
+            peak
+        });
+        Self { stop, thread }
+    }
+
+    /// Highest memory seen, in bytes.
+    pub fn finish(self) -> u64 {
+        let _ = self.stop.send(());
+        self.thread.join().unwrap_or(0)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn budget_holds_back_heavy_builds() {
+        let mut budget = MemoryBudget::new(4 * MIB);
+        assert!(budget.admits(8 * MIB));
+        budget.reserve(3 * MIB);
+        assert!(budget.admits(MIB));
+        assert!(!budget.admits(2 * MIB));
+        budget.release(3 * MIB);
+        assert!(budget.admits(8 * MIB));
+        assert_eq!(budget.jobs_for(8 * MIB, 16), 8);
+        assert_eq!(budget.jobs_for(64 * MIB, 4), 1);
+        assert_eq!(MemoryBudget::new(0).jobs_for(8 * MIB, 16), 16);
+    }
+
+    #[test]
+    fn pressure_reduces_jobs() {
+        let psi = "some avg10=12.50 avg60=3.00 avg300=0.50 total=123456\n\
+                   full avg10=1.00 avg60=0.00 avg300=0.00 total=1234\n";
+        assert_eq!(parse_pressure(psi), Some(12.5));
+        assert_eq!(jobs_at_pressure(16, 12.5), 8);
+        assert_eq!(jobs_at_pressure(16, 55.0), 1);
+        assert_eq!(jobs_at_pressure(16, 0.2), 16);
+    }
+}
@@ -0,0 +1,446 @@
+//! Live metrics of a cook run.
+//!
+//! Recipe states, phase latencies, fetched and extracted bytes, sysroot cache
+//! hits and the resource use of running build scripts are collected here as
+//! the run goes. With `metrics` set in cookbook.toml or `COOKBOOK_METRICS`,
+//! [`serve`] answers HTTP requests on a loopback `host:port` or on
+//! `unix:<path>`: `/metrics` in the Prometheus text format, `/metrics.json`
+//! with the same snapshot as JSON.
+
+use std::collections::BTreeMap;
+use std::fmt::Write as _;
+use std::io::{BufRead, BufReader, Read, Write};
+use std::net::{SocketAddr, TcpListener};
+use std::os::unix::fs::FileTypeExt;
+use std::os::unix::net::UnixListener;
+use std::path::Path;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{LazyLock, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+
+use serde::Serialize;
+
+use crate::{Result, bail_other_err, wrap_io_err};
+
+#[derive(Clone, Copy)]
+pub enum RecipeState {
+    Pending,
+    Fetching,
+    Cooking,
+    Done,
+    Cached,
+    Failed,
+}
+
+impl RecipeState {
+    const ALL: [RecipeState; 6] = [
+        RecipeState::Pending,
+        RecipeState::Fetching,
+        RecipeState::Cooking,
+        RecipeState::Done,
+        RecipeState::Cached,
+        RecipeState::Failed,
+    ];
+
+    fn as_str(&self) -> &'static str {
+        match self {
+            RecipeState::Pending => "pending",
+            RecipeState::Fetching => "fetching",
+            RecipeState::Cooking => "cooking",
+            RecipeState::Done => "done",
+            RecipeState::Cached => "cached",
+            RecipeState::Failed => "failed",
+        }
+    }
+}
+
+#[derive(Clone, Copy)]
+pub enum Phase {
+    Fetch,
+    Build,
+    Package,
+}
+
+impl Phase {
+    const ALL: [Phase; 3] = [Phase::Fetch, Phase::Build, Phase::Package];
+
+    fn as_str(&self) -> &'static str {
+        match self {
+            Phase::Fetch => "fetch",
+            Phase::Build => "build",
+            Phase::Package => "package",
+        }
+    }
+}
+
+#[derive(Clone, Copy)]
+pub enum Counter {
+    /// bytes of source tarballs downloaded
+    BytesFetched,
+    /// bytes of source tarballs extracted
+    BytesExtracted,
+    /// sysroot or toolchain dirs reused by `build_deps_dir`
+    SysrootHits,
+    /// sysroot or toolchain dirs installed again by `build_deps_dir`
+    SysrootMisses,
+}
+
+impl Counter {
+    const ALL: [Counter; 4] = [
+        Counter::BytesFetched,
+        Counter::BytesExtracted,
+        Counter::SysrootHits,
+        Counter::SysrootMisses,
+    ];
+
+    fn as_str(&self) -> &'static str {
+        match self {
+            Counter::BytesFetched => "fetched_bytes",
+            Counter::BytesExtracted => "extracted_bytes",
+            Counter::SysrootHits => "sysroot_cache_hits",
+            Counter::SysrootMisses => "sysroot_cache_misses",
+        }
+    }
+
+    fn help(&self) -> &'static str {
+        match self {
+            Counter::BytesFetched => "Bytes of source tarballs downloaded.",
+            Counter::BytesExtracted => "Bytes of source tarballs extracted.",
+            Counter::SysrootHits => "Sysroot and toolchain dirs reused as they were.",
+            Counter::SysrootMisses => "Sysroot and toolchain dirs installed from dependencies.",
+        }
+    }
+}
+
+/// Upper bounds in seconds of the phase latency histogram buckets.
+const BUCKETS: [f64; 10] = [0.1, 0.5, 1.0, 5.0, 15.0, 60.0, 300.0, 900.0, 1800.0, 3600.0];
+
+#[derive(Clone, Serialize)]
+pub struct Histogram {
+    /// cumulative count of each bucket in [`BUCKETS`], without `+Inf`
+    buckets: Vec<u64>,
+    sum: f64,
+    count: u64,
+}
+
+impl Default for Histogram {
+    fn default() -> Self {
+        Self {
+            buckets: vec![0; BUCKETS.len()],
+            sum: 0.0,
+            count: 0,
+        }
+    }
+}
+
+impl Histogram {
+    fn observe(&mut self, seconds: f64) {
+        for (bucket, le) in self.buckets.iter_mut().zip(BUCKETS) {
+            if seconds <= le {
+                *bucket += 1;
+            }
+        }
+        self.sum += seconds;
+        self.count += 1;
+    }
+}
+
+#[derive(Clone, Serialize)]
+pub struct RunningBuild {
+    /// `<target>/<recipe>`
+    recipe: String,
+    pid: u32,
+    rss_bytes: u64,
+    cpu_seconds: f64,
+}
+
+struct Metrics {
+    started: Instant,
+    counters: [AtomicU64; Counter::ALL.len()],
+    /// by (recipe, target)
+    recipes: Mutex<BTreeMap<(String, String), RecipeState>>,
+    phases: Mutex<[Histogram; Phase::ALL.len()]>,
+    /// by pid of the build script
+    builds: Mutex<BTreeMap<u32, RunningBuild>>,
+}
+
+static METRICS: LazyLock<Metrics> = LazyLock::new(|| Metrics {
+    started: Instant::now(),
+    counters: Default::default(),
+    recipes: Mutex::new(BTreeMap::new()),
+    phases: Mutex::new(Default::default()),
+    builds: Mutex::new(BTreeMap::new()),
+});
+
+pub fn add(counter: Counter, value: u64) {
+    METRICS.counters[counter as usize].fetch_add(value, Ordering::Relaxed);
+}
+
+pub fn set_state(recipe: &str, target: &str, state: RecipeState) {
+    METRICS
+        .recipes
+        .lock()
+        .unwrap()
+        .insert((recipe.to_string(), target.to_string()), state);
+}
+
+/// Latency of one phase of one recipe, recorded when dropped.
+pub struct PhaseTimer {
+    phase: Phase,
+    started: Instant,
+}
+
+impl Drop for PhaseTimer {
+    fn drop(&mut self) {
+        let seconds = self.started.elapsed().as_secs_f64();
+        METRICS.phases.lock().unwrap()[self.phase as usize].observe(seconds);
+    }
+}
+
+pub fn time_phase(phase: Phase) -> PhaseTimer {
+    PhaseTimer {
+        phase,
+        started: Instant::now(),
+    }
+}
+
+pub fn update_build(pid: u32, recipe: &str, rss_bytes: u64, cpu_seconds: f64) {
+    METRICS.builds.lock().unwrap().insert(
+        pid,
+        RunningBuild {
+            recipe: recipe.to_string(),
+            pid,
+            rss_bytes,
+            cpu_seconds,
+        },
+    );
+}
+
+pub fn end_build(pid: u32) {
+    METRICS.builds.lock().unwrap().remove(&pid);
+}
+
+#[derive(Serialize)]
+pub struct Snapshot {
+    uptime_seconds: f64,
+    /// number of recipes in each state
+    recipes: BTreeMap<&'static str, usize>,
+    /// latency of each phase
+    phases: BTreeMap<&'static str, Histogram>,
+    counters: BTreeMap<&'static str, u64>,
+    builds: Vec<RunningBuild>,
+}
+
+pub fn snapshot() -> Snapshot {
+    let metrics = &*METRICS;
+    let mut recipes: BTreeMap<_, _> = RecipeState::ALL.iter().map(|s| (s.as_str(), 0)).collect();
+    for state in metrics.recipes.lock().unwrap().values() {
+        *recipes.entry(state.as_str()).or_default() += 1;
+    }
+    let phases = metrics.phases.lock().unwrap();
+    Snapshot {
+        uptime_seconds: metrics.started.elapsed().as_secs_f64(),
+        recipes,
+        phases: Phase::ALL
+            .iter()
+            .map(|p| (p.as_str(), phases[*p as usize].clone()))
+            .collect(),
+        counters: Counter::ALL
+            .iter()
+            .map(|c| {
+                let value = metrics.counters[*c as usize].load(Ordering::Relaxed);
+                (c.as_str(), value)
+            })
+            .collect(),
+        builds: metrics.builds.lock().unwrap().values().cloned().collect(),
+    }
+}
+
+/// Prometheus text exposition format of a snapshot.
+pub fn prometheus(snapshot: &Snapshot) -> String {
+    let mut out = String::new();
+    let _ = writeln!(
+        out,
+        "# HELP cookbook_uptime_seconds Time since the run started."
+    );
+    let _ = writeln!(out, "# TYPE cookbook_uptime_seconds gauge");
+    let _ = writeln!(out, "cookbook_uptime_seconds {}", snapshot.uptime_seconds);
+
+    let _ = writeln!(out, "# HELP cookbook_recipes Recipes in each state.");
+    let _ = writeln!(out, "# TYPE cookbook_recipes gauge");
+    for (state, count) in &snapshot.recipes {
+        let _ = writeln!(out, "cookbook_recipes{{state=\"{state}\"}} {count}");
+    }
+
+    let _ = writeln!(
+        out,
+        "# HELP cookbook_phase_seconds Latency of recipe phases."
+    );
+    let _ = writeln!(out, "# TYPE cookbook_phase_seconds histogram");
+    for (phase, histogram) in &snapshot.phases {
+        for (i, le) in BUCKETS.iter().enumerate() {
+            let count = histogram.buckets[i];
+            let _ = writeln!(
+                out,
+                "cookbook_phase_seconds_bucket{{phase=\"{phase}\",le=\"{le}\"}} {count}"
+            );
+        }
+        let _ = writeln!(
+            out,
+            "cookbook_phase_seconds_bucket{{phase=\"{phase}\",le=\"+Inf\"}} {}",
+            histogram.count
+        );
+        let _ = writeln!(
+            out,
+            "cookbook_phase_seconds_sum{{phase=\"{phase}\"}} {}",
+            histogram.sum
+        );
+        let _ = writeln!(
+            out,
+            "cookbook_phase_seconds_count{{phase=\"{phase}\"}} {}",
+            histogram.count
+        );
+    }
+
+    for counter in Counter::ALL {
+        let name = counter.as_str();
+        let value = snapshot.counters.get(name).copied().unwrap_or(0);
+        let _ = writeln!(out, "# HELP cookbook_{name}_total {}", counter.help());
+        let _ = writeln!(out, "# TYPE cookbook_{name}_total counter");
+        let _ = writeln!(out, "cookbook_{name}_total {value}");
+    }
+
+    let _ = writeln!(
+        out,
+        "# HELP cookbook_build_rss_bytes Resident memory of running build scripts."
+    );
+    let _ = writeln!(out, "# TYPE cookbook_build_rss_bytes gauge");
+    for build in &snapshot.builds {
+        let _ = writeln!(
+            out,
+            "cookbook_build_rss_bytes{{recipe=\"{}\"}} {}",
+            build.recipe, build.rss_bytes
+        );
+    }
+    let _ = writeln!(
+        out,
+        "# HELP cookbook_build_cpu_seconds CPU time used by running build scripts."
+    );
+    let _ = writeln!(out, "# TYPE cookbook_build_cpu_seconds gauge");
+    for build in &snapshot.builds {
+        let _ = writeln!(
+            out,
+            "cookbook_build_cpu_seconds{{recipe=\"{}\"}} {}",
+            build.recipe, build.cpu_seconds
+        );
+    }
+    out
+}
+
+/// Answer one HTTP request.
+fn respond(stream: impl Read + Write) {
+    let mut reader = BufReader::new(stream);
+    let mut request = String::new();
+    if reader.read_line(&mut request).is_err() {
+        return;
+    }
+    // skip headers, the request has no body
+    let mut header = String::new();
+    while reader.read_line(&mut header).is_ok_and(|n| n > 0) && !header.trim_end().is_empty() {
+        header.clear();
+    }
+
+    let path = request.split_whitespace().nth(1).unwrap_or("");
+    let (status, content_type, body) = match path {
+        "/metrics" => (
+            "200 OK",
+            "text/plain; version=0.0.4",
+            prometheus(&snapshot()),
+        ),
+        "/metrics.json" => (
+            "200 OK",
+            "application/json",
+            serde_json::to_string(&snapshot()).unwrap_or_default(),
+        ),
+        _ => ("404 Not Found", "text/plain", "not found\n".to_string()),
+    };
+    let _ = write!(
+        reader.get_mut(),
+        "HTTP/1.1 {status}\r\nContent-Type: {content_type}\r\n\
+         Content-Length: {}\r\nConnection: close\r\n\r\n{body}",
+        body.len()
+    );
+}
+
+/// Serve metrics on `addr` in a background thread, see the module docs.
+pub fn serve(addr: &str) -> Result<()> {
+    let timeout = Some(Duration::from_secs(5));
+    if let Some(path) = addr.strip_prefix("unix:") {
+        let path = Path::new(path);
+        // a socket left by an earlier run, but never a file given by mistake
+        if std::fs::symlink_metadata(path).is_ok_and(|meta| meta.file_type().is_socket()) {
+            let _ = std::fs::remove_file(path);
+        }
+        let listener =
+            UnixListener::bind(path).map_err(wrap_io_err!(path, "Binding metrics socket"))?;
+        thread::spawn(move || {
+            for stream in listener.incoming().flatten() {
+                let _ = stream.set_read_timeout(timeout);
+                respond(&stream);
+            }
+        });
+        return Ok(());
+    }
+
+    let Ok(socket_addr) = addr.parse::<SocketAddr>() else {
+        bail_other_err!("Invalid metrics address {addr:?}, expected host:port or unix:<path>");
+    };
+    if !socket_addr.ip().is_loopback() {
+        bail_other_err!("Metrics address {addr:?} is not a loopback address");
+    }
+    let listener =
+        TcpListener::bind(socket_addr).map_err(wrap_io_err!(addr, "Binding metrics port"))?;
+    thread::spawn(move || {
+        for stream in listener.incoming().flatten() {
+            let _ = stream.set_read_timeout(timeout);
+            respond(&stream);
+        }
+    });
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn serves_prometheus_and_json() {
+        set_state("bench-a", "x86_64-unknown-redox", RecipeState::Cached);
+        drop(time_phase(Phase::Build));
+        add(Counter::SysrootHits, 2);
+
+        let path = std::env::temp_dir().join(format!("cook-metrics-{}.sock", std::process::id()));
+        serve(&format!("unix:{}", path.display())).unwrap();
+        let get = |url: &str| {
+            let mut stream = std::os::unix::net::UnixStream::connect(&path).unwrap();
+            write!(stream, "GET {url} HTTP/1.1\r\nHost: localhost\r\n\r\n").unwrap();
+            let mut response = String::new();
+            stream.read_to_string(&mut response).unwrap();
+            response
+        };
+
+        let text = get("/metrics");
+        assert!(text.starts_with("HTTP/1.1 200 OK"));
+        assert!(text.contains("cookbook_recipes{state=\"cached\"} "));
+        assert!(text.contains("cookbook_phase_seconds_bucket{phase=\"build\",le=\"0.1\"} "));
+        let json = get("/metrics.json");
+        let body = json.split("\r\n\r\n").nth(1).unwrap();
+        let value: serde_json::Value = serde_json::from_str(body).unwrap();
+        assert!(value["counters"]["sysroot_cache_hits"].as_u64().unwrap() >= 2);
+        assert!(get("/other").starts_with("HTTP/1.1 404"));
+
+        let _ = std::fs::remove_file(&path);
+        assert!(serve("0.0.0.0:0").is_err());
+    }
+}
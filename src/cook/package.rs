@@ -11,10 +11,11 @@ use pkgar_keys::PublicKeyFile;
 use crate::{
     Error, Result,
     config::CookConfig,
-    cook::{cook_build::BuildResult, fetch, fs::*, pty::PtyOut},
-    log_to_pty,
+    cook::{
+        cook_build::BuildResult, delta, fetch, fs::*, image::ImageWriter, pkgar_cache, pty::PtyOut,
+    },
+    log_debug, log_warn,
     recipe::{BuildKind, CookRecipe, OptionalPackageRecipe},
-    wrap_io_err,
 };
 
 pub fn package(
@@ -56,7 +57,7 @@ pub fn package(
         let (stage_dir, package_file, package_meta) = package_stage_paths(package, target_dir);
         // Rebuild package if stage is newer
         if package_file.is_file() && !build_result.cached {
-            log_to_pty!(logger, "DEBUG: updating '{}'", package_file.display());
+            log_debug!(logger, "updating '{}'", package_file.display());
             remove_all(&package_file)?;
             if package_meta.is_file() {
                 remove_all(&package_meta)?;
@@ -134,20 +135,19 @@ pub fn package_toml(
     let (hash, network_size, storage_size) = if let Some((pkey_path, archive_path)) = package_file {
         use pkgar_core::PackageSrc;
         let pkey = pkgar_keys::PublicKeyFile::open(pkey_path)?.pkey;
-        let mut package = pkgar::PackageFile::new(archive_path, &pkey)?;
-        let mt = std::fs::metadata(archive_path)
-            .map_err(wrap_io_err!(archive_path, "Reading metadata"))?;
-        let package_size = mt.len();
-        let header = package.header();
-        let storage_size = match header.flags.packaging() {
+        let info = pkgar_cache::get(archive_path, &pkey)?;
+        let package_size = info.size;
+        let storage_size = match info.flags.packaging() {
             pkgar_core::Packaging::LZMA2 => {
-                let mut size = header
+                // unpacked sizes of compressed entries need the data itself
+                let mut package = pkgar::PackageFile::new(archive_path, &pkey)?;
+                let mut size = package
+                    .header()
                     .total_size()
                     .map_err(|e| Error::Pkgar(pkgar::Error::Core(e)))?
                     as u64;
-                let entries = package.read_entries()?;
-                for entry in entries {
-                    let data_reader = package.data_reader(&entry)?;
+                for entry in &info.entries {
+                    let data_reader = package.data_reader(entry)?;
                     size += data_reader.unpacked_size;
                     package.restore_reader(data_reader.into_inner())?;
                 }
@@ -156,13 +156,7 @@ pub fn package_toml(
             _ => package_size,
         };
 
-        (
-            blake3::Hash::from_bytes(package.header().blake3)
-                .to_hex()
-                .to_string(),
-            package_size,
-            storage_size,
-        )
+        (info.blake3_hex(), package_size, storage_size)
     } else {
         ("".into(), 0, 0)
     };
@@ -243,42 +237,137 @@ fn get_package_name_inner(name: &str, package: Option<&str>) -> String {
     prefix_name
 }
 
-pub fn package_handle_push(
-    state: &mut PackageState,
+/// A package that needs to be extracted into a sysroot
+pub struct PushJob {
+    pkg_toml: Package,
+    archive_path: PathBuf,
+    manual: bool,
+    dependents: BTreeSet<PackageName>,
+    reinstall: bool,
+}
+
+/// Check against installed state, returns None if the package is already installed
+pub fn package_prepare_push(
+    state: &PackageState,
     archive_path: &Path,
-    sysroot_dir: &Path,
     reinstall: bool,
-) -> crate::Result<bool> {
+) -> crate::Result<Option<PushJob>> {
     let archive_toml = archive_path.with_extension("toml");
-    let pkey_path = "build/id_ed25519.pub.toml";
     let pkg_toml = Package::from_file(&archive_toml)?;
-    // "local" is what remote name from installer is hardcoded into
-    let remote_name = "local".to_string();
-    let (cached, pstate) = match state.installed.get(&pkg_toml.name) {
-        Some(s) if !reinstall && pkg_toml.blake3 == s.blake3 => (true, None),
-        Some(s) => (false, Some((s.manual, s.dependents.clone()))),
+    let (manual, dependents) = match state.installed.get(&pkg_toml.name) {
+        Some(s) if !reinstall && pkg_toml.blake3 == s.blake3 => return Ok(None),
+        Some(s) => (s.manual, s.dependents.clone()),
         None => {
             // TODO: Handle manual & dependents
-            (false, Some((true, BTreeSet::new())))
+            (true, BTreeSet::new())
         }
     };
+    Ok(Some(PushJob {
+        pkg_toml,
+        archive_path: archive_path.to_path_buf(),
+        manual,
+        dependents,
+        reinstall,
+    }))
+}
 
-    if let Some((manual, dependents)) = pstate {
-        if archive_path.is_file() {
-            let pkey = PublicKeyFile::open(pkey_path)?.pkey;
-            let mut package = PackageFile::new(archive_path, &pkey)?;
+impl PushJob {
+    fn head_path(&self, sysroot_dir: &Path) -> PathBuf {
+        sysroot_dir.join(format!(
+            "var/lib/packages/{}.pkgar_head",
+            self.pkg_toml.name.as_str()
+        ))
+    }
+
+    /// Paths that extracting writes or removes, used to detect overlapping
+    /// packages: all entries in the archive, and with a delta install also the
+    /// entries of the installed head, which are removed if they are gone
+    pub fn entry_paths(&self, sysroot_dir: &Path) -> crate::Result<Vec<PathBuf>> {
+        if !self.archive_path.is_file() {
+            return Ok(Vec::new());
+        }
+        let pkey = PublicKeyFile::open("build/id_ed25519.pub.toml")?.pkey;
+        let mut paths = pkgar_cache::entry_paths(&self.archive_path, &pkey)?;
+        let head_path = self.head_path(sysroot_dir);
+        if !self.reinstall && head_path.is_file() {
+            paths.extend(pkgar_cache::entry_paths(&head_path, &pkey)?);
+        }
+        Ok(paths)
+    }
+
+    /// Write package files into sysroot. Does not touch the package state,
+    /// so different packages can be extracted concurrently.
+    pub fn extract(&self, sysroot_dir: &Path) -> crate::Result<()> {
+        if !self.archive_path.is_file() {
+            return Ok(());
+        }
+        let pkey_path = "build/id_ed25519.pub.toml";
+        let pkey = PublicKeyFile::open(pkey_path)?.pkey;
+        let mut package = PackageFile::new(&self.archive_path, &pkey)?;
+        let head_path = self.head_path(sysroot_dir);
+        // only write changed files when upgrading from a known head
+        let mut delta_installed = false;
+        if !self.reinstall && head_path.is_file() {
+            match delta::install_delta(&mut package, &head_path, sysroot_dir, &pkey) {
+                Ok(_) => delta_installed = true,
+                Err(e) => log_warn!(
+                    &None,
+                    "delta install of '{}' failed, installing in full: {e}",
+                    self.archive_path.display()
+                ),
+            }
+        }
+        if !delta_installed {
             Transaction::install(&mut package, sysroot_dir)?.commit()?;
-            let head_path = sysroot_dir.join(format!(
-                "var/lib/packages/{}.pkgar_head",
-                pkg_toml.name.as_str()
-            ));
-            package.split(&head_path, None::<&Path>)?;
         }
+        package.split(&head_path, None::<&Path>)?;
+        Ok(())
+    }
+
+    /// Write package files into a RedoxFS image, like [`PushJob::extract`]
+    /// with the package heads in `meta_dir`.
+    pub fn extract_image(&self, meta_dir: &Path, image: &ImageWriter) -> crate::Result<()> {
+        use pkgar_core::PackageSrc;
+        if !self.archive_path.is_file() {
+            return Ok(());
+        }
+        let pkey = PublicKeyFile::open("build/id_ed25519.pub.toml")?.pkey;
+        let mut package = PackageFile::new(&self.archive_path, &pkey)?;
+        let head_path = self.head_path(meta_dir);
+        // only write changed files when upgrading from a known head
+        let (entries, removed) = if !self.reinstall && head_path.is_file() {
+            delta::changed_entries(&mut package, &head_path, &pkey)?
+        } else {
+            (package.read_entries()?, Vec::new())
+        };
+        image.push_entries(&mut package, &entries, removed)?;
+        package.split(&head_path, None::<&Path>)?;
+        Ok(())
+    }
 
+    /// Record the package as installed
+    pub fn commit(self, state: &mut PackageState) {
+        // "local" is what remote name from installer is hardcoded into
+        let remote_name = "local".to_string();
         // TODO: Check if we need to inject remote key
-        let install_state = InstallState::from_package(&pkg_toml, remote_name, manual, dependents);
-        state.installed.insert(pkg_toml.name.clone(), install_state);
+        let install_state =
+            InstallState::from_package(&self.pkg_toml, remote_name, self.manual, self.dependents);
+        state
+            .installed
+            .insert(self.pkg_toml.name.clone(), install_state);
     }
+}
 
-    Ok(cached)
+pub fn package_handle_push(
+    state: &mut PackageState,
+    archive_path: &Path,
+    sysroot_dir: &Path,
+    reinstall: bool,
+) -> crate::Result<bool> {
+    let Some(job) = package_prepare_push(state, archive_path, reinstall)? else {
+        return Ok(true);
+    };
+    job.extract(sysroot_dir)?;
+    job.commit(state);
+    Ok(false)
 }
@@ -0,0 +1,114 @@
+//! Process-wide cache of verified pkgar headers and entry tables.
+//!
+//! Opening a `PackageFile` verifies the signed header, and the same
+//! dependency archives are read by every recipe that depends on them. The
+//! result of the first open is kept here, keyed by path and checked against
+//! the file's device, inode, size and modification time, so a rewritten
+//! archive is always verified again.
+
+use std::collections::HashMap;
+use std::os::unix::fs::MetadataExt;
+use std::path::{Path, PathBuf};
+use std::sync::{Arc, LazyLock, Mutex};
+
+use pkgar::PackageFile;
+use pkgar_core::{Entry, HeaderFlags, PackageSrc, PublicKey};
+
+use crate::{Result, wrap_io_err};
+
+/// Identity of one version of a file on disk.
+#[derive(Clone, Copy, PartialEq, Eq)]
+struct FileStamp {
+    dev: u64,
+    ino: u64,
+    size: u64,
+    mtime: i64,
+    mtime_nsec: i64,
+}
+
+impl FileStamp {
+    fn of(path: &Path) -> Result<Self> {
+        let mt = std::fs::metadata(path).map_err(wrap_io_err!(path, "Reading metadata"))?;
+        Ok(Self {
+            dev: mt.dev(),
+            ino: mt.ino(),
+            size: mt.len(),
+            mtime: mt.mtime(),
+            mtime_nsec: mt.mtime_nsec(),
+        })
+    }
+}
+
+/// What is known about a pkgar archive after verifying it once.
+pub struct PkgarInfo {
+    /// header blake3
+    pub blake3: [u8; 32],
+    /// archive size in bytes
+    pub size: u64,
+    /// header flags, such as how entry data is packed
+    pub flags: HeaderFlags,
+    /// entry table, already checked against the header
+    pub entries: Vec<Entry>,
+}
+
+impl PkgarInfo {
+    pub fn blake3_hex(&self) -> String {
+        blake3::Hash::from_bytes(self.blake3).to_hex().to_string()
+    }
+}
+
+struct CacheEntry {
+    stamp: FileStamp,
+    pkey: PublicKey,
+    info: Arc<PkgarInfo>,
+}
+
+static CACHE: LazyLock<Mutex<HashMap<PathBuf, CacheEntry>>> =
+    LazyLock::new(|| Mutex::new(HashMap::new()));
+
+/// Verified header and entries of the archive at `path`, reading the archive
+/// only if this version of it was not verified with `pkey` before.
+pub fn get(path: &Path, pkey: &PublicKey) -> Result<Arc<PkgarInfo>> {
+    let stamp = FileStamp::of(path)?;
+    if let Some(cached) = CACHE.lock().unwrap().get(path)
+        && cached.stamp == stamp
+        && cached.pkey == *pkey
+    {
+        return Ok(cached.info.clone());
+    }
+
+    // verify outside the lock, concurrent misses on one file are harmless
+    let mut package = PackageFile::new(path, pkey)?;
+    let entries = package.read_entries()?;
+    let header = package.header();
+    let info = Arc::new(PkgarInfo {
+        blake3: header.blake3,
+        flags: header.flags,
+        size: stamp.size,
+        entries,
+    });
+    CACHE.lock().unwrap().insert(
+        path.to_path_buf(),
+        CacheEntry {
+            stamp,
+            pkey: pkey.clone(),
+            info: info.clone(),
+        },
+    );
+    Ok(info)
+}
+
+/// Header blake3 of the archive at `path`, see [`get`].
+pub fn header_blake3(path: &Path, pkey: &PublicKey) -> Result<[u8; 32]> {
+    Ok(get(path, pkey)?.blake3)
+}
+
+/// Paths of all entries of the archive at `path`, see [`get`].
+pub fn entry_paths(path: &Path, pkey: &PublicKey) -> Result<Vec<PathBuf>> {
+    let info = get(path, pkey)?;
+    let mut paths = Vec::with_capacity(info.entries.len());
+    for entry in &info.entries {
+        paths.push(pkgar::ext::EntryExt::check_path(entry)?.to_path_buf());
+    }
+    Ok(paths)
+}
@@ -0,0 +1,323 @@
+use pkg::PackageName;
+use pkgar_keys::PublicKeyFile;
+use serde::Serialize;
+use std::collections::{BTreeSet, HashMap};
+use std::fmt::Display;
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::thread;
+
+use crate::Result;
+use crate::cook::cook_build::{
+    build_dep_pkgars, build_source_newer_reason, deps_dir_outdated, get_stage_dirs,
+    get_sub_target_dir,
+};
+use crate::cook::fetch::fetch_is_patches_newer;
+use crate::cook::fs;
+use crate::cook::package::package_source_paths;
+use crate::recipe::{BuildKind, CookRecipe, SourceRecipe};
+
+/// Why a recipe would be rebuilt by "cook"
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize)]
+#[serde(rename_all = "snake_case")]
+pub enum PlanReason {
+    /// stage pkgar or auto_deps.toml is absent
+    Missing,
+    /// source files are newer than stage pkgar
+    Source,
+    /// recipe.toml is newer than stage pkgar
+    Recipe,
+    /// patch files are newer than extracted source
+    Patch,
+    /// remote package is newer than stage pkgar
+    Remote,
+    /// a build dependency is updated or will be rebuilt
+    Deps,
+}
+
+impl Display for PlanReason {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        let s = match self {
+            PlanReason::Missing => "missing",
+            PlanReason::Source => "source",
+            PlanReason::Recipe => "recipe",
+            PlanReason::Patch => "patch",
+            PlanReason::Remote => "remote",
+            PlanReason::Deps => "deps",
+        };
+        write!(f, "{s}")
+    }
+}
+
+#[derive(Debug, Clone, Serialize)]
+pub struct PlanEntry {
+    pub name: String,
+    pub target: &'static str,
+    pub rebuild: bool,
+    pub reason: Option<PlanReason>,
+    /// the dependency that caused PlanReason::Deps
+    pub cause: Option<String>,
+    #[serde(skip)]
+    is_deps: bool,
+    #[serde(skip)]
+    build_deps: Vec<PackageName>,
+}
+
+impl PlanEntry {
+    fn new(cook_recipe: &CookRecipe) -> Self {
+        Self {
+            name: cook_recipe.name.as_str().to_string(),
+            target: cook_recipe.target,
+            rebuild: false,
+            reason: None,
+            cause: None,
+            is_deps: cook_recipe.is_deps,
+            build_deps: Vec::new(),
+        }
+    }
+
+    fn set_reason(&mut self, reason: PlanReason, cause: Option<&PackageName>) {
+        self.rebuild = true;
+        self.reason = Some(reason);
+        self.cause = cause.map(|c| c.as_str().to_string());
+    }
+}
+
+/// Decide whether a recipe would rebuild, using the same checks as fetch and build,
+/// but without fetching, extracting or touching any sysroot.
+pub fn plan_recipe(cook_recipe: &CookRecipe) -> Result<PlanEntry> {
+    let mut entry = PlanEntry::new(cook_recipe);
+    let recipe = &cook_recipe.recipe;
+    if recipe.build.kind == BuildKind::None {
+        return Ok(entry);
+    }
+
+    let target_dir = cook_recipe.target_dir();
+    let source_dir = cook_recipe.dir.join("source");
+    let auto_deps_file = get_sub_target_dir(&target_dir, "auto_deps.toml");
+    let stage_dirs = get_stage_dirs(&recipe.optional_packages, &target_dir);
+    let stage_pkgars: Vec<PathBuf> = stage_dirs
+        .iter()
+        .map(|p| p.with_added_extension("pkgar"))
+        .collect();
+
+    let (dep_pkgars, dep_host_pkgars) = build_dep_pkgars(cook_recipe)?;
+    entry.build_deps = dep_pkgars
+        .iter()
+        .chain(dep_host_pkgars.iter())
+        .map(|(name, _)| name.clone())
+        .collect();
+
+    if !stage_pkgars.iter().all(|file| file.is_file()) || !auto_deps_file.is_file() {
+        entry.set_reason(PlanReason::Missing, None);
+        return Ok(entry);
+    }
+    if cook_recipe.is_deps {
+        // build() does not check source for dependencies
+        return Ok(entry);
+    }
+
+    if recipe.build.kind == BuildKind::Remote {
+        for (i, package) in recipe.get_packages_list().into_iter().enumerate() {
+            let (_, source_pkgar, _) = package_source_paths(package, &target_dir);
+            let newer = match (fs::modified(&source_pkgar), fs::modified(&stage_pkgars[i])) {
+                (Ok(source), Ok(stage)) => source > stage,
+                _ => true,
+            };
+            if newer {
+                entry.set_reason(PlanReason::Remote, None);
+                break;
+            }
+        }
+        return Ok(entry);
+    }
+
+    if recipe.source.is_some() && !source_dir.exists() {
+        entry.set_reason(PlanReason::Source, None);
+        return Ok(entry);
+    }
+    if let Some(SourceRecipe::Tar { patches, .. }) = &recipe.source {
+        if fetch_is_patches_newer(&cook_recipe.dir, patches, &source_dir)? {
+            entry.set_reason(PlanReason::Patch, None);
+            return Ok(entry);
+        }
+    }
+
+    let deps_sysroot = if cook_recipe.name.is_host() {
+        &dep_host_pkgars
+    } else {
+        &dep_pkgars
+    };
+    let have_toolchain = !cook_recipe.name.is_host() && dep_host_pkgars.len() > 0;
+    let mut deps_dirs: Vec<(PathBuf, &BTreeSet<(PackageName, PathBuf)>)> =
+        vec![(get_sub_target_dir(&target_dir, "sysroot"), deps_sysroot)];
+    if have_toolchain {
+        deps_dirs.push((
+            get_sub_target_dir(&target_dir, "toolchain"),
+            &dep_host_pkgars,
+        ));
+    }
+    let pkey = PublicKeyFile::open("build/id_ed25519.pub.toml").map(|k| k.pkey);
+    for (deps_dir, dep_pkgars) in deps_dirs {
+        if dep_pkgars.is_empty() {
+            continue;
+        }
+        if let Some((name, _)) = dep_pkgars.iter().find(|(_, pkgar)| !pkgar.is_file()) {
+            entry.set_reason(PlanReason::Deps, Some(name));
+            return Ok(entry);
+        }
+        let Ok(pkey) = &pkey else {
+            entry.set_reason(PlanReason::Deps, None);
+            return Ok(entry);
+        };
+        if let Some(cause) = deps_dir_outdated(&deps_dir, dep_pkgars, pkey)? {
+            entry.set_reason(PlanReason::Deps, cause.as_ref());
+            return Ok(entry);
+        }
+    }
+
+    if let Some(reason) = build_source_newer_reason(
+        &cook_recipe.dir,
+        &source_dir,
+        &auto_deps_file,
+        &stage_pkgars,
+    ) {
+        entry.set_reason(reason, None);
+    }
+
+    Ok(entry)
+}
+
+/// Mark recipes as rebuilt when any of their build dependencies will be rebuilt.
+/// Entries must be ordered so that dependencies come first, like in get_build_deps_recursive.
+/// With several targets, a dependency is the entry for the dependent's target, while host
+/// dependencies are built once and shared by all targets.
+pub fn plan_propagate(entries: &mut [PlanEntry]) {
+    let mut index: HashMap<(String, &'static str), usize> = HashMap::new();
+    for i in 0..entries.len() {
+        let cause = if entries[i].rebuild || entries[i].is_deps {
+            // dependencies are not checked for source changes in build()
+            None
+        } else {
+            entries[i].build_deps.iter().find(|dep| {
+                let target = if dep.is_host() {
+                    redoxer::host_target()
+                } else {
+                    entries[i].target
+                };
+                index
+                    .get(&(dep.as_str().to_string(), target))
+                    .is_some_and(|j| entries[*j].rebuild)
+            })
+        };
+        if let Some(cause) = cause.cloned() {
+            entries[i].set_reason(PlanReason::Deps, Some(&cause));
+        }
+        index.insert((entries[i].name.clone(), entries[i].target), i);
+    }
+}
+
+/// Evaluate all recipes in parallel, then propagate rebuilds through the dependency order.
+pub fn plan(recipes: &[CookRecipe], jobs: usize) -> Result<Vec<PlanEntry>> {
+    let next = AtomicUsize::new(0);
+    let jobs = jobs.clamp(1, recipes.len().max(1));
+    let mut results: Vec<(usize, Result<PlanEntry>)> = thread::scope(|s| {
+        let workers: Vec<_> = (0..jobs)
+            .map(|_| {
+                s.spawn(|| {
+                    let mut results = Vec::new();
+                    loop {
+                        let i = next.fetch_add(1, Ordering::Relaxed);
+                        let Some(recipe) = recipes.get(i) else {
+                            break;
+                        };
+                        results.push((i, plan_recipe(recipe)));
+                    }
+                    results
+                })
+            })
+            .collect();
+        workers
+            .into_iter()
+            .flat_map(|w| w.join().expect("plan worker panicked"))
+            .collect()
+    });
+    results.sort_by_key(|(i, _)| *i);
+
+    let mut entries = Vec::with_capacity(results.len());
+    for (i, result) in results {
+        let entry = result.map_err(|e| {
+            crate::Error::Other(format!(
+                "Planning {} failed: {}",
+                recipes[i].name.as_str(),
+                e
+            ))
+        })?;
+        entries.push(entry);
+    }
+    plan_propagate(&mut entries);
+    Ok(entries)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn entry(name: &str, is_deps: bool, deps: &[&str], reason: Option<PlanReason>) -> PlanEntry {
+        entry_for("x86_64-unknown-redox", name, is_deps, deps, reason)
+    }
+
+    fn entry_for(
+        target: &'static str,
+        name: &str,
+        is_deps: bool,
+        deps: &[&str],
+        reason: Option<PlanReason>,
+    ) -> PlanEntry {
+        PlanEntry {
+            name: name.to_string(),
+            target,
+            rebuild: reason.is_some(),
+            reason,
+            cause: None,
+            is_deps,
+            build_deps: deps
+                .iter()
+                .map(|d| PackageName::new(d.to_string()).unwrap())
+                .collect(),
+        }
+    }
+
+    #[test]
+    fn propagate_transitive_rebuilds() {
+        let mut entries = vec![
+            entry("zlib", false, &[], Some(PlanReason::Source)),
+            entry("libpng", true, &["zlib"], None),
+            entry("netsurf", false, &["libpng", "zlib"], None),
+            entry("ca-certificates", false, &[], None),
+        ];
+        plan_propagate(&mut entries);
+
+        // dependencies skip source checks in build(), so they stay cached
+        assert!(!entries[1].rebuild);
+        assert!(entries[2].rebuild);
+        assert_eq!(entries[2].reason, Some(PlanReason::Deps));
+        assert_eq!(entries[2].cause.as_deref(), Some("zlib"));
+        assert!(!entries[3].rebuild);
+    }
+
+    #[test]
+    fn propagate_per_target() {
+        let (x86, arm) = ("x86_64-unknown-redox", "aarch64-unknown-redox");
+        let mut entries = vec![
+            entry_for(x86, "zlib", false, &[], Some(PlanReason::Source)),
+            entry_for(arm, "zlib", false, &[], None),
+            entry_for(x86, "libpng", false, &["zlib"], None),
+            entry_for(arm, "libpng", false, &["zlib"], None),
+        ];
+        plan_propagate(&mut entries);
+
+        assert!(entries[2].rebuild);
+        assert!(!entries[3].rebuild);
+    }
+}
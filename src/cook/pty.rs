@@ -1,34 +1,19 @@
 use libc::{self, winsize};
-use std::io::{self, PipeReader, PipeWriter, Read, Write};
+use std::io::{self, Read, Write};
 use std::os::fd::FromRawFd;
 use std::os::unix::{io::AsRawFd, io::RawFd, process::CommandExt};
 use std::process::{Child, Command};
-use std::{fs::File, mem, ptr, time::Duration};
+use std::sync::{Arc, Mutex};
+use std::{fs::File, mem, ptr};
 
+use crate::cook::log::Logger;
 use crate::{Error, Result, wrap_io_err};
 
-macro_rules! log_to_pty {
-    ($logger:expr, $($arg:tt)+) => {
-        if $logger.is_some() {
-            use std::io::Write;
-            let mut logfd = $logger.as_ref().unwrap().1.try_clone().unwrap();
-            let _ = logfd.write(format!($($arg)+).as_bytes());
-            let _ = logfd.write(&[b'\n']);
-        } else {
-            eprintln!($($arg)+);
-        }
-    };
-}
+pub type PtyOut<'a> = Option<(&'a mut UnixSlavePty, &'a Logger)>;
 
-pub(crate) use log_to_pty;
-
-pub type PtyOut<'a> = Option<(&'a mut UnixSlavePty, &'a mut PipeWriter)>;
-
-pub fn setup_pty() -> (
-    Box<dyn Read + Send>,
-    PipeReader,
-    (UnixSlavePty, std::io::PipeWriter),
-) {
+/// Open a pty for command output. The slave end is handed to spawned
+/// commands, the reader end to a log thread.
+pub fn setup_pty() -> (Arc<PtyReader>, UnixSlavePty) {
     let pty_system = UnixPtySystem::default();
     let pair = pty_system
         .openpty(PtySize {
@@ -39,35 +24,94 @@ pub fn setup_pty() -> (
         .expect("Unable to open pty");
 
     // TODO: There's no way to handle stdin
-    let pty_reader = pair
-        .master
-        .try_clone_reader()
-        .expect("Unable to clone pty reader");
-
-    let (log_reader, log_writer) = std::io::pipe().expect("Failed to create log pipe");
-    let pipes = (pair.slave, log_writer);
-    (pty_reader, log_reader, pipes)
+    let reader = PtyReader::new(&pair.master).expect("Unable to clone pty reader");
+    (Arc::new(reader), pair.slave)
 }
 
+/// Write out everything logged and printed by commands so far.
 pub fn flush_pty(logger: &mut PtyOut) {
-    let Some((pty, file)) = logger else {
+    let Some((pty, logger)) = logger else {
         return;
     };
-    // Not sure if flush actually working
     let _ = pty.flush();
-    std::thread::sleep(Duration::from_millis(10));
-    let _ = file.flush();
+    logger.flush();
 }
 
 pub fn spawn_to_pipe(command: &mut Command, stdout_pipe: &PtyOut) -> Result<Child> {
     match stdout_pipe {
-        Some(stdout) => stdout.0.spawn_command(command.into()),
+        Some(stdout) => {
+            // keep our log lines ahead of the command output
+            stdout.1.flush();
+            stdout.0.spawn_command(command.into())
+        }
         None => Ok(command.spawn().map_err(wrap_io_err!("Spawning"))?),
     }
 }
 
-pub fn write_to_pty(pty: &PtyOut, text: &str) {
-    log_to_pty!(pty, "{}", text);
+/// Non-blocking master side of a pty.
+///
+/// A log thread calls [`PtyReader::pump`] in a loop, while [`PtyReader::drain`]
+/// lets the cooking thread collect the rest of the output before writing a log
+/// file. Reads happen under a lock, so the two never reorder output and a
+/// drain returns only after every byte read so far has reached its sink.
+pub struct PtyReader {
+    master: Mutex<PtyFd>,
+    fd: RawFd,
+}
+
+impl PtyReader {
+    fn new(master: &UnixMasterPty) -> Result<Self> {
+        let fd = master
+            .fd
+            .try_clone()
+            .map_err(wrap_io_err!("Cloning pty fd"))?;
+        let raw = fd.as_raw_fd();
+        let flags = unsafe { libc::fcntl(raw, libc::F_GETFL) };
+        if flags == -1 || unsafe { libc::fcntl(raw, libc::F_SETFL, flags | libc::O_NONBLOCK) } == -1
+        {
+            return Err(Error::from_last_io_error("fcntl to set O_NONBLOCK"));
+        }
+        Ok(Self {
+            master: Mutex::new(PtyFd(fd)),
+            fd: raw,
+        })
+    }
+
+    /// Wait for output and pass it to `sink`. Returns false once the slave
+    /// side is closed.
+    pub fn pump(&self, sink: &mut dyn FnMut(&[u8])) -> bool {
+        let mut pollfd = libc::pollfd {
+            fd: self.fd,
+            events: libc::POLLIN,
+            revents: 0,
+        };
+        if unsafe { libc::poll(&mut pollfd, 1, -1) } < 0 {
+            return io::Error::last_os_error().kind() == io::ErrorKind::Interrupted;
+        }
+        self.drain(sink)
+    }
+
+    /// Pass all output that is readable now to `sink`. Returns false once the
+    /// slave side is closed.
+    pub fn drain(&self, sink: &mut dyn FnMut(&[u8])) -> bool {
+        // An empty non-blocking read on a pty master first flushes data the
+        // kernel still has queued from the slave, so nothing written before
+        // this call is missed.
+        let mut master = self.master.lock().unwrap();
+        let mut buffer = [0; 4096];
+        loop {
+            match master.read(&mut buffer) {
+                Ok(0) => return false,
+                Ok(n) => sink(&buffer[..n]),
+                Err(e) if e.kind() == io::ErrorKind::WouldBlock => return true,
+                Err(e) if e.kind() == io::ErrorKind::Interrupted => {}
+                Err(e) => {
+                    sink(format!("[IO Error] {}", e).as_bytes());
+                    return false;
+                }
+            }
+        }
+    }
 }
 
 //
@@ -315,6 +359,10 @@ impl UnixSlavePty {
     fn flush(&mut self) -> Result<()> {
         self.fd.flush()
     }
+    /// Another handle that writes into the pty, as spawned commands do.
+    pub fn try_clone_writer(&self) -> Result<File> {
+        self.fd.try_clone().map_err(wrap_io_err!("Cloning pty fd"))
+    }
 }
 
 impl UnixMasterPty {
@@ -327,13 +375,4 @@ impl UnixMasterPty {
     fn get_size(&self) -> Result<PtySize> {
         self.fd.get_size()
     }
-
-    fn try_clone_reader(&self) -> Result<Box<dyn Read + Send>> {
-        let fd = PtyFd(
-            self.fd
-                .try_clone()
-                .map_err(wrap_io_err!("Cloning pty fd"))?,
-        );
-        Ok(Box::new(fd))
-    }
 }
@@ -0,0 +1,352 @@
+//! RAM-backed build directories.
+//!
+//! With `ram_dir` set, usually to a tmpfs, the `build` dir of a recipe and the
+//! `stage.tmp` its build script installs into live in an entry under it, and
+//! `target/<triple>/build` becomes a symlink to that entry. Configure scripts
+//! and compilers then do their small-file I/O and fsyncs in memory, and only
+//! the finished stage is copied back to disk.
+//!
+//! A recipe builds in RAM while its expected size, from the sizes recorded in
+//! `build/build_size.toml` or its `build-size` hint, fits `ram_budget` next to
+//! the entries already there. Idle entries are kept for incremental rebuilds
+//! and evicted least recently used first when space is needed. Everything
+//! else builds on disk as before, including recipes whose build dir is
+//! already on disk. Entries are locked while in use, so several processes can
+//! share one `ram_dir`.
+
+use std::fs::{self, File};
+use std::io;
+use std::os::unix::fs::MetadataExt;
+use std::path::{Path, PathBuf};
+use std::sync::Mutex;
+use std::time::SystemTime;
+
+use walkdir::WalkDir;
+
+use crate::config::CookConfig;
+use crate::cook::fs::{copy_tree, remove_all};
+use crate::cook::memory::{self, MIB};
+use crate::cook::pty::PtyOut;
+use crate::recipe::CookRecipe;
+use crate::{Result, log_debug, wrap_io_err};
+
+const HISTORY_PATH: &str = "build/build_size.toml";
+
+/// Expected size of a recipe that has neither history nor a hint.
+const DEFAULT_SIZE: u64 = 512 * MIB;
+
+/// Bytes reserved by the leases of this process.
+static RESERVED: Mutex<u64> = Mutex::new(0);
+
+/// Expected size in bytes of the build and stage dirs of `recipe`.
+pub fn expected_size(recipe: &CookRecipe) -> u64 {
+    if let Some(size) = memory::recorded(HISTORY_PATH, recipe) {
+        return size;
+    }
+    match recipe.recipe.build.build_size {
+        Some(mib) => mib * MIB,
+        None => DEFAULT_SIZE,
+    }
+}
+
+/// Remember the size of `dirs` after building `recipe`, whether they are in
+/// RAM or not, so the next build of it knows whether it fits.
+pub fn record_size(recipe: &CookRecipe, dirs: &[&Path], config: &CookConfig) {
+    if config.ram_dir.is_some() {
+        let size = dirs.iter().map(|dir| dir_size(dir)).sum();
+        memory::record(HISTORY_PATH, recipe, size);
+    }
+}
+
+/// Space used by the files under `dir`, in bytes.
+fn dir_size(dir: &Path) -> u64 {
+    WalkDir::new(dir)
+        .into_iter()
+        .flatten()
+        .filter_map(|entry| entry.metadata().ok())
+        .map(|meta| meta.blocks() * 512)
+        .sum()
+}
+
+/// Free bytes on the filesystem holding `dir`.
+#[cfg(target_os = "linux")]
+fn free_space(dir: &Path) -> Option<u64> {
+    use std::os::unix::ffi::OsStrExt;
+    let path = std::ffi::CString::new(dir.as_os_str().as_bytes()).ok()?;
+    let mut stat: libc::statvfs = unsafe { std::mem::zeroed() };
+    if unsafe { libc::statvfs(path.as_ptr(), &mut stat) } != 0 {
+        return None;
+    }
+    Some(stat.f_bavail as u64 * stat.f_frsize as u64)
+}
+
+#[cfg(not(target_os = "linux"))]
+fn free_space(_dir: &Path) -> Option<u64> {
+    None
+}
+
+/// Entry of the build dir at `build_dir`, named after its absolute path.
+fn entry_name(build_dir: &Path) -> Result<String> {
+    let path = std::path::absolute(build_dir).map_err(wrap_io_err!(build_dir, "Resolving"))?;
+    let hash = blake3::hash(path.as_os_str().as_encoded_bytes()).to_hex();
+    Ok(hash[..16].to_string())
+}
+
+fn is_entry_name(name: &str) -> bool {
+    name.len() == 16 && name.chars().all(|c| c.is_ascii_hexdigit())
+}
+
+/// An entry in use by a build of this process.
+pub struct Lease {
+    entry: PathBuf,
+    reserved: u64,
+    /// holds the entry's lock while alive
+    _lock: File,
+}
+
+impl Lease {
+    pub fn build_dir(&self) -> PathBuf {
+        self.entry.join("build")
+    }
+
+    pub fn stage_dir(&self) -> PathBuf {
+        self.entry.join("stage.tmp")
+    }
+
+    /// Copy the stage the build script installed to `stage_dir` on disk and
+    /// free it in RAM, keeping the build dir for the next build.
+    pub fn finish(self, stage_dir: &Path) -> Result<()> {
+        let ram_stage = self.stage_dir();
+        if stage_dir.is_dir() {
+            fs::remove_dir_all(stage_dir).map_err(wrap_io_err!(stage_dir, "Removing stage"))?;
+        }
+        copy_tree(&ram_stage, stage_dir).map_err(wrap_io_err!(
+            ram_stage,
+            stage_dir,
+            "Copying stage out of RAM"
+        ))?;
+        fs::remove_dir_all(&ram_stage).map_err(wrap_io_err!(ram_stage, "Removing stage"))?;
+        let size = self.entry.join("size");
+        fs::write(&size, dir_size(&self.entry).to_string())
+            .map_err(wrap_io_err!(size, "Writing size"))?;
+        Ok(())
+    }
+}
+
+impl Drop for Lease {
+    fn drop(&mut self) {
+        *RESERVED.lock().unwrap() -= self.reserved;
+    }
+}
+
+/// Lock an entry, returning None if another build holds it.
+fn try_lock(entry: &Path) -> io::Result<Option<File>> {
+    let file = File::options()
+        .create(true)
+        .truncate(false)
+        .write(true)
+        .open(entry.join("lock"))?;
+    match file.try_lock() {
+        Ok(()) => Ok(Some(file)),
+        Err(fs::TryLockError::WouldBlock) => Ok(None),
+        Err(fs::TryLockError::Error(e)) => Err(e),
+    }
+}
+
+/// An entry other than the one being leased. Idle entries are locked until
+/// this is dropped, so they may be evicted.
+struct Other {
+    used: SystemTime,
+    size: u64,
+    lock: Option<File>,
+    path: PathBuf,
+}
+
+fn others(ram_dir: &Path, name: &str) -> io::Result<Vec<Other>> {
+    let mut others = Vec::new();
+    for entry in fs::read_dir(ram_dir)? {
+        let entry = entry?;
+        let file_name = entry.file_name();
+        let Some(other) = file_name.to_str() else {
+            continue;
+        };
+        if other == name || !is_entry_name(other) {
+            continue;
+        }
+        let path = entry.path();
+        let lock = try_lock(&path)?;
+        // an idle entry recorded its size when its last build finished,
+        // one in use is measured as it is now
+        let size = fs::read_to_string(path.join("size"))
+            .ok()
+            .filter(|_| lock.is_some())
+            .and_then(|s| s.trim().parse().ok())
+            .unwrap_or_else(|| dir_size(&path));
+        others.push(Other {
+            used: entry.metadata()?.modified()?,
+            size,
+            lock,
+            path,
+        });
+    }
+    // least recently used first
+    others.sort_by_key(|other| other.used);
+    Ok(others)
+}
+
+/// Point `build_dir` at `dest`, replacing whatever link or dir is there.
+fn link_build_dir(build_dir: &Path, dest: &Path) -> Result<()> {
+    if fs::read_link(build_dir).is_ok_and(|link| link == dest) {
+        return Ok(());
+    }
+    if fs::symlink_metadata(build_dir).is_ok() {
+        remove_all(build_dir)?;
+    }
+    crate::cook::fs::symlink(dest, build_dir)
+}
+
+/// Remove `build_dir` if it is a link into RAM. The entry it points to is
+/// left for eviction, as another process may be using it.
+fn unlink_build_dir(build_dir: &Path) -> Result<()> {
+    if fs::symlink_metadata(build_dir).is_ok_and(|meta| meta.is_symlink()) {
+        fs::remove_file(build_dir).map_err(wrap_io_err!(build_dir, "Removing link"))?;
+    }
+    Ok(())
+}
+
+/// Remove a build dir, along with its entry in RAM if it is a link to one.
+pub fn remove_build_dir(build_dir: &Path) -> Result<()> {
+    if let Ok(dest) = fs::read_link(build_dir) {
+        if let Some(entry) = dest.parent()
+            && entry.is_dir()
+        {
+            fs::remove_dir_all(entry).map_err(wrap_io_err!(entry, "Removing RAM build dir"))?;
+        }
+        return fs::remove_file(build_dir).map_err(wrap_io_err!(build_dir, "Removing link"));
+    }
+    if build_dir.is_dir() {
+        remove_all(build_dir)?;
+    }
+    Ok(())
+}
+
+/// Set up `build_dir` in RAM for building `recipe`, cleaned if `clean`, with
+/// an empty stage dir next to it. Returns None if the build has to happen on
+/// disk, leaving `build_dir` a real dir or absent.
+pub fn lease(
+    recipe: &CookRecipe,
+    build_dir: &Path,
+    clean: bool,
+    config: &CookConfig,
+    logger: &PtyOut,
+) -> Result<Option<Lease>> {
+    let Some(ram_dir) = &config.ram_dir else {
+        // built in RAM while it was enabled
+        unlink_build_dir(build_dir)?;
+        return Ok(None);
+    };
+    if !clean && fs::symlink_metadata(build_dir).is_ok_and(|meta| meta.is_dir()) {
+        log_debug!(logger, "keeping build dir on disk");
+        return Ok(None);
+    }
+    let need = expected_size(recipe);
+    if need > config.ram_budget {
+        log_debug!(logger, "building on disk, expected {} MiB", need / MIB);
+        unlink_build_dir(build_dir)?;
+        return Ok(None);
+    }
+
+    fs::create_dir_all(ram_dir).map_err(wrap_io_err!(ram_dir, "Creating RAM dir"))?;
+    // build_dir links here
+    let ram_dir = &std::path::absolute(ram_dir).map_err(wrap_io_err!(ram_dir, "Resolving"))?;
+    let name = entry_name(build_dir)?;
+    let entry = ram_dir.join(&name);
+    let mut reserved = RESERVED.lock().unwrap();
+    let others = others(ram_dir, &name).map_err(wrap_io_err!(ram_dir, "Reading RAM dir"))?;
+
+    let mut used = *reserved + others.iter().map(|other| other.size).sum::<u64>();
+    let fits = |used: u64| {
+        used + need <= config.ram_budget && free_space(ram_dir).is_none_or(|free| need <= free)
+    };
+    let mut idle = others.iter().filter(|other| other.lock.is_some());
+    while !fits(used) {
+        let Some(victim) = idle.next() else {
+            break;
+        };
+        // build systems record absolute paths, so an evicted
+        // build dir can't be moved to disk and is rebuilt instead
+        fs::remove_dir_all(&victim.path).map_err(wrap_io_err!(victim.path, "Evicting"))?;
+        used -= victim.size;
+    }
+    if !fits(used) {
+        log_debug!(
+            logger,
+            "building on disk, {} of {} MiB in RAM used",
+            used / MIB,
+            config.ram_budget / MIB
+        );
+        unlink_build_dir(build_dir)?;
+        return Ok(None);
+    }
+
+    fs::create_dir_all(&entry).map_err(wrap_io_err!(entry, "Creating RAM build dir"))?;
+    let Some(lock) = try_lock(&entry).map_err(wrap_io_err!(entry, "Locking"))? else {
+        // the same recipe is built by another process
+        log_debug!(logger, "building on disk, RAM build dir is in use");
+        unlink_build_dir(build_dir)?;
+        return Ok(None);
+    };
+    let ram_build = entry.join("build");
+    if clean && ram_build.is_dir() {
+        fs::remove_dir_all(&ram_build).map_err(wrap_io_err!(ram_build, "Cleaning"))?;
+    }
+    let ram_stage = entry.join("stage.tmp");
+    if ram_stage.is_dir() {
+        fs::remove_dir_all(&ram_stage).map_err(wrap_io_err!(ram_stage, "Cleaning"))?;
+    }
+    for dir in [&ram_build, &ram_stage] {
+        fs::create_dir_all(dir).map_err(wrap_io_err!(dir, "Creating RAM build dir"))?;
+    }
+    let _ = File::open(&entry).and_then(|dir| dir.set_modified(SystemTime::now()));
+    link_build_dir(build_dir, &ram_build)?;
+    log_debug!(logger, "building in {}", ram_build.display());
+
+    *reserved += need;
+    Ok(Some(Lease {
+        entry,
+        reserved: need,
+        _lock: lock,
+    }))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn entries_are_locked_and_measured() {
+        let root = std::env::temp_dir().join(format!("cook-scratch-{}", std::process::id()));
+        let _ = fs::remove_dir_all(&root);
+        let a = root.join("0123456789abcdef");
+        let b = root.join("fedcba9876543210");
+        fs::create_dir_all(&a).unwrap();
+        fs::create_dir_all(root.join("fedcba9876543210/build")).unwrap();
+        fs::create_dir_all(root.join(".trash")).unwrap();
+        fs::write(b.join("size"), "4096").unwrap();
+
+        let held = try_lock(&a).unwrap().unwrap();
+        assert!(try_lock(&a).unwrap().is_none());
+        let others = others(&root, "none").unwrap();
+        assert_eq!(others.len(), 2);
+        let other_a = others.iter().find(|other| other.path == a).unwrap();
+        let other_b = others.iter().find(|other| other.path == b).unwrap();
+        assert!(other_a.lock.is_none());
+        assert!(other_b.lock.is_some());
+        assert_eq!(other_b.size, 4096);
+        drop(others);
+        drop(held);
+        assert!(try_lock(&a).unwrap().is_some());
+
+        fs::remove_dir_all(&root).unwrap();
+    }
+}
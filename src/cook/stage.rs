@@ -0,0 +1,309 @@
+//! Post-build processing of a fresh stage in a single traversal.
+//!
+//! The build script installs everything into `stage.tmp`. One walk over it
+//! routes files into the optional package stage dirs, records the file
+//! manifest of every stage and collects `DT_NEEDED` entries of binaries.
+
+use std::collections::{BTreeMap, BTreeSet};
+use std::ffi::OsStr;
+use std::fs::{self, File};
+use std::io::{self, Read};
+use std::path::{Path, PathBuf};
+use std::sync::Mutex;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::{str, thread};
+
+use globset::{Glob, GlobSet, GlobSetBuilder};
+
+use crate::cook::tree::format_size;
+use crate::recipe::OptionalPackageRecipe;
+use crate::{Result, wrap_io_err};
+
+/// Directories searched for dynamically linked binaries, relative to a stage.
+pub const ELF_DIRS: [&str; 4] = ["usr/bin", "usr/games", "usr/lib", "usr/libexec"];
+
+pub enum StageEntry {
+    File(u64),
+    Symlink(PathBuf),
+}
+
+/// What the traversal of a freshly built stage found.
+pub struct StageScan {
+    /// Files and symlinks of each stage dir, relative to it
+    pub manifests: Vec<Vec<(PathBuf, StageEntry)>>,
+    /// `DT_NEEDED` names, with the file that needs them relative to its stage
+    pub needed: Vec<(PathBuf, String)>,
+}
+
+impl StageScan {
+    /// Same listing as `tree::walk_file_tree` for the stage dir at `index`.
+    pub fn file_tree(&self, index: usize) -> Vec<String> {
+        let mut root = BTreeMap::new();
+        for (path, entry) in &self.manifests[index] {
+            let mut dir = &mut root;
+            let mut components = path.iter().peekable();
+            while let Some(name) = components.next() {
+                if components.peek().is_none() {
+                    dir.insert(name, TreeNode::Entry(entry));
+                    break;
+                }
+                let node = dir
+                    .entry(name)
+                    .or_insert_with(|| TreeNode::Dir(BTreeMap::new()));
+                let TreeNode::Dir(children) = node else {
+                    break;
+                };
+                dir = children;
+            }
+        }
+        let mut buffer = Vec::new();
+        render_tree(&root, "", &mut buffer);
+        buffer
+    }
+}
+
+enum TreeNode<'a> {
+    Dir(BTreeMap<&'a OsStr, TreeNode<'a>>),
+    Entry(&'a StageEntry),
+}
+
+fn render_tree(children: &BTreeMap<&OsStr, TreeNode>, prefix: &str, buffer: &mut Vec<String>) {
+    for (index, (name, node)) in children.iter().enumerate() {
+        let is_last = index == children.len() - 1;
+        let line_prefix = if is_last { "└── " } else { "├── " };
+        let file_name = name.to_str().unwrap_or("Unknown");
+        match node {
+            TreeNode::Dir(grandchildren) => {
+                buffer.push(format!("{}{}{}/", prefix, line_prefix, file_name));
+                let new_prefix = format!("{}{}", prefix, if is_last { "    " } else { "│   " });
+                render_tree(grandchildren, &new_prefix, buffer);
+            }
+            TreeNode::Entry(StageEntry::Symlink(target)) => buffer.push(format!(
+                "{}{}{} -> {:?}",
+                prefix,
+                line_prefix,
+                file_name,
+                target.display()
+            )),
+            TreeNode::Entry(StageEntry::File(size)) => buffer.push(format!(
+                "{}{}{} ({})",
+                prefix,
+                line_prefix,
+                file_name,
+                format_size(*size)
+            )),
+        }
+    }
+}
+
+/// `DT_NEEDED` entries of an ELF file, empty for anything else.
+pub fn elf_needed(path: &Path) -> Vec<String> {
+    let mut needed = Vec::new();
+    let Ok(mut file) = File::open(path) else {
+        return needed;
+    };
+    // most staged files are not ELF, don't bother the parser with them
+    let mut magic = [0; 4];
+    if file.read_exact(&mut magic).is_err() || &magic != b"\x7fELF" {
+        return needed;
+    }
+    let read_cache = object::ReadCache::new(file);
+    let Ok(object) = object::build::elf::Builder::read(&read_cache) else {
+        return needed;
+    };
+    let Some(dynamic_data) = object.dynamic_data() else {
+        return needed;
+    };
+    for dynamic in dynamic_data {
+        if let object::build::elf::Dynamic::String { tag, val } = dynamic
+            && *tag == object::elf::DT_NEEDED
+            && let Ok(name) = str::from_utf8(val)
+        {
+            needed.push(name.to_string());
+        }
+    }
+    needed
+}
+
+/// Routes stage files to optional packages by their `files` globs.
+struct Router {
+    globs: GlobSet,
+    /// stage index of each glob, in glob order
+    stages: Vec<usize>,
+}
+
+impl Router {
+    fn new(features: &[OptionalPackageRecipe]) -> Result<Self> {
+        let mut builder = GlobSetBuilder::new();
+        let mut stages = Vec::new();
+        for (i, feat) in features.iter().enumerate() {
+            for path in &feat.files {
+                builder.add(Glob::new(path).map_err(|e| format!("{}", e))?);
+                stages.push(i);
+            }
+        }
+        let globs = builder.build().map_err(|e| format!("{}", e))?;
+        Ok(Self { globs, stages })
+    }
+
+    /// The first matching glob wins, like the order in recipe.toml
+    fn route(&self, relpath: &Path) -> Option<usize> {
+        self.globs
+            .matches(relpath)
+            .first()
+            .map(|glob| self.stages[*glob])
+    }
+}
+
+/// Results of one worker
+struct Partial {
+    manifests: Vec<Vec<(PathBuf, StageEntry)>>,
+    needed: Vec<(PathBuf, String)>,
+}
+
+struct Splitter<'a> {
+    stage_tmp: &'a Path,
+    stage_dirs: &'a [PathBuf],
+    router: Router,
+}
+
+impl Splitter<'_> {
+    fn partial(&self) -> Partial {
+        Partial {
+            manifests: self.stage_dirs.iter().map(|_| Vec::new()).collect(),
+            needed: Vec::new(),
+        }
+    }
+
+    fn visit_file(&self, entry: fs::DirEntry, out: &mut Partial) -> io::Result<()> {
+        let path = entry.path();
+        let Ok(relpath) = path.strip_prefix(self.stage_tmp) else {
+            return Ok(());
+        };
+        let relpath = relpath.to_path_buf();
+        let metadata = entry.metadata()?;
+
+        // leftovers stay, since stage.tmp becomes the last stage dir
+        let last = self.stage_dirs.len() - 1;
+        let stage = self.router.route(&relpath).unwrap_or(last);
+        let path = if stage == last {
+            path
+        } else {
+            let dest = self.stage_dirs[stage].join(&relpath);
+            fs::create_dir_all(dest.parent().unwrap())?;
+            fs::rename(&path, &dest)?;
+            dest
+        };
+
+        let entry = if metadata.is_symlink() {
+            StageEntry::Symlink(fs::read_link(&path)?)
+        } else {
+            if metadata.is_file() && ELF_DIRS.iter().any(|dir| relpath.starts_with(dir)) {
+                for name in elf_needed(&path) {
+                    out.needed.push((relpath.clone(), name));
+                }
+            }
+            StageEntry::File(metadata.len())
+        };
+        out.manifests[stage].push((relpath, entry));
+        Ok(())
+    }
+
+    fn visit_dir(&self, dir: &Path, out: &mut Partial) -> io::Result<()> {
+        for entry in fs::read_dir(dir)? {
+            let entry = entry?;
+            if entry.file_type()?.is_dir() {
+                self.visit_dir(&entry.path(), out)?;
+            } else {
+                self.visit_file(entry, out)?;
+            }
+        }
+        Ok(())
+    }
+}
+
+/// Move files of `stage_tmp` matching optional package globs into their
+/// (already created) stage dirs and scan everything, in one traversal.
+///
+/// Directories two levels down, such as `usr/lib`, are processed in
+/// parallel by up to `jobs` threads.
+pub fn split_and_scan(
+    stage_tmp: &Path,
+    stage_dirs: &[PathBuf],
+    features: &[OptionalPackageRecipe],
+    jobs: usize,
+) -> Result<StageScan> {
+    let splitter = Splitter {
+        stage_tmp,
+        stage_dirs,
+        router: Router::new(features)?,
+    };
+    let wrap = wrap_io_err!(stage_tmp, "Moving to stages dir");
+
+    // files near the top are handled right away, subtrees queued
+    let mut main = splitter.partial();
+    let mut work = Vec::new();
+    let mut top_dirs = vec![stage_tmp.to_path_buf()];
+    for depth in 0..2 {
+        for dir in std::mem::take(&mut top_dirs) {
+            for entry in fs::read_dir(&dir).map_err(wrap)? {
+                let entry = entry.map_err(wrap)?;
+                if entry.file_type().map_err(wrap)?.is_dir() {
+                    if depth == 0 {
+                        top_dirs.push(entry.path());
+                    } else {
+                        work.push(entry.path());
+                    }
+                } else {
+                    splitter.visit_file(entry, &mut main).map_err(wrap)?;
+                }
+            }
+        }
+    }
+
+    let next = AtomicUsize::new(0);
+    let parts = Mutex::new(vec![main]);
+    let error = Mutex::new(None);
+    thread::scope(|s| {
+        for _ in 0..jobs.clamp(1, work.len().max(1)) {
+            s.spawn(|| {
+                let mut part = splitter.partial();
+                loop {
+                    let i = next.fetch_add(1, Ordering::SeqCst);
+                    let Some(dir) = work.get(i) else {
+                        break;
+                    };
+                    if let Err(e) = splitter.visit_dir(dir, &mut part) {
+                        error.lock().unwrap().get_or_insert(e);
+                        break;
+                    }
+                }
+                parts.lock().unwrap().push(part);
+            });
+        }
+    });
+    if let Some(e) = error.into_inner().unwrap() {
+        return Err(wrap(e));
+    }
+
+    let mut scan = StageScan {
+        manifests: stage_dirs.iter().map(|_| Vec::new()).collect(),
+        needed: Vec::new(),
+    };
+    for part in parts.into_inner().unwrap() {
+        for (manifest, entries) in scan.manifests.iter_mut().zip(part.manifests) {
+            manifest.extend(entries);
+        }
+        scan.needed.extend(part.needed);
+    }
+    for manifest in &mut scan.manifests {
+        manifest.sort_by(|a, b| a.0.cmp(&b.0));
+    }
+    scan.needed.sort();
+    Ok(scan)
+}
+
+/// Names of all `DT_NEEDED` entries.
+pub fn needed_names(needed: &[(PathBuf, String)]) -> BTreeSet<String> {
+    needed.iter().map(|(_, name)| name.clone()).collect()
+}
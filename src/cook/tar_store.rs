@@ -0,0 +1,232 @@
+//! Content-addressed store of source tarballs.
+//!
+//! Tarballs are stored once as `<blake3>.tar` under the directory configured
+//! by `tar_store`, and a recipe's `source.tar` becomes a symlink into it. Any
+//! recipe, wip duplicate or cookbook checkout that asks for the same blake3
+//! gets the stored file without downloading. Files are inserted through a
+//! private temporary name and renamed into place, so several processes can
+//! share one store. The least recently used tarballs are removed once the
+//! store grows over `tar_store_limit`.
+
+use std::fs::{self, File};
+use std::io;
+use std::os::unix::fs::PermissionsExt;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::SystemTime;
+
+use crate::cook::fetch::get_blake3;
+use crate::{Result, bail_other_err, wrap_io_err};
+
+static INSERTED: AtomicUsize = AtomicUsize::new(0);
+
+pub struct TarStore {
+    root: PathBuf,
+    /// maximum size in bytes, 0 for no limit
+    limit: u64,
+}
+
+fn is_blake3(hash: &str) -> bool {
+    hash.len() == 64 && hash.chars().all(|c| c.is_ascii_hexdigit())
+}
+
+impl TarStore {
+    pub fn open(root: &Path, limit: u64) -> Result<Self> {
+        let tmp = root.join("tmp");
+        fs::create_dir_all(&tmp).map_err(wrap_io_err!(tmp, "Creating tar store"))?;
+        let root = fs::canonicalize(root).map_err(wrap_io_err!(root, "Resolving tar store"))?;
+        Ok(Self { root, limit })
+    }
+
+    /// The store configured in cookbook.toml or by `COOKBOOK_TAR_STORE`, if any.
+    pub fn from_config() -> Result<Option<Self>> {
+        let config = &crate::config::get_config().cook;
+        match &config.tar_store {
+            Some(root) => Ok(Some(Self::open(root, config.tar_store_limit)?)),
+            None => Ok(None),
+        }
+    }
+
+    fn path(&self, blake3: &str) -> PathBuf {
+        self.root.join(format!("{blake3}.tar"))
+    }
+
+    /// Stored tarball with this hash, marked as recently used.
+    pub fn get(&self, blake3: &str) -> Option<PathBuf> {
+        if !is_blake3(blake3) {
+            return None;
+        }
+        let path = self.path(blake3);
+        let file = File::open(&path).ok()?;
+        let _ = file.set_modified(SystemTime::now());
+        Some(path)
+    }
+
+    /// Put `src`, whose content hashes to `blake3`, into the store. With `take`,
+    /// `src` is moved instead of copied when it is on the same filesystem.
+    pub fn insert(&self, src: &Path, blake3: &str, take: bool) -> Result<PathBuf> {
+        if !is_blake3(blake3) {
+            bail_other_err!("Invalid blake3 {blake3:?} for tar store");
+        }
+        let dest = self.path(blake3);
+        let tmp = self.root.join("tmp").join(format!(
+            "{}-{}",
+            std::process::id(),
+            INSERTED.fetch_add(1, Ordering::Relaxed)
+        ));
+        let moved = take && fs::rename(src, &tmp).is_ok();
+        if !moved {
+            fs::copy(src, &tmp).map_err(wrap_io_err!(src, tmp, "Copying into tar store"))?;
+        }
+        // symlinked source.tar must not be written through
+        fs::set_permissions(&tmp, fs::Permissions::from_mode(0o444))
+            .map_err(wrap_io_err!(tmp, "Setting permissions"))?;
+        // same content under the same name, so a concurrent insert is harmless
+        fs::rename(&tmp, &dest).map_err(wrap_io_err!(tmp, dest, "Renaming into tar store"))?;
+        self.prune(Some(&dest))?;
+        Ok(dest)
+    }
+
+    /// Replace `dest` with a symlink to the stored tarball with this hash.
+    /// Returns false if the store doesn't have it.
+    pub fn link(&self, blake3: &str, dest: &Path) -> Result<bool> {
+        let Some(stored) = self.get(blake3) else {
+            return Ok(false);
+        };
+        let tmp = dest.with_added_extension("link");
+        let _ = fs::remove_file(&tmp);
+        std::os::unix::fs::symlink(&stored, &tmp)
+            .map_err(wrap_io_err!(tmp, "Linking from tar store"))?;
+        fs::rename(&tmp, dest).map_err(wrap_io_err!(tmp, dest, "Linking from tar store"))?;
+        Ok(true)
+    }
+
+    /// Move a verified `source.tar` into the store and leave a symlink behind.
+    pub fn adopt(&self, source_tar: &Path, blake3: &str) -> Result<()> {
+        let meta = fs::symlink_metadata(source_tar)
+            .map_err(wrap_io_err!(source_tar, "Reading metadata"))?;
+        if meta.is_symlink() && self.get(blake3).is_some() {
+            return Ok(());
+        }
+        self.insert(source_tar, blake3, !meta.is_symlink())?;
+        self.link(blake3, source_tar)?;
+        Ok(())
+    }
+
+    /// Adopt `source_tar` if the store lacks this hash and the file matches it,
+    /// for recipes fetched before the store was set up.
+    pub fn adopt_if_matching(&self, source_tar: &Path, blake3: &str) -> Result<()> {
+        if self.get(blake3).is_none()
+            && source_tar.is_file()
+            && get_blake3(&source_tar.to_path_buf())? == blake3
+        {
+            self.adopt(source_tar, blake3)?;
+        }
+        Ok(())
+    }
+
+    /// Remove least recently used tarballs, other than `keep`, until the
+    /// store fits its limit.
+    pub fn prune(&self, keep: Option<&Path>) -> Result<()> {
+        if self.limit == 0 {
+            return Ok(());
+        }
+        let wrap = wrap_io_err!(self.root, "Reading tar store");
+        let mut stored = Vec::new();
+        let mut total = 0;
+        for entry in fs::read_dir(&self.root).map_err(wrap)? {
+            let entry = entry.map_err(wrap)?;
+            let meta = entry.metadata().map_err(wrap)?;
+            if !meta.is_file() {
+                continue;
+            }
+            total += meta.len();
+            if keep.is_some_and(|keep| keep == entry.path()) {
+                continue;
+            }
+            stored.push((meta.modified().map_err(wrap)?, meta.len(), entry.path()));
+        }
+        stored.sort();
+        for (_, size, path) in stored {
+            if total <= self.limit {
+                break;
+            }
+            match fs::remove_file(&path) {
+                Err(e) if e.kind() != io::ErrorKind::NotFound => {
+                    return Err(wrap_io_err!(path, "Pruning tar store")(e));
+                }
+                _ => total -= size,
+            }
+        }
+        Ok(())
+    }
+
+    /// Copy the tarball with this hash to `dir/<blake3>.tar`.
+    /// Returns false if the store doesn't have it.
+    pub fn export(&self, blake3: &str, dir: &Path) -> Result<bool> {
+        let Some(stored) = self.get(blake3) else {
+            return Ok(false);
+        };
+        let dest = dir.join(format!("{blake3}.tar"));
+        if !dest.is_file() {
+            fs::copy(&stored, &dest).map_err(wrap_io_err!(stored, dest, "Exporting tarball"))?;
+        }
+        Ok(true)
+    }
+
+    /// Insert `dir/<blake3>.tar` after checking its content.
+    /// Returns false if there is no such file.
+    pub fn import(&self, blake3: &str, dir: &Path) -> Result<bool> {
+        let src = dir.join(format!("{blake3}.tar"));
+        if !src.is_file() {
+            return Ok(false);
+        }
+        if self.get(blake3).is_none() {
+            let actual = get_blake3(&src)?;
+            if actual != blake3 {
+                bail_other_err!("{:?} has blake3 {actual:?}", src.display());
+            }
+            self.insert(&src, blake3, false)?;
+        }
+        Ok(true)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn adopt_link_and_prune() {
+        let root = std::env::temp_dir().join(format!("cook-tar-store-{}", std::process::id()));
+        let _ = fs::remove_dir_all(&root);
+        fs::create_dir_all(root.join("recipe")).unwrap();
+        let store = TarStore::open(&root.join("store"), 6).unwrap();
+
+        let a = "a".repeat(64);
+        let b = "b".repeat(64);
+        let source_tar = root.join("recipe/source.tar");
+        fs::write(&source_tar, b"aaaa").unwrap();
+        store.adopt(&source_tar, &a).unwrap();
+        assert!(fs::symlink_metadata(&source_tar).unwrap().is_symlink());
+        assert_eq!(fs::read(&source_tar).unwrap(), b"aaaa");
+
+        let other = root.join("recipe/other.tar");
+        assert!(store.link(&a, &other).unwrap());
+        assert!(!store.link(&b, &other).unwrap());
+
+        // the older tarball goes once both don't fit
+        let past = SystemTime::UNIX_EPOCH + std::time::Duration::from_secs(1);
+        File::open(store.path(&a))
+            .unwrap()
+            .set_modified(past)
+            .unwrap();
+        fs::write(root.join("b.tar"), b"bbbb").unwrap();
+        store.insert(&root.join("b.tar"), &b, false).unwrap();
+        assert!(store.get(&a).is_none());
+        assert!(store.get(&b).is_some());
+        assert!(!source_tar.is_file());
+
+        fs::remove_dir_all(&root).unwrap();
+    }
+}
@@ -0,0 +1,228 @@
+//! Background deletion of large directories.
+//!
+//! Removing a build tree of llvm or gcc takes long enough to stall a recipe.
+//! [`discard`] renames a directory into a `.trash` directory on the same
+//! filesystem, which is atomic and instant, and leaves the unlinking to a few
+//! reaper threads running at idle I/O priority. Whatever is left in a trash
+//! directory when the process exits is reaped by the next run.
+
+use std::collections::{HashMap, VecDeque};
+use std::fs;
+use std::io;
+use std::os::unix::fs::MetadataExt;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Condvar, LazyLock, Mutex};
+use std::thread;
+
+use crate::{Result, wrap_io_err};
+
+/// Number of reaper threads.
+const REAPERS: usize = 4;
+
+struct Reaper {
+    queue: Mutex<VecDeque<PathBuf>>,
+    ready: Condvar,
+    /// trash dir of each filesystem, by device id
+    trash_dirs: Mutex<HashMap<u64, PathBuf>>,
+}
+
+static REAPER: LazyLock<Reaper> = LazyLock::new(|| {
+    for i in 0..REAPERS {
+        thread::Builder::new()
+            .name(format!("trash-reaper-{i}"))
+            .spawn(reap_loop)
+            .expect("Unable to spawn trash reaper");
+    }
+    Reaper {
+        queue: Mutex::new(VecDeque::new()),
+        ready: Condvar::new(),
+        trash_dirs: Mutex::new(HashMap::new()),
+    }
+});
+
+static TRASHED: AtomicUsize = AtomicUsize::new(0);
+
+impl Reaper {
+    fn push(&self, path: PathBuf) {
+        self.queue.lock().unwrap().push_back(path);
+        self.ready.notify_one();
+    }
+
+    /// Trash dir on the filesystem `dev`, next to `path` unless the shared
+    /// `build/.trash` is on the same filesystem. Leftovers found in it when
+    /// it is first used are queued for deletion.
+    fn trash_dir(&self, dev: u64, path: &Path) -> io::Result<PathBuf> {
+        let mut trash_dirs = self.trash_dirs.lock().unwrap();
+        if let Some(dir) = trash_dirs.get(&dev) {
+            return Ok(dir.clone());
+        }
+        let build_dir = Path::new("build");
+        let dir = match fs::metadata(build_dir) {
+            Ok(mt) if mt.is_dir() && mt.dev() == dev => fs::canonicalize(build_dir)?.join(".trash"),
+            _ => path
+                .parent()
+                .ok_or_else(|| io::Error::from(io::ErrorKind::InvalidInput))?
+                .join(".trash"),
+        };
+        fs::create_dir_all(&dir)?;
+        for entry in fs::read_dir(&dir)? {
+            self.push(entry?.path());
+        }
+        trash_dirs.insert(dev, dir.clone());
+        Ok(dir)
+    }
+
+    /// Move `path` into the trash dir of its filesystem.
+    fn trash(&self, path: &Path, dev: u64) -> io::Result<PathBuf> {
+        let dir = self.trash_dir(dev, path)?;
+        let name = path.file_name().unwrap_or_default().to_string_lossy();
+        let dest = dir.join(format!(
+            "{}-{}-{}",
+            std::process::id(),
+            TRASHED.fetch_add(1, Ordering::Relaxed),
+            name
+        ));
+        fs::rename(path, &dest)?;
+        Ok(dest)
+    }
+}
+
+/// Let the reaper threads yield to the build for disk and CPU time.
+#[cfg(target_os = "linux")]
+fn lower_priority() {
+    const IOPRIO_CLASS_IDLE: libc::c_long = 3;
+    const IOPRIO_CLASS_SHIFT: libc::c_long = 13;
+    const IOPRIO_WHO_PROCESS: libc::c_long = 1;
+    unsafe {
+        // with who = 0, both apply to the calling thread only
+        libc::syscall(
+            libc::SYS_ioprio_set,
+            IOPRIO_WHO_PROCESS,
+            0,
+            IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT,
+        );
+        libc::setpriority(libc::PRIO_PROCESS, 0, 19);
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+fn lower_priority() {}
+
+fn reap_loop() {
+    lower_priority();
+    let reaper = &*REAPER;
+    loop {
+        let path = {
+            let mut queue = reaper.queue.lock().unwrap();
+            loop {
+                if let Some(path) = queue.pop_front() {
+                    break path;
+                }
+                queue = reaper.ready.wait(queue).unwrap();
+            }
+        };
+        reap(reaper, &path);
+    }
+}
+
+/// Delete one trashed path. Subdirectories are renamed out as separate
+/// items first, so other reapers can work on them in parallel.
+fn reap(reaper: &Reaper, path: &Path) {
+    let Ok(mt) = fs::symlink_metadata(path) else {
+        return;
+    };
+    if !mt.is_dir() {
+        let _ = fs::remove_file(path);
+        return;
+    }
+    if let Ok(entries) = fs::read_dir(path) {
+        for entry in entries.flatten() {
+            let child = entry.path();
+            match entry.file_type() {
+                Ok(kind) if kind.is_dir() => match reaper.trash(&child, mt.dev()) {
+                    Ok(dest) => reaper.push(dest),
+                    Err(_) => {
+                        let _ = fs::remove_dir_all(&child);
+                    }
+                },
+                _ => {
+                    let _ = fs::remove_file(&child);
+                }
+            }
+        }
+    }
+    // also catches whatever could not be removed entry by entry above
+    let _ = fs::remove_dir_all(path);
+}
+
+/// Remove the directory at `path` in the background. The path is free for
+/// reuse when this returns. Falls back to removing it in place if it can't
+/// be moved to a trash dir.
+pub fn discard(path: &Path) -> Result<()> {
+    let mt = fs::symlink_metadata(path).map_err(wrap_io_err!(path, "Reading metadata"))?;
+    if !mt.is_dir() {
+        return fs::remove_file(path).map_err(wrap_io_err!(path, "Removing file"));
+    }
+    let reaper = &*REAPER;
+    match reaper.trash(path, mt.dev()) {
+        Ok(dest) => {
+            reaper.push(dest);
+            Ok(())
+        }
+        Err(_) => fs::remove_dir_all(path).map_err(wrap_io_err!(path, "Removing all")),
+    }
+}
+
+/// Queue what earlier runs left in the shared trash dir for deletion.
+pub fn reap_leftovers() {
+    if let Ok(mt) = fs::metadata("build")
+        && mt.is_dir()
+    {
+        let _ = REAPER.trash_dir(mt.dev(), Path::new("build/.trash"));
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::time::{Duration, Instant};
+
+    #[test]
+    fn discard_frees_path_and_reaps() {
+        let root = std::env::temp_dir().join(format!("cook-trash-{}", std::process::id()));
+        let victim = root.join("build");
+        fs::create_dir_all(victim.join("a/b/c")).unwrap();
+        fs::create_dir_all(victim.join("d")).unwrap();
+        fs::write(victim.join("a/b/c/file"), b"x").unwrap();
+        fs::write(victim.join("top"), b"y").unwrap();
+
+        discard(&victim).unwrap();
+        assert!(!victim.exists());
+        fs::create_dir(&victim).unwrap();
+
+        let dev = fs::metadata(&root).unwrap().dev();
+        let trash = REAPER
+            .trash_dirs
+            .lock()
+            .unwrap()
+            .get(&dev)
+            .cloned()
+            .unwrap();
+        let ours = format!("{}-", std::process::id());
+        let deadline = Instant::now() + Duration::from_secs(10);
+        loop {
+            let left = fs::read_dir(&trash)
+                .unwrap()
+                .flatten()
+                .filter(|e| e.file_name().to_string_lossy().starts_with(&ours))
+                .count();
+            if left == 0 {
+                break;
+            }
+            assert!(Instant::now() < deadline, "trash was not reaped");
+            thread::sleep(Duration::from_millis(10));
+        }
+        fs::remove_dir_all(&root).unwrap();
+    }
+}
@@ -34,7 +34,7 @@ pub fn display_tree_entry(
         visited,
         total_size,
         total_count,
-        display_pkg_fn,
+        &mut display_pkg_fn,
     )
 }
 
@@ -47,7 +47,7 @@ pub fn walk_tree_entry(
     visited: &mut HashSet<PackageName>,
     total_size: &mut u64,
     total_count: &mut u64,
-    op: fn(&PackageName, &str, bool, &WalkTreeEntry) -> Result<bool>,
+    op: &mut dyn FnMut(&PackageName, &str, bool, &WalkTreeEntry) -> Result<bool>,
 ) -> Result<()> {
     let cook_recipe = match recipe_map.get(package_name) {
         Some(r) => r,
@@ -232,4 +232,4 @@ pub(crate) use wrap_other_err;
 
 pub(crate) use bail_other_err;
 
-pub(crate) use cook::pty::log_to_pty;
+pub(crate) use cook::log::{log_debug, log_info, log_warn};
@@ -125,6 +125,13 @@ pub struct BuildRecipe {
     pub dependencies: Vec<PackageName>,
     #[serde(rename = "dev-dependencies")]
     pub dev_dependencies: Vec<PackageName>,
+    /// Expected peak memory of the build in MiB, used until one is recorded
+    #[serde(rename = "peak-memory", skip_serializing_if = "Option::is_none")]
+    pub peak_memory: Option<u64>,
+    /// Expected size of the build and stage dirs in MiB, used until one is
+    /// recorded
+    #[serde(rename = "build-size", skip_serializing_if = "Option::is_none")]
+    pub build_size: Option<u64>,
 }
 
 #[derive(Debug, Clone, Default, Deserialize, PartialEq, Serialize)]
@@ -450,6 +457,15 @@ impl CookRecipe {
         cook_package::package_stage_paths(r.as_ref(), &self.target_dir())
     }
 
+    /// Clone this recipe to be built for another target. Host recipes are kept as is.
+    pub fn with_target(&self, target: &'static str) -> Self {
+        let mut recipe = self.clone();
+        if !self.name.is_host() {
+            recipe.target = target;
+        }
+        recipe
+    }
+
     pub fn target_dir(&self) -> PathBuf {
         self.dir.join("target").join(self.target)
     }